@@ -0,0 +1,32 @@
+#include "arena.h"
+
+#include <cstdlib>
+
+namespace CMU462 {
+
+void* Arena::allocate_block( size_t size, size_t align ) {
+
+  // large requests get a block of their own, so that the current block
+  // keeps serving the small ones
+  if (size + align > block_size / 4) {
+    char* block = (char*) malloc(size + align);
+    if (!block) throw std::bad_alloc();
+    blocks.push_back(block);
+    return block + ((align - (size_t) block % align) & (align - 1));
+  }
+
+  char* block = (char*) malloc(block_size);
+  if (!block) throw std::bad_alloc();
+  blocks.push_back(block);
+
+  head = block; left = block_size;
+  return allocate(size, align);
+}
+
+void Arena::release() {
+  for (size_t i = 0; i < blocks.size(); ++i) free(blocks[i]);
+  blocks.clear();
+  head = NULL; left = 0;
+}
+
+} // namespace CMU462
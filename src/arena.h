@@ -0,0 +1,56 @@
+#ifndef CMU462_ARENA_H
+#define CMU462_ARENA_H
+
+#include <new>
+#include <vector>
+#include <stddef.h>
+
+namespace CMU462 {
+
+/**
+ * Monotonic allocator. Memory is carved out of large blocks in order and
+ * is only given back all at once, when the arena is released or destroyed.
+ * Destructors of the objects created in an arena are not run by it; their
+ * owner runs the ones that matter before releasing the arena.
+ */
+class Arena {
+ public:
+
+  Arena( size_t block_size = 64 * 1024 )
+    : block_size ( block_size ), head ( NULL ), left ( 0 ) { }
+
+  ~Arena() { release(); }
+
+  // Allocate size bytes aligned to align (a power of two).
+  void* allocate( size_t size, size_t align ) {
+    size_t pad = (align - (size_t) head % align) & (align - 1);
+    if (size + pad > left) return allocate_block(size, align);
+    void* p = head + pad;
+    head += size + pad; left -= size + pad;
+    return p;
+  }
+
+  // Default construct a T in the arena.
+  template<typename T> T* create() {
+    return new (allocate(sizeof(T), alignof(T))) T();
+  }
+
+  // Free all the blocks.
+  void release();
+
+ private:
+
+  size_t block_size;
+  char* head; size_t left;
+  std::vector<char*> blocks;
+
+  void* allocate_block( size_t size, size_t align );
+
+  Arena( const Arena& );
+  Arena& operator=( const Arena& );
+
+}; // class Arena
+
+} // namespace CMU462
+
+#endif // CMU462_ARENA_H
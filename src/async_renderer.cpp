@@ -0,0 +1,247 @@
+#include "async_renderer.h"
+
+#include <chrono>
+#include <cstring>
+
+using namespace std;
+
+namespace CMU462 {
+
+// previews drop to half resolution above this frame time (seconds)
+static const double PREVIEW_BUDGET = 1.0 / 60;
+
+AsyncRenderer::AsyncRenderer( Sampler2D* sampler )
+  : target_w ( 0 ), target_h ( 0 ), target_sample_rate ( 1 ),
+    preview_time ( 0 ),
+    pending ( false ), busy ( false ), job_preview ( false ), quit ( false ),
+    tiled ( false ),
+    frame_w ( 0 ), frame_h ( 0 ), frame_ready ( false ),
+    cancelled ( false ), tiles ( sampler ) {
+
+  renderer.set_tex_sampler(sampler);
+  renderer.set_cancel_flag(&cancelled);
+
+  worker = thread(&AsyncRenderer::run, this);
+}
+
+AsyncRenderer::~AsyncRenderer( void ) {
+
+  {
+    lock_guard<std::mutex> lock(mutex);
+    quit = true;
+    cancelled = true;
+  }
+  wake.notify_one();
+  worker.join();
+}
+
+void AsyncRenderer::request( const SVGScene* scene, const Matrix3x3& canvas_to_screen,
+                             size_t width, size_t height, size_t sample_rate ) {
+  Job job = { scene, canvas_to_screen, width, height, sample_rate, false, false };
+  post(job);
+}
+
+void AsyncRenderer::preview( const SVGScene* scene, const Matrix3x3& canvas_to_screen,
+                             size_t width, size_t height ) {
+  Job job = { scene, canvas_to_screen, width, height, 1, true, false };
+  post(job);
+}
+
+void AsyncRenderer::post( const Job& job ) {
+
+  {
+    lock_guard<std::mutex> lock(mutex);
+    this->job = job;
+    this->job.tiled = tiled;
+    pending = true;
+
+    // A preview in flight is left to finish, otherwise input arriving
+    // faster than previews render would cancel every one of them.
+    if (busy && !(job.preview && this->job_preview)) cancelled = true;
+  }
+  wake.notify_one();
+}
+
+void AsyncRenderer::cancel( void ) {
+
+  unique_lock<std::mutex> lock(mutex);
+  pending = false;
+  frame_ready = false;
+  if (busy) cancelled = true;
+  idle.wait(lock, [this] { return !busy; });
+}
+
+void AsyncRenderer::invalidate( void ) {
+
+  cancel();
+
+  // with the worker idle, nothing else touches the frame or the tiles
+  renderer.discard_frame();
+  tiles.clear();
+}
+
+void AsyncRenderer::set_tiled( bool tiled ) {
+  lock_guard<std::mutex> lock(mutex);
+  this->tiled = tiled;
+}
+
+bool AsyncRenderer::present( vector<unsigned char>& pixels,
+                             size_t width, size_t height ) {
+
+  lock_guard<std::mutex> lock(mutex);
+  if (!frame_ready) return false;
+  frame_ready = false;
+
+  // drop frames made for a previous window size
+  if (frame_w != width || frame_h != height) return false;
+
+  memcpy(&pixels[0], &frame[0], frame.size());
+  return true;
+}
+
+void AsyncRenderer::run( void ) {
+
+  unique_lock<std::mutex> lock(mutex);
+  while (true) {
+
+    wake.wait(lock, [this] { return pending || quit; });
+    if (quit) break;
+
+    Job current = job;
+    pending = false;
+    busy = true;
+    job_preview = current.preview;
+    cancelled = false;
+
+    if (current.tiled && current.width && current.height &&
+        TileCache::can_draw(current.canvas_to_screen)) {
+      draw_tiles(current, lock);
+      busy = false;
+      idle.notify_all();
+      continue;
+    }
+
+    // passes: 1x, then doubling the sample rate up to the requested one
+    vector<size_t> rates; size_t downsample = 1;
+    if (current.width && current.height) {
+      if (current.preview) {
+        rates.push_back(1);
+        if (preview_time > PREVIEW_BUDGET) downsample = 2;
+      } else {
+        for (size_t rate = 1; rate < current.sample_rate; rate *= 2) {
+          rates.push_back(rate);
+        }
+        rates.push_back(current.sample_rate);
+      }
+    }
+
+    for (size_t i = 0; i < rates.size(); ++i) {
+
+      lock.unlock();
+      double time = render(current, rates[i], downsample);
+      lock.lock();
+
+      // cancelled frames stop early and say nothing of the frame time
+      if (current.preview && !cancelled) {
+        preview_time = time * downsample * downsample;
+      }
+
+      // publish the pass unless the frame was cancelled, and go on with
+      // the next one unless there is a newer request
+      if (cancelled) break;
+      publish(current, downsample);
+      if (pending) break;
+    }
+
+    busy = false;
+    idle.notify_all();
+  }
+}
+
+void AsyncRenderer::draw_tiles( const Job& job, unique_lock<std::mutex>& lock ) {
+
+  // what is cached first (coarser tiles standing in for missing ones),
+  // then again once the missing tiles are rendered
+  for (int pass = 0; pass < 2; ++pass) {
+
+    lock.unlock();
+    size_t missing = 0;
+    if (pass == 0 || tiles.render(*job.scene, job.canvas_to_screen,
+                                  job.sample_rate, job.width, job.height,
+                                  &cancelled)) {
+      prepare(job.width, job.height, target_sample_rate);
+      renderer.discard_frame();
+      missing = tiles.composite(*job.scene, job.canvas_to_screen,
+                                job.sample_rate, &back_buffer[0],
+                                job.width, job.height);
+    }
+    lock.lock();
+
+    if (cancelled) return;
+    publish(job, 1);
+    if (!missing || pending) return;
+  }
+}
+
+void AsyncRenderer::prepare( size_t width, size_t height, size_t sample_rate ) {
+
+  // the render target is set before the sample rate, and both only when
+  // they change since each reallocates the sample buffer
+  if (width != target_w || height != target_h) {
+    target_w = width; target_h = height;
+    back_buffer.resize(4 * width * height);
+    renderer.set_render_target(&back_buffer[0], width, height);
+    target_sample_rate = 0;
+  }
+  if (sample_rate != target_sample_rate) {
+    target_sample_rate = sample_rate;
+    renderer.set_sample_rate(sample_rate);
+  }
+}
+
+double AsyncRenderer::render( const Job& job, size_t sample_rate,
+                              size_t downsample ) {
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  prepare((job.width  + downsample - 1) / downsample,
+          (job.height + downsample - 1) / downsample, sample_rate);
+
+  Matrix3x3 canvas_to_screen = job.canvas_to_screen;
+  for (int j = 0; j < 3; ++j) {
+    canvas_to_screen(0,j) /= downsample;
+    canvas_to_screen(1,j) /= downsample;
+  }
+
+  // the back buffer holds the last frame, which is reused when the view
+  // was only panned by whole pixels
+  renderer.set_canvas_to_screen(canvas_to_screen);
+  renderer.update_scene(*job.scene);
+
+  chrono::duration<double> time = chrono::steady_clock::now() - start;
+  return time.count();
+}
+
+void AsyncRenderer::publish( const Job& job, size_t downsample ) {
+
+  frame_w = job.width; frame_h = job.height;
+  frame_ready = true;
+
+  if (downsample == 1) {
+    frame.assign(back_buffer.begin(), back_buffer.end());
+    return;
+  }
+
+  // scale up by pixel replication
+  frame.resize(4 * frame_w * frame_h);
+  uint32_t* dst = (uint32_t*) &frame[0];
+  const uint32_t* src = (const uint32_t*) &back_buffer[0];
+  for (size_t y = 0; y < frame_h; ++y) {
+    const uint32_t* row = src + (y / downsample) * target_w;
+    for (size_t x = 0; x < frame_w; ++x) {
+      *dst++ = row[x / downsample];
+    }
+  }
+}
+
+} // namespace CMU462
@@ -0,0 +1,129 @@
+#ifndef CMU462_ASYNC_RENDERER_H
+#define CMU462_ASYNC_RENDERER_H
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "scene.h"
+#include "texture.h"
+#include "software_renderer.h"
+#include "tile_cache.h"
+
+namespace CMU462 {
+
+/**
+ * Software renderer running on a worker thread. Frames are requested with
+ * the view to draw and rendered into a back buffer; a finished frame is
+ * handed over by present, so the caller (the viewer's event callbacks)
+ * never waits for a render. Only the latest request matters: a new
+ * request cancels the frame in flight, which stops at the next primitive
+ * and is dropped (except for a preview, which is quick to finish), so the
+ * delay before a view change shows up is bounded by one frame.
+ *
+ * Frames are progressive. A request renders a sequence of passes, at 1x
+ * and then doubling the sample rate up to the requested one, and each
+ * pass is presented when it is done. A preview is a single 1x pass, at
+ * half resolution if full resolution 1x frames take longer than input
+ * events arrive. It is meant for frames requested during interaction.
+ *
+ * In tiled mode, views are drawn from a TileCache instead: the cached
+ * tiles are presented right away and the missing ones are rendered (all
+ * at the requested sample rate, previews included) and presented next.
+ *
+ * The scene and its textures are read by the worker while a frame is in
+ * flight, and tiles and the last frame drawn stay around. Call
+ * invalidate before changing or deleting them.
+ */
+class AsyncRenderer {
+ public:
+
+  AsyncRenderer( Sampler2D* sampler );
+
+  // stops the worker, dropping any frame in flight
+  ~AsyncRenderer( void );
+
+  // request a frame, replacing any request in flight
+  void request( const SVGScene* scene, const Matrix3x3& canvas_to_screen,
+                size_t width, size_t height, size_t sample_rate );
+
+  // request a fast preview frame, replacing any request in flight
+  void preview( const SVGScene* scene, const Matrix3x3& canvas_to_screen,
+                size_t width, size_t height );
+
+  // drop any requested or finished frame and wait for the worker to be idle
+  void cancel( void );
+
+  // cancel, and forget everything drawn so far
+  void invalidate( void );
+
+  // draw the next requests from tiles (see TileCache)
+  void set_tiled( bool tiled );
+
+  // copy the latest finished frame to pixels (width x height) if there is
+  // a new one of that size, returns true if it did
+  bool present( std::vector<unsigned char>& pixels, size_t width, size_t height );
+
+ private:
+
+  struct Job {
+    const SVGScene* scene;
+    Matrix3x3 canvas_to_screen;
+    size_t width, height;
+    size_t sample_rate;
+    bool preview;
+    bool tiled;
+  };
+
+  void post( const Job& job );
+  void run( void );
+
+  // size the back buffer and renderer, reallocating only what changed
+  void prepare( size_t width, size_t height, size_t sample_rate );
+
+  // draw a job from tiles, publishing as it goes. Called, and returns,
+  // with the mutex held.
+  void draw_tiles( const Job& job, std::unique_lock<std::mutex>& lock );
+
+  // render one pass of a job at 1/downsample of its resolution, returns
+  // its time in seconds
+  double render( const Job& job, size_t sample_rate, size_t downsample );
+
+  // copy the back buffer to the finished frame, scaling it up to the
+  // resolution of the job. Called with the mutex held.
+  void publish( const Job& job, size_t downsample );
+
+  // renderer and back buffer, used by the worker only
+  SoftwareRendererImp renderer;
+  std::vector<unsigned char> back_buffer;
+  size_t target_w, target_h, target_sample_rate;
+
+  // time of a full resolution 1x frame, estimated from the last preview
+  double preview_time;
+
+  // state shared with the worker, guarded by mutex
+  std::mutex mutex;
+  std::condition_variable wake;  // a job is pending, or quit
+  std::condition_variable idle;  // the worker finished or dropped a job
+  Job job; bool pending; bool busy; bool job_preview; bool quit;
+  bool tiled;
+
+  // finished frame, guarded by mutex
+  std::vector<unsigned char> frame;
+  size_t frame_w, frame_h; bool frame_ready;
+
+  // set to stop the frame in flight
+  std::atomic<bool> cancelled;
+
+  // tiles, used by the worker only
+  TileCache tiles;
+
+  std::thread worker;
+
+}; // class AsyncRenderer
+
+} // namespace CMU462
+
+#endif // CMU462_ASYNC_RENDERER_H
@@ -0,0 +1,228 @@
+#include "base64_decoder.h"
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BASE64_X86
+#include <tmmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace CMU462 {
+
+// Decode table //
+
+static const unsigned char B64_INVALID = 0xff;
+static const unsigned char B64_SPACE   = 0xfe;
+static const unsigned char B64_PAD     = 0xfd;
+
+struct DecodeTable {
+  unsigned char value[256];
+  DecodeTable() {
+    const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                           "abcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (int i = 0; i < 256; i++) value[i] = B64_INVALID;
+    for (int i = 0; i < 64; i++) value[(unsigned char) alphabet[i]] = i;
+    value[(unsigned char) ' ' ] = B64_SPACE;
+    value[(unsigned char) '\t'] = B64_SPACE;
+    value[(unsigned char) '\n'] = B64_SPACE;
+    value[(unsigned char) '\r'] = B64_SPACE;
+    value[(unsigned char) '=' ] = B64_PAD;
+  }
+};
+
+static const unsigned char* decode_table() {
+  static const DecodeTable table;
+  return table.value;
+}
+
+// Block decoders //
+
+/**
+ * A block decoder decodes whole blocks of base64 characters and stops at
+ * the first block containing anything outside the alphabet (whitespace,
+ * padding, garbage), leaving that block to the scalar decoder. It returns
+ * the number of characters consumed, each 4 of which produce 3 bytes.
+ * Blocks are stored with full vector stores, so the output needs a few
+ * bytes of slack past the decoded data.
+ */
+typedef size_t (*BlockDecoder)( const char* in, size_t length,
+                                unsigned char* out );
+
+#ifdef BASE64_X86
+
+// Character classification and sextet lookup by nibble, as described in
+// W. Mula, D. Lemire, "Faster Base64 Encoding and Decoding Using AVX2
+// Instructions". A character is valid if the low and high nibble lookups
+// share no bit, and its sextet is the character plus an offset selected
+// by its high nibble ('/' being the one exception).
+
+__attribute__((target("ssse3")))
+static size_t decode_blocks_ssse3( const char* in, size_t length,
+                                   unsigned char* out ) {
+
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+                                       0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                       0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                       0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                         0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  const __m128i slash  = _mm_set1_epi8('/');
+  const __m128i merge_pairs = _mm_set1_epi32(0x01400140);
+  const __m128i merge_quads = _mm_set1_epi32(0x00011000);
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                     14, 13, 12, -1, -1, -1, -1);
+
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16, out += 12) {
+
+    __m128i v  = _mm_loadu_si128((const __m128i*) (in + i));
+    __m128i hi = _mm_and_si128(_mm_srli_epi32(v, 4), nibble);
+    __m128i lo = _mm_and_si128(v, nibble);
+
+    __m128i check = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo),
+                                  _mm_shuffle_epi8(lut_hi, hi));
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(check, _mm_setzero_si128()))) break;
+
+    __m128i roll = _mm_shuffle_epi8(lut_roll,
+                                    _mm_add_epi8(_mm_cmpeq_epi8(v, slash), hi));
+    __m128i sextets = _mm_add_epi8(v, roll);
+
+    // 4 x 6 bits -> 24 bits per 32-bit lane, then compact to 12 bytes
+    __m128i merged = _mm_madd_epi16(_mm_maddubs_epi16(sextets, merge_pairs),
+                                    merge_quads);
+    _mm_storeu_si128((__m128i*) out, _mm_shuffle_epi8(merged, pack));
+  }
+
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t decode_blocks_avx2( const char* in, size_t length,
+                                  unsigned char* out ) {
+
+  const __m256i lut_lo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lut_hi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i slash  = _mm256_set1_epi8('/');
+  const __m256i merge_pairs = _mm256_set1_epi32(0x01400140);
+  const __m256i merge_quads = _mm256_set1_epi32(0x00011000);
+  const __m256i pack = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32, out += 24) {
+
+    __m256i v  = _mm256_loadu_si256((const __m256i*) (in + i));
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), nibble);
+    __m256i lo = _mm256_and_si256(v, nibble);
+
+    __m256i check = _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo),
+                                     _mm256_shuffle_epi8(lut_hi, hi));
+    if (!_mm256_testz_si256(check, check)) break;
+
+    __m256i roll = _mm256_shuffle_epi8(lut_roll,
+                        _mm256_add_epi8(_mm256_cmpeq_epi8(v, slash), hi));
+    __m256i sextets = _mm256_add_epi8(v, roll);
+
+    __m256i merged = _mm256_madd_epi16(_mm256_maddubs_epi16(sextets, merge_pairs),
+                                       merge_quads);
+    merged = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(merged, pack), lanes);
+    _mm256_storeu_si256((__m256i*) out, merged);
+  }
+
+  // finish with 16 character blocks
+  return i + decode_blocks_ssse3(in + i, length - i, out);
+}
+
+#endif // BASE64_X86
+
+static BlockDecoder block_decoder() {
+#ifdef BASE64_X86
+  static BlockDecoder decoder = __builtin_cpu_supports("avx2")  ? decode_blocks_avx2  :
+                                __builtin_cpu_supports("ssse3") ? decode_blocks_ssse3 : 0;
+  return decoder;
+#else
+  return 0;
+#endif
+}
+
+// vector stores write up to this many bytes past the decoded data
+static const size_t BLOCK_SLACK = 32;
+
+int base64_decode_into( std::vector<unsigned char>& out, size_t& size,
+                        const char* text, size_t length ) {
+
+  size_t capacity = (length + 3) / 4 * 3 + BLOCK_SLACK;
+  if (out.size() < capacity) out.resize(capacity);
+
+  const unsigned char* table = decode_table();
+  BlockDecoder blocks = block_decoder();
+  const unsigned char* in = (const unsigned char*) text;
+  unsigned char* o = &out[0];
+
+  size_t i = 0;
+  uint32_t bits = 0; int count = 0;
+  while (i < length) {
+
+    // on a quad boundary, decode as much as possible in bulk
+    if (count == 0) {
+      if (blocks) {
+        size_t n = blocks(text + i, length - i, o);
+        i += n; o += n / 4 * 3;
+      }
+      for (; i + 4 <= length; i += 4, o += 3) {
+        uint32_t a = table[in[i + 0]], b = table[in[i + 1]],
+                 c = table[in[i + 2]], d = table[in[i + 3]];
+        if ((a | b | c | d) & 0xc0) break;
+        uint32_t q = (a << 18) | (b << 12) | (c << 6) | d;
+        o[0] = q >> 16; o[1] = q >> 8; o[2] = q;
+      }
+      if (i >= length) break;
+    }
+
+    // one character at a time around whitespace and padding
+    unsigned char v = table[in[i++]];
+    if (v < 64) {
+      bits = (bits << 6) | v;
+      if (++count == 4) {
+        o[0] = bits >> 16; o[1] = bits >> 8; o[2] = bits;
+        o += 3; bits = 0; count = 0;
+      }
+    } else if (v == B64_PAD) {
+      break;
+    } else if (v != B64_SPACE) {
+      return 1;
+    }
+  }
+
+  // trailing partial quad, a single character does not make a byte
+  if (count == 1) {
+    return 1;
+  } else if (count == 2) {
+    *o++ = bits >> 4;
+  } else if (count == 3) {
+    *o++ = bits >> 10; *o++ = bits >> 2;
+  }
+
+  size = o - &out[0];
+  return 0;
+}
+
+} // namespace CMU462
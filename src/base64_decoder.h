@@ -0,0 +1,23 @@
+#ifndef CMU462_BASE64_DECODER_H
+#define CMU462_BASE64_DECODER_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace CMU462 {
+
+/**
+ * Decode length characters of base64 text into out, skipping whitespace.
+ * Decoding stops at the first padding character. The decoded bytes are
+ * written to the front of out, which is grown as needed but never shrunk,
+ * so the same buffer can be reused across calls without reallocating.
+ * On success the number of decoded bytes is stored in size and 0 is
+ * returned, otherwise 1 is returned for a character outside the base64
+ * alphabet or for a single character left over after the last full quad.
+ */
+int base64_decode_into( std::vector<unsigned char>& out, size_t& size,
+                        const char* text, size_t length );
+
+} // namespace CMU462
+
+#endif // CMU462_BASE64_DECODER_H
@@ -0,0 +1,62 @@
+# Benchmarks. These only depend on the parser sources and the CMU462
+# utility library, so they build and run without a display.
+
+include_directories(${CMAKE_CURRENT_SOURCE_DIR})
+
+# png decode benchmark
+add_executable( png_bench
+    bench/png_bench.cpp
+    png.cpp
+    png_filter.cpp
+    png_writer.cpp
+    base64_decoder.cpp
+)
+
+target_link_libraries( png_bench
+    ${CMU462_LIBRARIES}
+)
+
+# render benchmark, implementation against the reference solution
+add_executable( render_bench
+    bench/render_bench.cpp
+    ${CMU462_DRAWSVG_CORE_SOURCE}
+)
+
+target_link_libraries( render_bench drawsvg_ref
+    ${CMU462_LIBRARIES}
+)
+
+# rasterization microbenchmark, implementation against the reference
+add_executable( raster_bench
+    bench/raster_bench.cpp
+    ${CMU462_DRAWSVG_CORE_SOURCE}
+)
+
+target_link_libraries( raster_bench drawsvg_ref
+    ${CMU462_LIBRARIES}
+)
+
+# synthetic svg generator, for scale testing
+add_executable( svg_gen
+    bench/svg_gen.cpp
+    bench/svg_generator.cpp
+    png.cpp
+    png_filter.cpp
+    png_writer.cpp
+    base64_decoder.cpp
+)
+
+target_link_libraries( svg_gen
+    ${CMU462_LIBRARIES}
+)
+
+# parse and render times over growing synthetic documents
+add_executable( scale_bench
+    bench/scale_bench.cpp
+    bench/svg_generator.cpp
+    ${CMU462_DRAWSVG_CORE_SOURCE}
+)
+
+target_link_libraries( scale_bench
+    ${CMU462_LIBRARIES}
+)
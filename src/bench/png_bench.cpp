@@ -0,0 +1,223 @@
+#include "png.h"
+#include "png_filter.h"
+#include "base64_decoder.h"
+#include "tinyxml2.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace CMU462;
+using namespace tinyxml2;
+
+#define msg(s) cerr << "[png_bench] " << s << endl;
+
+/**
+ * PNG decode benchmark.
+ * Extracts the PNG images embedded in the svg files found under the given
+ * paths (svg/ by default) and reports the decode throughput of
+ * PNGParser::load in MB/s, both of compressed input and of decoded RGBA.
+ * The base64 decode of the embedded data and the encode of the decoded
+ * images by PNGParser::save (in both compression modes) are timed
+ * separately.
+ * Pass --scalar to compare against the portable scanline kernels.
+ */
+
+struct EmbeddedPNG {
+  string source;
+  string encoded;
+  vector<unsigned char> data;
+};
+
+static void collectImages( XMLElement* xml, const string& source,
+                           vector<EmbeddedPNG>& images ) {
+
+  for (XMLElement* elem = xml->FirstChildElement(); elem;
+       elem = elem->NextSiblingElement()) {
+
+    const char* href = elem->Attribute( "xlink:href" );
+    if (string(elem->Value()) == "image" && href) {
+
+      // skip the data uri header
+      const char* data = href;
+      while (*data && *data != ',') data++;
+      if (*data) data++;
+
+      EmbeddedPNG png;
+      png.source = source;
+      png.encoded = data;
+      size_t size = 0;
+      if (base64_decode_into(png.data, size, data, strlen(data))) {
+        msg(source << ": invalid base64 data");
+        continue;
+      }
+      png.data.resize(size);
+      images.push_back(png);
+    }
+
+    collectImages(elem, source, images);
+  }
+}
+
+static void collectPath( const string& path, vector<EmbeddedPNG>& images ) {
+
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
+    msg("File does not exist: " << path);
+    return;
+  }
+
+  if (st.st_mode & S_IFDIR) {
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir) return;
+
+    vector<string> entries;
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+      string name = ent->d_name;
+      if (name != "." && name != "..") entries.push_back(name);
+    }
+    closedir(dir);
+
+    sort(entries.begin(), entries.end());
+    string pathname = path;
+    if (pathname.back() != '/') pathname.push_back('/');
+    for (size_t i = 0; i < entries.size(); ++i) {
+      collectPath(pathname + entries[i], images);
+    }
+    return;
+  }
+
+  if (path.size() < 4 || path.substr(path.size() - 4) != ".svg") return;
+
+  XMLDocument doc;
+  if (doc.LoadFile(path.c_str()) != XML_NO_ERROR) {
+    msg("Could not parse " << path);
+    return;
+  }
+  collectImages(doc.RootElement(), path, images);
+}
+
+int main( int argc, char** argv ) {
+
+  size_t iterations = 20;
+  vector<string> paths;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "-n" && i + 1 < argc) {
+      iterations = max(1, atoi(argv[++i]));
+    } else if (arg == "--scalar") {
+      png_select_kernels(PNG_KERNEL_SCALAR);
+    } else if (arg == "-h" || arg == "--help") {
+      msg("Usage: png_bench [-n iterations] [--scalar] [svg file or directory ...]");
+      return 0;
+    } else {
+      paths.push_back(arg);
+    }
+  }
+  if (paths.empty()) paths.push_back("../svg");
+
+  vector<EmbeddedPNG> images;
+  for (size_t i = 0; i < paths.size(); ++i) collectPath(paths[i], images);
+
+  if (images.empty()) {
+    msg("No embedded png images found");
+    return 1;
+  }
+
+  msg("Using " << png_kernel_name() << " kernels");
+
+  double total_in = 0, total_out = 0, total_time = 0;
+  double total_text = 0, total_base64 = 0;
+  double total_encode[2] = {0, 0}, total_encoded[2] = {0, 0};
+  const char* encode_file = "png_bench_encode.png";
+  vector<unsigned char> decoded;
+  for (size_t i = 0; i < images.size(); ++i) {
+
+    const EmbeddedPNG& image = images[i];
+    const unsigned char* buffer = &image.data[0];
+
+    // warm up and validate
+    PNG png;
+    int error = PNGParser::load(buffer, image.data.size(), png);
+    if (error) {
+      msg(image.source << ": decode error " << error);
+      return 1;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t n = 0; n < iterations; ++n) {
+      PNGParser::load(buffer, image.data.size(), png);
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    double in_mb  = (double) image.data.size()  * iterations / 1e6;
+    double out_mb = (double) png.pixels.size()  * iterations / 1e6;
+    double secs = elapsed.count();
+
+    printf("%-40s %5dx%-5d %9.2f ms %9.1f MB/s in %9.1f MB/s out\n",
+           image.source.c_str(), png.width, png.height,
+           1e3 * secs / iterations, in_mb / secs, out_mb / secs);
+
+    total_in += in_mb; total_out += out_mb; total_time += secs;
+
+    // base64 decode of the embedded text into a reused buffer
+    const char* text = image.encoded.c_str();
+    size_t length = image.encoded.size(), size = 0;
+    start = chrono::steady_clock::now();
+    for (size_t n = 0; n < iterations; ++n) {
+      base64_decode_into(decoded, size, text, length);
+    }
+    elapsed = chrono::steady_clock::now() - start;
+
+    total_text += (double) length * iterations / 1e6;
+    total_base64 += elapsed.count();
+
+    // encode in both compression modes
+    for (int mode = 0; mode < 2; ++mode) {
+      PNGCompression compression = mode ? PNG_COMPRESSION_SMALL : PNG_COMPRESSION_FAST;
+      start = chrono::steady_clock::now();
+      for (size_t n = 0; n < iterations; ++n) {
+        if (PNGParser::save(encode_file, png, compression)) {
+          msg("Could not write " << encode_file);
+          return 1;
+        }
+      }
+      elapsed = chrono::steady_clock::now() - start;
+
+      struct stat st;
+      stat(encode_file, &st);
+      total_encode[mode] += elapsed.count();
+      total_encoded[mode] += st.st_size;
+    }
+  }
+  remove(encode_file);
+
+  printf("%-40s %11s %9.2f ms %9.1f MB/s in %9.1f MB/s out\n",
+         "total", "", 1e3 * total_time / iterations,
+         total_in / total_time, total_out / total_time);
+
+  printf("%-40s %11s %9.2f ms %9.1f MB/s in\n",
+         "base64", "", 1e3 * total_base64 / iterations,
+         total_text / total_base64);
+
+  for (int mode = 0; mode < 2; ++mode) {
+    printf("%-40s %11s %9.2f ms %9.1f MB/s in %9.0f bytes out\n",
+           mode ? "encode (small)" : "encode (fast)", "",
+           1e3 * total_encode[mode] / iterations,
+           total_out / total_encode[mode],
+           total_encoded[mode]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,317 @@
+#include "texture.h"
+#include "software_renderer.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace CMU462;
+
+#define msg(s) cerr << "[raster_bench] " << s << endl;
+
+/**
+ * Rasterization microbenchmark.
+ * Times the rasterization functions of SoftwareRendererImp and of the
+ * reference SoftwareRendererRef on their own, over sweeps of primitive
+ * shapes: lines by length and slope, triangles by area and aspect ratio
+ * (down to slivers), points, images by scale factor, and resolve. Both
+ * draw into an in-memory render target, so no display is needed.
+ *
+ * Each case is run in batches of about BATCH_TIME seconds, and reports
+ * the mean number of primitives per second over the batches with its 95%
+ * confidence interval. The last column is the implementation's throughput
+ * over the reference's (above 1, the implementation is faster).
+ */
+
+// target duration of a batch (seconds)
+static const double BATCH_TIME = 0.01;
+
+// primitives are spread over this many positions
+static const size_t POSITIONS = 64;
+
+namespace CMU462 {
+
+// calls into the rasterization functions (befriended by both renderers)
+struct RasterBench {
+
+  template <typename R>
+  static void point( R& r, float x, float y, Color c ) {
+    r.rasterize_point(x, y, c);
+  }
+
+  template <typename R>
+  static void line( R& r, float x0, float y0, float x1, float y1, Color c ) {
+    r.rasterize_line(x0, y0, x1, y1, c);
+  }
+
+  template <typename R>
+  static void triangle( R& r, float x0, float y0, float x1, float y1,
+                        float x2, float y2, Color c ) {
+    r.rasterize_triangle(x0, y0, x1, y1, x2, y2, c);
+  }
+
+  template <typename R>
+  static void image( R& r, float x0, float y0, float x1, float y1, Texture& tex ) {
+    r.rasterize_image(x0, y0, x1, y1, tex);
+  }
+
+  template <typename R>
+  static void resolve( R& r ) {
+    r.resolve();
+  }
+
+}; // struct RasterBench
+
+} // namespace CMU462
+
+// mean and 95% confidence half interval of a throughput
+struct Throughput {
+  double mean, interval;
+};
+
+// two sided 95% quantile of Student's t distribution
+static double student_t( size_t dof ) {
+  static const double t[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086
+  };
+  return dof == 0 ? 0 : dof <= 20 ? t[dof - 1] : 1.96;
+}
+
+// Primitives per second of draw(i), which draws the i-th primitive of a
+// case. The batch size is calibrated first.
+template <typename Draw>
+static Throughput measure( Draw draw, size_t batches ) {
+
+  typedef chrono::steady_clock clock;
+
+  size_t batch = 1;
+  while (true) {
+    clock::time_point start = clock::now();
+    for (size_t i = 0; i < batch; ++i) draw(i);
+    chrono::duration<double> elapsed = clock::now() - start;
+    if (elapsed.count() >= BATCH_TIME || batch >= (1u << 24)) break;
+    batch *= 2;
+  }
+
+  vector<double> rates(batches);
+  for (size_t b = 0; b < batches; ++b) {
+    clock::time_point start = clock::now();
+    for (size_t i = 0; i < batch; ++i) draw(i);
+    chrono::duration<double> elapsed = clock::now() - start;
+    rates[b] = batch / elapsed.count();
+  }
+
+  double mean = 0, variance = 0;
+  for (size_t b = 0; b < batches; ++b) mean += rates[b];
+  mean /= batches;
+  for (size_t b = 0; b < batches; ++b) variance += (rates[b] - mean) * (rates[b] - mean);
+  variance /= max((size_t) 1, batches - 1);
+
+  Throughput result = { mean, student_t(batches - 1) * sqrt(variance / batches) };
+  return result;
+}
+
+static string rate( const Throughput& t ) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.4g +- %.2g", t.mean, t.interval);
+  return buffer;
+}
+
+static void report( const string& name, const Throughput& imp, const Throughput& ref ) {
+  printf("%-36s %24s %24s %8.2f\n", name.c_str(),
+         rate(imp).c_str(), rate(ref).c_str(), imp.mean / ref.mean);
+}
+
+// Centers for primitives reaching ex, ey pixels from them, spread over the
+// target without crossing its edges. False if they do not fit.
+static bool place( const vector<Vector2D>& spread, float ex, float ey,
+                   size_t width, size_t height, vector<Vector2D>& centers ) {
+  if (2 * ex + 2 > width || 2 * ey + 2 > height) return false;
+  centers.resize(spread.size());
+  for (size_t i = 0; i < spread.size(); ++i) {
+    centers[i] = Vector2D(ex + 1 + spread[i].x * (width  - 2 * ex - 2),
+                          ey + 1 + spread[i].y * (height - 2 * ey - 2));
+  }
+  return true;
+}
+
+// checkerboard texture with its mipmaps
+static void makeTexture( Texture& tex, size_t size, Sampler2D& sampler ) {
+  MipLevel level;
+  level.width = level.height = size;
+  level.texels.resize(4 * size * size);
+  for (size_t y = 0; y < size; ++y) {
+    for (size_t x = 0; x < size; ++x) {
+      unsigned char* t = &level.texels[4 * (y * size + x)];
+      bool dark = ((x / 16) + (y / 16)) % 2;
+      t[0] = dark ? 40 : 220; t[1] = dark ? 80 : 200; t[2] = 120; t[3] = 255;
+    }
+  }
+  tex.width = tex.height = size;
+  tex.mipmap.assign(1, level);
+  sampler.generate_mips(tex, 0);
+}
+
+int main( int argc, char** argv ) {
+
+  size_t width = 1024, height = 1024;
+  size_t sample_rate = 1;
+  size_t batches = 10;
+  string only;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "-r" && i + 1 < argc) {
+      int w = 0, h = 0;
+      if (sscanf(argv[++i], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+        msg("Invalid resolution: " << argv[i]);
+        return 1;
+      }
+      width = w; height = h;
+    } else if (arg == "-s" && i + 1 < argc) {
+      sample_rate = max(1, atoi(argv[++i]));
+    } else if (arg == "-n" && i + 1 < argc) {
+      batches = max(2, atoi(argv[++i]));
+    } else if (arg == "-h" || arg == "--help") {
+      msg("Usage: raster_bench [-r <w>x<h>] [-s <sample rate>] [-n <batches>] [primitive]");
+      msg("  primitive: point, line, triangle, image or resolve (default: all)");
+      return 0;
+    } else {
+      only = arg;
+    }
+  }
+
+  // render targets, set before the sample rate
+  vector<unsigned char> target_imp(4 * width * height, 255);
+  vector<unsigned char> target_ref(4 * width * height, 255);
+  Sampler2DImp sampler_imp;
+  Sampler2DRef sampler_ref;
+  SoftwareRendererImp imp;
+  SoftwareRendererRef ref;
+  imp.set_tex_sampler(&sampler_imp);
+  ref.set_tex_sampler(&sampler_ref);
+  imp.set_render_target(&target_imp[0], width, height);
+  ref.set_render_target(&target_ref[0], width, height);
+  imp.set_sample_rate(sample_rate);
+  ref.set_sample_rate(sample_rate);
+
+  // where the primitives go, in [0,1]^2 (see place)
+  vector<Vector2D> spread(POSITIONS), positions;
+  srand(462);
+  for (size_t i = 0; i < POSITIONS; ++i) {
+    spread[i] = Vector2D((double) rand() / RAND_MAX, (double) rand() / RAND_MAX);
+  }
+  const Color color(0.2, 0.4, 0.8, 0.75);
+
+  msg(width << "x" << height << " target, sample rate " << sample_rate);
+  printf("%-36s %24s %24s %8s\n", "primitives/s", "imp", "ref", "imp/ref");
+
+  if (only.empty() || only == "point") {
+    place(spread, 0, 0, width, height, positions);
+    auto imp_draw = [&] (size_t i) {
+      const Vector2D& p = positions[i % POSITIONS];
+      RasterBench::point(imp, p.x, p.y, color);
+    };
+    auto ref_draw = [&] (size_t i) {
+      const Vector2D& p = positions[i % POSITIONS];
+      RasterBench::point(ref, p.x, p.y, color);
+    };
+    report("point", measure(imp_draw, batches), measure(ref_draw, batches));
+  }
+
+  if (only.empty() || only == "line") {
+    const float lengths[] = { 4, 32, 256, 768 };
+    const float slopes[] = { 0, 30, 45, 80, 90 };
+    for (float length : lengths) {
+      for (float slope : slopes) {
+        float a = slope * M_PI / 180;
+        float dx = 0.5f * length * cos(a), dy = 0.5f * length * sin(a);
+        char name[64];
+        snprintf(name, sizeof(name), "line length %g slope %g", length, slope);
+        if (!place(spread, fabs(dx), fabs(dy), width, height, positions)) {
+          printf("%-36s does not fit\n", name);
+          continue;
+        }
+        auto imp_draw = [&] (size_t i) {
+          const Vector2D& p = positions[i % POSITIONS];
+          RasterBench::line(imp, p.x - dx, p.y - dy, p.x + dx, p.y + dy, color);
+        };
+        auto ref_draw = [&] (size_t i) {
+          const Vector2D& p = positions[i % POSITIONS];
+          RasterBench::line(ref, p.x - dx, p.y - dy, p.x + dx, p.y + dy, color);
+        };
+        report(name, measure(imp_draw, batches), measure(ref_draw, batches));
+      }
+    }
+  }
+
+  if (only.empty() || only == "triangle") {
+    // base over height; the last ones are slivers
+    const float areas[] = { 16, 256, 4096, 65536 };
+    const float aspects[] = { 1, 4, 16, 256 };
+    for (float area : areas) {
+      for (float aspect : aspects) {
+        float h = sqrt(2 * area / aspect), b = aspect * h;
+        char name[64];
+        snprintf(name, sizeof(name), "triangle area %g aspect %g", area, aspect);
+        if (!place(spread, b / 2, h / 2, width, height, positions)) {
+          printf("%-36s does not fit\n", name);
+          continue;
+        }
+        auto imp_draw = [&] (size_t i) {
+          const Vector2D& p = positions[i % POSITIONS];
+          RasterBench::triangle(imp, p.x - b / 2, p.y + h / 2, p.x + b / 2, p.y + h / 2,
+                                p.x + b / 5, p.y - h / 2, color);
+        };
+        auto ref_draw = [&] (size_t i) {
+          const Vector2D& p = positions[i % POSITIONS];
+          RasterBench::triangle(ref, p.x - b / 2, p.y + h / 2, p.x + b / 2, p.y + h / 2,
+                                p.x + b / 5, p.y - h / 2, color);
+        };
+        report(name, measure(imp_draw, batches), measure(ref_draw, batches));
+      }
+    }
+  }
+
+  if (only.empty() || only == "image") {
+    Texture tex_imp, tex_ref;
+    makeTexture(tex_imp, 256, sampler_imp);
+    makeTexture(tex_ref, 256, sampler_ref);
+    const float scales[] = { 0.25, 0.5, 1, 2, 3 };
+    for (float scale : scales) {
+      float half = 128 * scale;
+      char name[64];
+      snprintf(name, sizeof(name), "image 256x256 scale %g", scale);
+      if (!place(spread, half, half, width, height, positions)) {
+        printf("%-36s does not fit\n", name);
+        continue;
+      }
+      auto imp_draw = [&] (size_t i) {
+        const Vector2D& p = positions[i % POSITIONS];
+        RasterBench::image(imp, p.x - half, p.y - half, p.x + half, p.y + half, tex_imp);
+      };
+      auto ref_draw = [&] (size_t i) {
+        const Vector2D& p = positions[i % POSITIONS];
+        RasterBench::image(ref, p.x - half, p.y - half, p.x + half, p.y + half, tex_ref);
+      };
+      report(name, measure(imp_draw, batches), measure(ref_draw, batches));
+    }
+  }
+
+  if (only.empty() || only == "resolve") {
+    auto imp_draw = [&] (size_t) { RasterBench::resolve(imp); };
+    auto ref_draw = [&] (size_t) { RasterBench::resolve(ref); };
+    char name[64];
+    snprintf(name, sizeof(name), "resolve %zux%zu", width, height);
+    report(name, measure(imp_draw, batches), measure(ref_draw, batches));
+  }
+
+  return 0;
+}
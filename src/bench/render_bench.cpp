@@ -0,0 +1,417 @@
+#include "svg.h"
+#include "scene.h"
+#include "texture.h"
+#include "viewport.h"
+#include "image_diff.h"
+#include "software_renderer.h"
+
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <dirent.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace CMU462;
+
+#define msg(s) cerr << "[render_bench] " << s << endl;
+
+/**
+ * Render regression benchmark.
+ * Renders every svg file found under the given paths (svg/ by default)
+ * with SoftwareRendererImp and with the reference SoftwareRendererRef, at
+ * each resolution and sample rate, and reports the time per frame, the
+ * samples per second and the difference to the reference of every frame,
+ * and the peak memory use so far. Results are printed as a table and
+ * written as JSON (render_bench.json by default).
+ *
+ * For every resolution and sample rate, the slowdown is the total time of
+ * the implementation over that of a baseline: the JSON output of an
+ * earlier run if one is given, to catch regressions on the same machine,
+ * or else the reference, which runs alongside on any machine. The
+ * benchmark fails if a slowdown is above the threshold.
+ *
+ * Sample rates are per axis, as in the viewer: 1, 2, 3 and 4 are 1, 4, 9
+ * and 16 samples per pixel.
+ */
+
+struct Resolution {
+  size_t width, height;
+};
+
+struct Timing {
+  double ms;              // per frame
+  double samples_per_sec;
+};
+
+struct Result {
+  string file;
+  Resolution resolution;
+  size_t sample_rate;
+  Timing imp, ref;
+  ImageDiff diff;
+  long peak_rss_kb;
+};
+
+// all files at a resolution and sample rate
+struct Total {
+  Resolution resolution;
+  size_t sample_rate;
+  double imp_ms, ref_ms;
+  double baseline_ms; // implementation in the baseline run, 0 if none
+  bool passed;
+};
+
+static void usage() {
+  msg("Usage: render_bench [options] [svg file or directory ...]");
+  msg("  -r <w>x<h>     resolution, repeat for several (default: 1280x720,");
+  msg("                 1920x1080 and 3840x2160)");
+  msg("  -s <rate>      sample rate per axis, repeat for several (default: 1 to 4)");
+  msg("  -n <frames>    timed frames per file and renderer (default: 3)");
+  msg("  -b <file>      baseline: JSON output of an earlier run (default: the");
+  msg("                 reference renderer)");
+  msg("  -t <slowdown>  largest slowdown over the baseline that passes");
+  msg("                 (default: 1.5)");
+  msg("  -o <file>      JSON output (default: render_bench.json)");
+}
+
+static void collectPath( const string& path, vector<string>& files ) {
+
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
+    msg("File does not exist: " << path);
+    return;
+  }
+
+  if (st.st_mode & S_IFDIR) {
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+      msg("Could not open directory " << path);
+      return;
+    }
+
+    vector<string> entries;
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+      string name = ent->d_name;
+      if (name != "." && name != "..") entries.push_back(name);
+    }
+    closedir(dir);
+
+    sort(entries.begin(), entries.end());
+    string pathname = path;
+    if (pathname.back() != '/') pathname.push_back('/');
+    for (size_t i = 0; i < entries.size(); ++i) {
+      collectPath(pathname + entries[i], files);
+    }
+    return;
+  }
+
+  if (path.size() > 4 && path.substr(path.size() - 4) == ".svg") {
+    files.push_back(path);
+  }
+}
+
+static void generateMipmaps( vector<SVGElement*>& elements, Sampler2D& sampler ) {
+  for (size_t i = 0; i < elements.size(); ++i) {
+    if (elements[i]->type == IMAGE) {
+      sampler.generate_mips(static_cast<Image*>(elements[i])->tex, 0);
+    } else if (elements[i]->type == GROUP) {
+      generateMipmaps(static_cast<Group*>(elements[i])->elements, sampler);
+    }
+  }
+}
+
+// view of a drawing framed like DrawSVG::auto_adjust
+static Matrix3x3 frameView( const SVG& svg, const Resolution& resolution ) {
+
+  ViewportImp viewport;
+  float span = 1.2 * max(svg.width, svg.height) / 2;
+  viewport.set_viewbox(svg.width / 2, svg.height / 2, span);
+
+  float scale = min(resolution.width, resolution.height);
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (resolution.width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (resolution.height - scale) / 2;
+  return norm_to_screen * viewport.get_canvas_to_norm();
+}
+
+static long peakRSS() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// time frames of a draw call, after one untimed frame (the one compared)
+template <typename Draw>
+static Timing timeFrames( Draw draw, size_t frames, vector<unsigned char>& target,
+                          const Resolution& resolution, size_t sample_rate ) {
+
+  memset(&target[0], 255, target.size());
+  draw();
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (size_t n = 0; n < frames; ++n) draw();
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  Timing timing;
+  double secs = elapsed.count() / frames;
+  timing.ms = 1e3 * secs;
+  timing.samples_per_sec = resolution.width * resolution.height *
+                           sample_rate * sample_rate / secs;
+  return timing;
+}
+
+// totals of an earlier run, from its JSON output
+static int loadBaseline( const string& path, vector<Total>& totals ) {
+
+  FILE* in = fopen(path.c_str(), "r");
+  if (!in) return -1;
+
+  char line[1024];
+  while (fgets(line, sizeof(line), in)) {
+    Total total;
+    if (sscanf(line, " { \"width\": %zu, \"height\": %zu, \"sample_rate\": %zu, "
+                     "\"imp_ms\": %lf, \"ref_ms\": %lf",
+               &total.resolution.width, &total.resolution.height,
+               &total.sample_rate, &total.imp_ms, &total.ref_ms) == 5) {
+      totals.push_back(total);
+    }
+  }
+  fclose(in);
+  return 0;
+}
+
+static void writeJSON( FILE* out, const vector<Result>& results,
+                       const vector<Total>& totals,
+                       size_t frames, double threshold, bool passed ) {
+
+  fprintf(out, "{\n  \"frames\": %zu,\n  \"threshold\": %g,\n", frames, threshold);
+  fprintf(out, "  \"passed\": %s,\n  \"results\": [\n", passed ? "true" : "false");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    fprintf(out, "    { \"file\": \"%s\", \"width\": %zu, \"height\": %zu, "
+                 "\"sample_rate\": %zu,\n",
+            r.file.c_str(), r.resolution.width, r.resolution.height, r.sample_rate);
+    fprintf(out, "      \"imp\": { \"ms\": %.3f, \"samples_per_sec\": %.0f },\n",
+            r.imp.ms, r.imp.samples_per_sec);
+    fprintf(out, "      \"ref\": { \"ms\": %.3f, \"samples_per_sec\": %.0f },\n",
+            r.ref.ms, r.ref.samples_per_sec);
+    fprintf(out, "      \"diff\": { \"pixels\": %zu, \"max_error\": %d, "
+                 "\"rmse\": %.4f, \"psnr\": ",
+            r.diff.different, r.diff.max_error, r.diff.rmse);
+    if (r.diff.different) fprintf(out, "%.2f", r.diff.psnr);
+    else fprintf(out, "null");
+    fprintf(out, " },\n      \"peak_rss_kb\": %ld }%s\n",
+            r.peak_rss_kb, i + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ],\n  \"totals\": [\n");
+  for (size_t i = 0; i < totals.size(); ++i) {
+    const Total& t = totals[i];
+    fprintf(out, "    { \"width\": %zu, \"height\": %zu, \"sample_rate\": %zu, "
+                 "\"imp_ms\": %.3f, \"ref_ms\": %.3f, \"baseline_ms\": ",
+            t.resolution.width, t.resolution.height, t.sample_rate,
+            t.imp_ms, t.ref_ms);
+    if (t.baseline_ms) fprintf(out, "%.3f", t.baseline_ms);
+    else fprintf(out, "null");
+    fprintf(out, ", \"slowdown\": %.3f, \"passed\": %s }%s\n",
+            t.imp_ms / (t.baseline_ms ? t.baseline_ms : t.ref_ms),
+            t.passed ? "true" : "false", i + 1 < totals.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+int main( int argc, char** argv ) {
+
+  vector<Resolution> resolutions;
+  vector<size_t> sample_rates;
+  size_t frames = 3;
+  double threshold = 1.5;
+  string output = "render_bench.json";
+  string baseline;
+  vector<string> paths;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "-r" && i + 1 < argc) {
+      int w = 0, h = 0;
+      if (sscanf(argv[++i], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+        msg("Invalid resolution: " << argv[i]);
+        return 1;
+      }
+      Resolution resolution = { (size_t) w, (size_t) h };
+      resolutions.push_back(resolution);
+    } else if (arg == "-s" && i + 1 < argc) {
+      sample_rates.push_back(max(1, atoi(argv[++i])));
+    } else if (arg == "-n" && i + 1 < argc) {
+      frames = max(1, atoi(argv[++i]));
+    } else if (arg == "-t" && i + 1 < argc) {
+      threshold = atof(argv[++i]);
+    } else if (arg == "-b" && i + 1 < argc) {
+      baseline = argv[++i];
+    } else if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else if (!arg.empty() && arg[0] == '-') {
+      msg("Unknown option: " << arg);
+      usage();
+      return 1;
+    } else {
+      paths.push_back(arg);
+    }
+  }
+  if (resolutions.empty()) {
+    Resolution defaults[] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+    resolutions.assign(defaults, defaults + 3);
+  }
+  if (sample_rates.empty()) {
+    for (size_t rate = 1; rate <= 4; ++rate) sample_rates.push_back(rate);
+  }
+  if (paths.empty()) paths.push_back("../svg");
+
+  vector<Total> baseline_totals;
+  if (!baseline.empty() && loadBaseline(baseline, baseline_totals) < 0) {
+    msg("Could not read " << baseline);
+    return 1;
+  }
+
+  vector<string> files;
+  for (size_t i = 0; i < paths.size(); ++i) collectPath(paths[i], files);
+
+  // load everything up front, so that parsing is not timed
+  Sampler2DImp sampler_imp;
+  Sampler2DRef sampler_ref;
+  vector<SVG*> svgs; vector<SVGScene*> scenes; vector<string> names;
+  for (size_t i = 0; i < files.size(); ++i) {
+    SVG* svg = new SVG();
+    if (SVGParser::load(files[i].c_str(), svg) < 0) {
+      msg("Could not load " << files[i]);
+      delete svg;
+      continue;
+    }
+    generateMipmaps(svg->elements, sampler_imp);
+    svgs.push_back(svg);
+    scenes.push_back(new SVGScene());
+    scenes.back()->sync(*svg);
+    names.push_back(files[i]);
+  }
+
+  if (svgs.empty()) {
+    msg("No svg files found");
+    return 1;
+  }
+
+  SoftwareRendererImp imp;
+  SoftwareRendererRef ref;
+  imp.set_tex_sampler(&sampler_imp);
+  ref.set_tex_sampler(&sampler_ref);
+  vector<unsigned char> target_imp, target_ref;
+
+  vector<Result> results;
+  vector<Total> totals;
+  bool passed = true;
+  printf("%-40s %11s %4s %10s %10s %9s %8s %8s\n", "file", "resolution", "rate",
+         "imp ms", "ref ms", "imp/ref", "diff px", "psnr");
+
+  for (size_t r = 0; r < resolutions.size(); ++r) {
+
+    const Resolution& resolution = resolutions[r];
+    target_imp.assign(4 * resolution.width * resolution.height, 255);
+    target_ref.assign(4 * resolution.width * resolution.height, 255);
+
+    for (size_t s = 0; s < sample_rates.size(); ++s) {
+
+      // the render target is set before the sample rate, which sizes the
+      // supersample buffer from it
+      size_t sample_rate = sample_rates[s];
+      imp.set_render_target(&target_imp[0], resolution.width, resolution.height);
+      imp.set_sample_rate(sample_rate);
+      ref.set_render_target(&target_ref[0], resolution.width, resolution.height);
+      ref.set_sample_rate(sample_rate);
+
+      double total_imp = 0, total_ref = 0;
+      for (size_t i = 0; i < svgs.size(); ++i) {
+
+        Matrix3x3 view = frameView(*svgs[i], resolution);
+        imp.set_canvas_to_screen(view);
+        ref.set_canvas_to_screen(view);
+
+        const SVGScene& scene = *scenes[i];
+        SVG& svg = *svgs[i];
+
+        Result result;
+        result.file = names[i];
+        result.resolution = resolution;
+        result.sample_rate = sample_rate;
+        result.imp = timeFrames([&] { imp.draw_scene(scene); },
+                                frames, target_imp, resolution, sample_rate);
+        result.ref = timeFrames([&] { ref.draw_svg(svg); },
+                                frames, target_ref, resolution, sample_rate);
+        result.diff = diff_images(&target_ref[0], &target_imp[0],
+                                  resolution.width, resolution.height);
+        result.peak_rss_kb = peakRSS();
+        results.push_back(result);
+
+        total_imp += result.imp.ms;
+        total_ref += result.ref.ms;
+
+        printf("%-40s %5zux%-5zu %4zu %10.3f %10.3f %9.2f %8zu %8.2f\n",
+               names[i].c_str(), resolution.width, resolution.height, sample_rate,
+               result.imp.ms, result.ref.ms, result.imp.ms / result.ref.ms,
+               result.diff.different, result.diff.different ? result.diff.psnr : INFINITY);
+      }
+
+      double baseline_ms = 0;
+      for (size_t k = 0; k < baseline_totals.size(); ++k) {
+        const Total& t = baseline_totals[k];
+        if (t.resolution.width == resolution.width &&
+            t.resolution.height == resolution.height &&
+            t.sample_rate == sample_rate) baseline_ms = t.imp_ms;
+      }
+
+      double slowdown = total_imp / (baseline_ms ? baseline_ms : total_ref);
+      bool ok = slowdown <= threshold;
+      passed = passed && ok;
+      Total total = { resolution, sample_rate, total_imp, total_ref, baseline_ms, ok };
+      totals.push_back(total);
+      printf("%-40s %5zux%-5zu %4zu %10.3f %10.3f %9.2f slowdown %.2f%s\n",
+             "total", resolution.width, resolution.height, sample_rate,
+             total_imp, total_ref, total_imp / total_ref, slowdown,
+             ok ? "" : " FAILED");
+    }
+  }
+
+  msg("Peak RSS " << peakRSS() / 1024 << " MB");
+
+  FILE* out = fopen(output.c_str(), "w");
+  if (!out) {
+    msg("Could not write " << output);
+    return 1;
+  }
+  writeJSON(out, results, totals, frames, threshold, passed);
+  fclose(out);
+  msg("Results written to " << output);
+
+  for (size_t i = 0; i < svgs.size(); ++i) {
+    delete scenes[i];
+    delete svgs[i];
+  }
+
+  if (!passed) {
+    msg("Slower than the " << (baseline.empty() ? "reference" : "baseline")
+        << " by more than " << threshold << "x");
+    return 1;
+  }
+  return 0;
+}
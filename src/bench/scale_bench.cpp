@@ -0,0 +1,245 @@
+#include "svg.h"
+#include "texture.h"
+#include "viewport.h"
+#include "software_renderer.h"
+#include "svg_generator.h"
+
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace CMU462;
+
+#define msg(s) cerr << "[scale_bench] " << s << endl;
+
+/**
+ * Scaling benchmark.
+ * Generates synthetic documents (see SyntheticSpec) of growing numbers of
+ * elements, and times SVGParser::load and SoftwareRendererImp::draw_svg
+ * on each, taking the best of a few runs. Besides the time per element,
+ * it reports the scaling exponent of each step: how the time grows with
+ * the element count, on a log-log chart (1 is linear). The benchmark
+ * fails if an exponent is above the threshold, which catches super-linear
+ * behavior. Results are also written as CSV for charting.
+ *
+ * Each document has half polygons and half lines, one image every
+ * thousand elements, one group every hundred (nested four deep) and a
+ * coverage of two. Rendering at a fixed resolution has a fixed cost
+ * (clearing and resolving the target), so small documents scale below 1.
+ */
+
+// steps where both times are below this are too noisy to judge (seconds)
+static const double MIN_TIME = 0.002;
+
+struct Step {
+  size_t elements;
+  double file_mb;
+  double load, draw; // seconds
+  double load_exponent, draw_exponent;
+  long peak_rss_kb;
+};
+
+static void usage() {
+  msg("Usage: scale_bench [options]");
+  msg("  -m <elements>  largest document (default: 1048576)");
+  msg("  -f <factor>    growth of the documents (default: 4)");
+  msg("  -r <w>x<h>     render resolution (default: 1024x1024)");
+  msg("  -a <alpha>     opacity of the shapes (default: 0.5)");
+  msg("  -n <runs>      runs of each step, the best is kept (default: 3)");
+  msg("  -t <exponent>  largest scaling exponent that passes (default: 1.3)");
+  msg("  -d <dir>       where documents are generated (default: .)");
+  msg("  -o <file>      CSV output (default: scale_bench.csv)");
+  msg("  --keep         keep the generated documents");
+}
+
+static void generateMipmaps( vector<SVGElement*>& elements, Sampler2D& sampler ) {
+  for (size_t i = 0; i < elements.size(); ++i) {
+    if (elements[i]->type == IMAGE) {
+      sampler.generate_mips(static_cast<Image*>(elements[i])->tex, 0);
+    } else if (elements[i]->type == GROUP) {
+      generateMipmaps(static_cast<Group*>(elements[i])->elements, sampler);
+    }
+  }
+}
+
+// view of a drawing framed like DrawSVG::auto_adjust
+static Matrix3x3 frameView( const SVG& svg, size_t width, size_t height ) {
+
+  ViewportImp viewport;
+  float span = 1.2 * max(svg.width, svg.height) / 2;
+  viewport.set_viewbox(svg.width / 2, svg.height / 2, span);
+
+  float scale = min(width, height);
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+  return norm_to_screen * viewport.get_canvas_to_norm();
+}
+
+static long peakRSS() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static double seconds( chrono::steady_clock::time_point start ) {
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// growth exponent of a time between two steps, 0 if too small to tell
+static double exponent( double t0, double t1, size_t n0, size_t n1 ) {
+  if (max(t0, t1) < MIN_TIME || t0 <= 0) return 0;
+  return log(t1 / t0) / log((double) n1 / n0);
+}
+
+int main( int argc, char** argv ) {
+
+  size_t max_elements = 1 << 20;
+  double factor = 4;
+  size_t width = 1024, height = 1024;
+  float alpha = 0.5;
+  size_t runs = 3;
+  double threshold = 1.3;
+  string dir = ".";
+  string output = "scale_bench.csv";
+  bool keep = false;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    bool value = i + 1 < argc;
+    if (arg == "-m" && value) {
+      max_elements = max(1ul, strtoul(argv[++i], NULL, 10));
+    } else if (arg == "-f" && value) {
+      factor = max(1.5, atof(argv[++i]));
+    } else if (arg == "-r" && value) {
+      int w = 0, h = 0;
+      if (sscanf(argv[++i], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+        msg("Invalid resolution: " << argv[i]);
+        return 1;
+      }
+      width = w; height = h;
+    } else if (arg == "-a" && value) {
+      alpha = atof(argv[++i]);
+    } else if (arg == "-n" && value) {
+      runs = max(1, atoi(argv[++i]));
+    } else if (arg == "-t" && value) {
+      threshold = atof(argv[++i]);
+    } else if (arg == "-d" && value) {
+      dir = argv[++i];
+    } else if (arg == "-o" && value) {
+      output = argv[++i];
+    } else if (arg == "--keep") {
+      keep = true;
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      msg("Unknown option: " << arg);
+      usage();
+      return 1;
+    }
+  }
+
+  // the render target is set before the sample rate
+  vector<unsigned char> target(4 * width * height);
+  Sampler2DImp sampler;
+  SoftwareRendererImp renderer;
+  renderer.set_tex_sampler(&sampler);
+  renderer.set_render_target(&target[0], width, height);
+  renderer.set_sample_rate(1);
+
+  vector<Step> steps;
+  bool passed = true;
+
+  printf("%10s %9s %10s %9s %6s %10s %9s %6s %9s\n", "elements", "file MB",
+         "load ms", "ns/elem", "exp", "draw ms", "ns/elem", "exp", "peak MB");
+
+  for (double n = 1024; (size_t) n <= max_elements; n *= factor) {
+
+    Step step;
+    step.elements = n;
+
+    SyntheticSpec spec;
+    spec.images = step.elements / 1000;
+    spec.polygons = (step.elements - spec.images) / 2;
+    spec.lines = step.elements - spec.images - spec.polygons;
+    spec.groups = step.elements / 100;
+    spec.depth = 4;
+    spec.alpha = alpha;
+
+    string filename = dir + "/scale_bench_" + to_string(step.elements) + ".svg";
+    if (write_synthetic_svg(filename.c_str(), spec)) {
+      msg("Could not write " << filename);
+      return 1;
+    }
+    struct stat st;
+    step.file_mb = stat(filename.c_str(), &st) ? 0 : st.st_size / 1048576.0;
+
+    step.load = step.draw = INFINITY;
+    for (size_t run = 0; run < runs; ++run) {
+
+      SVG svg;
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      if (SVGParser::load(filename.c_str(), &svg) < 0) {
+        msg("Could not load " << filename);
+        return 1;
+      }
+      step.load = min(step.load, seconds(start));
+
+      generateMipmaps(svg.elements, sampler);
+      renderer.set_canvas_to_screen(frameView(svg, width, height));
+      start = chrono::steady_clock::now();
+      renderer.draw_svg(svg);
+      step.draw = min(step.draw, seconds(start));
+    }
+    if (!keep) remove(filename.c_str());
+
+    step.load_exponent = step.draw_exponent = 0;
+    if (!steps.empty()) {
+      const Step& last = steps.back();
+      step.load_exponent = exponent(last.load, step.load, last.elements, step.elements);
+      step.draw_exponent = exponent(last.draw, step.draw, last.elements, step.elements);
+    }
+    step.peak_rss_kb = peakRSS();
+    steps.push_back(step);
+
+    bool slow = step.load_exponent > threshold || step.draw_exponent > threshold;
+    passed = passed && !slow;
+    printf("%10zu %9.2f %10.2f %9.1f %6.2f %10.2f %9.1f %6.2f %9ld%s\n",
+           step.elements, step.file_mb,
+           1e3 * step.load, 1e9 * step.load / step.elements, step.load_exponent,
+           1e3 * step.draw, 1e9 * step.draw / step.elements, step.draw_exponent,
+           step.peak_rss_kb / 1024, slow ? "  super-linear" : "");
+    fflush(stdout);
+  }
+
+  FILE* out = fopen(output.c_str(), "w");
+  if (!out) {
+    msg("Could not write " << output);
+    return 1;
+  }
+  fprintf(out, "elements,file_mb,load_ms,draw_ms,load_exponent,draw_exponent,peak_rss_kb\n");
+  for (size_t i = 0; i < steps.size(); ++i) {
+    const Step& s = steps[i];
+    fprintf(out, "%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%ld\n", s.elements, s.file_mb,
+            1e3 * s.load, 1e3 * s.draw, s.load_exponent, s.draw_exponent, s.peak_rss_kb);
+  }
+  fclose(out);
+  msg("Results written to " << output);
+
+  if (!passed) {
+    msg("FAILED: scaling exponent above " << threshold);
+    return 1;
+  }
+  return 0;
+}
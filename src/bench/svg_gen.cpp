@@ -0,0 +1,91 @@
+#include "svg_generator.h"
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+using namespace CMU462;
+
+#define msg(s) cerr << "[svg_gen] " << s << endl;
+
+/**
+ * Synthetic svg generator.
+ * Writes a deterministic svg document with the given numbers of polygons,
+ * lines, images and groups (see SyntheticSpec), for testing how the
+ * parser and the renderers scale with document size.
+ */
+
+static void usage() {
+  msg("Usage: svg_gen [options] <output svg>");
+  msg("  -p <n>        polygons (default: 1000)");
+  msg("  -l <n>        lines (default: 1000)");
+  msg("  -i <n>        images (default: 0)");
+  msg("  -S <pixels>   image width and height (default: 64)");
+  msg("  -g <n>        groups, 0 for none (default: 0)");
+  msg("  -d <n>        nesting depth of each group (default: 1)");
+  msg("  -c <x>        coverage, shapes over a point (default: 2)");
+  msg("  -a <alpha>    fill and stroke opacity (default: 1)");
+  msg("  -r <w>x<h>    canvas size (default: 1000x1000)");
+  msg("  --seed <n>    random seed (default: 462)");
+}
+
+int main( int argc, char** argv ) {
+
+  SyntheticSpec spec;
+  string output;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    bool value = i + 1 < argc;
+    if (arg == "-p" && value) {
+      spec.polygons = strtoul(argv[++i], NULL, 10);
+    } else if (arg == "-l" && value) {
+      spec.lines = strtoul(argv[++i], NULL, 10);
+    } else if (arg == "-i" && value) {
+      spec.images = strtoul(argv[++i], NULL, 10);
+    } else if (arg == "-S" && value) {
+      spec.image_size = max(1ul, strtoul(argv[++i], NULL, 10));
+    } else if (arg == "-g" && value) {
+      spec.groups = strtoul(argv[++i], NULL, 10);
+    } else if (arg == "-d" && value) {
+      spec.depth = max(1ul, strtoul(argv[++i], NULL, 10));
+    } else if (arg == "-c" && value) {
+      spec.coverage = atof(argv[++i]);
+    } else if (arg == "-a" && value) {
+      spec.alpha = atof(argv[++i]);
+    } else if (arg == "-r" && value) {
+      float w = 0, h = 0;
+      if (sscanf(argv[++i], "%fx%f", &w, &h) != 2 || w <= 0 || h <= 0) {
+        msg("Invalid canvas size: " << argv[i]);
+        return 1;
+      }
+      spec.width = w; spec.height = h;
+    } else if (arg == "--seed" && value) {
+      spec.seed = strtoul(argv[++i], NULL, 10);
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else if (!arg.empty() && arg[0] == '-') {
+      msg("Unknown option: " << arg);
+      usage();
+      return 1;
+    } else {
+      output = arg;
+    }
+  }
+
+  if (output.empty()) {
+    usage();
+    return 1;
+  }
+
+  if (write_synthetic_svg(output.c_str(), spec)) {
+    msg("Could not write " << output);
+    return 1;
+  }
+
+  msg(output << ": " << spec.elements() << " elements");
+  return 0;
+}
@@ -0,0 +1,193 @@
+#include "svg_generator.h"
+#include "png.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+namespace {
+
+// uniform in [lo, hi), from the raw sequence (distributions vary by library)
+class Random {
+ public:
+
+  Random( unsigned seed ) : engine ( seed ) { }
+
+  double uniform( double lo, double hi ) {
+    double u = (engine() - engine.min()) / (double) (engine.max() - engine.min() + 1.0);
+    return lo + u * (hi - lo);
+  }
+
+  size_t index( size_t n ) {
+    return min((size_t) uniform(0, n), n - 1);
+  }
+
+ private:
+
+  minstd_rand engine;
+
+};
+
+string base64_encode( const vector<unsigned char>& data ) {
+
+  static const char digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  string out;
+  out.reserve((data.size() + 2) / 3 * 4);
+  for (size_t i = 0; i < data.size(); i += 3) {
+    unsigned n = data[i] << 16;
+    if (i + 1 < data.size()) n |= data[i + 1] << 8;
+    if (i + 2 < data.size()) n |= data[i + 2];
+    out += digits[(n >> 18) & 63];
+    out += digits[(n >> 12) & 63];
+    out += i + 1 < data.size() ? digits[(n >> 6) & 63] : '=';
+    out += i + 2 < data.size() ? digits[n & 63] : '=';
+  }
+  return out;
+}
+
+// Png file of a size x size gradient with a checkerboard, in base64. It
+// goes through a temporary file, as PNGParser only writes files.
+int image_data( const string& filename, size_t size, string& data ) {
+
+  PNG png;
+  png.width = png.height = size;
+  png.pixels.resize(4 * size * size);
+  for (size_t y = 0; y < size; ++y) {
+    for (size_t x = 0; x < size; ++x) {
+      unsigned char* p = &png.pixels[4 * (y * size + x)];
+      bool dark = ((x * 8 / size) + (y * 8 / size)) % 2;
+      p[0] = 255 * x / size;
+      p[1] = 255 * y / size;
+      p[2] = dark ? 64 : 192;
+      p[3] = 255;
+    }
+  }
+
+  string temp = filename + ".png.tmp";
+  if (PNGParser::save(temp.c_str(), png)) return -1;
+
+  FILE* file = fopen(temp.c_str(), "rb");
+  if (!file) return -1;
+  vector<unsigned char> bytes;
+  unsigned char buffer[1 << 16];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    bytes.insert(bytes.end(), buffer, buffer + n);
+  }
+  fclose(file);
+  remove(temp.c_str());
+
+  data = "data:image/png;base64," + base64_encode(bytes);
+  return 0;
+}
+
+} // namespace
+
+int write_synthetic_svg( const char* filename, const SyntheticSpec& spec ) {
+
+  string image;
+  if (spec.images && image_data(filename, spec.image_size, image)) return -1;
+
+  FILE* out = fopen(filename, "w");
+  if (!out) return -1;
+  static char buffer[1 << 20];
+  setvbuf(out, buffer, _IOFBF, sizeof(buffer));
+
+  Random random(spec.seed);
+  const float w = spec.width, h = spec.height;
+
+  // area of each polygon and image, for the coverage
+  size_t filled = max(spec.polygons + spec.images, (size_t) 1);
+  double area = spec.coverage * w * h / filled;
+  double radius = sqrt(area / 2); // star polygons fill about half their circle
+  double side = min(sqrt(area), (double) min(w, h));
+  double length = min(2 * sqrt(area), (double) min(w, h));
+
+  char opacity[64] = "";
+
+  fprintf(out, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+  fprintf(out, "<svg version=\"1.1\" xmlns=\"http://www.w3.org/2000/svg\" "
+               "xmlns:xlink=\"http://www.w3.org/1999/xlink\" "
+               "width=\"%gpx\" height=\"%gpx\" viewBox=\"0 0 %g %g\">\n", w, h, w, h);
+
+  // elements left of each type, picked at random so that types interleave
+  size_t left[3] = { spec.polygons, spec.lines, spec.images };
+  size_t total = spec.elements();
+  size_t groups = min(spec.groups, max(total, (size_t) 1));
+  size_t depth = groups ? max(spec.depth, (size_t) 1) : 0;
+  size_t group = 0;
+
+  for (size_t i = 0; i < total; ++i) {
+
+    // open the next group chain where its share of the elements starts
+    if (groups && i == group * total / groups) {
+      for (size_t d = 0; d < depth; ++d) {
+        fprintf(out, "<g transform=\"rotate(%.2f %.2f %.2f)\">\n",
+                random.uniform(-5, 5), w / 2, h / 2);
+      }
+      group++;
+    }
+
+    size_t pick = random.index(left[0] + left[1] + left[2]);
+    int type = pick < left[0] ? 0 : pick < left[0] + left[1] ? 1 : 2;
+    left[type]--;
+
+    unsigned color = random.index(1 << 24);
+    if (spec.alpha < 1) {
+      snprintf(opacity, sizeof(opacity), " %s-opacity=\"%.3f\"",
+               type == 1 ? "stroke" : "fill", spec.alpha);
+    }
+
+    if (type == 0) {
+
+      size_t n = 3 + random.index(6);
+      double cx = random.uniform(0, w), cy = random.uniform(0, h);
+      vector<double> angles(n);
+      for (size_t k = 0; k < n; ++k) angles[k] = random.uniform(0, 2 * M_PI);
+      sort(angles.begin(), angles.end());
+
+      fprintf(out, "<polygon fill=\"#%06X\"%s points=\"", color, opacity);
+      for (size_t k = 0; k < n; ++k) {
+        double r = radius * random.uniform(0.5, 1);
+        fprintf(out, "%s%.2f,%.2f", k ? " " : "",
+                cx + r * cos(angles[k]), cy + r * sin(angles[k]));
+      }
+      fprintf(out, "\"/>\n");
+
+    } else if (type == 1) {
+
+      double a = random.uniform(0, 2 * M_PI);
+      double dx = 0.5 * length * cos(a), dy = 0.5 * length * sin(a);
+      double cx = random.uniform(fabs(dx), w - fabs(dx));
+      double cy = random.uniform(fabs(dy), h - fabs(dy));
+      fprintf(out, "<line fill=\"none\" stroke=\"#%06X\"%s "
+                   "x1=\"%.2f\" y1=\"%.2f\" x2=\"%.2f\" y2=\"%.2f\"/>\n",
+              color, opacity, cx - dx, cy - dy, cx + dx, cy + dy);
+
+    } else {
+
+      double x = random.uniform(0, w - side), y = random.uniform(0, h - side);
+      fprintf(out, "<image x=\"%.2f\" y=\"%.2f\" width=\"%.2f\" height=\"%.2f\" "
+                   "xlink:href=\"%s\"/>\n", x, y, side, side, image.c_str());
+    }
+
+    // close the group chain after its last element
+    if (groups && i + 1 == group * total / groups) {
+      for (size_t d = 0; d < depth; ++d) fprintf(out, "</g>\n");
+    }
+  }
+
+  fprintf(out, "</svg>\n");
+  return fclose(out) ? -1 : 0;
+}
+
+} // namespace CMU462
@@ -0,0 +1,48 @@
+#ifndef CMU462_SVG_GENERATOR_H
+#define CMU462_SVG_GENERATOR_H
+
+#include <cstddef>
+
+namespace CMU462 {
+
+/**
+ * Synthetic svg documents, for scale testing.
+ * The same spec always gives the same file: shapes come from a seeded
+ * std::minstd_rand, whose sequence the standard fixes, and are written with
+ * fixed precision.
+ *
+ * Polygons are random star shaped (often concave) polygons of 3 to 8
+ * vertices, lines go in random directions, and images are copies of one
+ * generated png, embedded in base64. Elements are split evenly over the
+ * groups, each of which is a chain of nested groups (with small rotations)
+ * holding its elements in the innermost one. Shapes are sized so that,
+ * together, they cover the canvas about coverage times over.
+ */
+struct SyntheticSpec {
+
+  size_t polygons;
+  size_t lines;
+  size_t images;
+  size_t image_size;   // width and height of the images (pixels)
+  size_t groups;       // 0 puts every element at the top level
+  size_t depth;        // nesting of each group
+  float coverage;      // average number of shapes over a point
+  float alpha;         // fill and stroke opacity
+  float width, height; // canvas
+  unsigned seed;
+
+  SyntheticSpec() : polygons ( 1000 ), lines ( 1000 ), images ( 0 ),
+                    image_size ( 64 ), groups ( 0 ), depth ( 1 ),
+                    coverage ( 2 ), alpha ( 1 ), width ( 1000 ),
+                    height ( 1000 ), seed ( 462 ) { }
+
+  size_t elements() const { return polygons + lines + images; }
+};
+
+// Writes the document of a spec. Returns 0, or -1 if the file (or the
+// temporary png next to it) cannot be written.
+int write_synthetic_svg( const char* filename, const SyntheticSpec& spec );
+
+} // namespace CMU462
+
+#endif // CMU462_SVG_GENERATOR_H
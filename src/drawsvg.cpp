@@ -1,6 +1,9 @@
 #include "drawsvg.h"
+#include "profiler.h"
 
+#include <cmath>
 #include <sstream>
+#include <iomanip>
 #include <iostream>
 #include <cstdlib>
 
@@ -8,9 +11,21 @@ using namespace std;
 
 namespace CMU462 {
 
+// time without input after which an interaction is over (seconds)
+static const double INTERACTION_IDLE = 0.15;
+
 DrawSVG::~DrawSVG() {
 
+  // stop the render thread before the scenes it reads go away
+  delete async_renderer;
+
+  if (Profiler::stop_trace()) {
+    cerr << "Could not write the profiler trace" << endl;
+  }
+
   tabs.clear();
+  for (size_t i = 0; i < scenes.size(); ++i) delete scenes[i];
+  scenes.clear();
   viewport_imp.clear();
   viewport_ref.clear();
 
@@ -41,6 +56,16 @@ string DrawSVG::info() {
     if (sample_rate > 1) {
       osd += "( " + to_string(sample_rate * sample_rate) + "x SSAA)";
     }
+    if (tiled && software_renderer == software_renderer_imp) {
+      osd += " (Tiled)";
+    }
+  }
+
+  // the summary is empty until a new frame is drawn
+  if (Profiler::enabled()) {
+    string summary = Profiler::summary();
+    if (!summary.empty()) profile = summary;
+    if (!profile.empty()) osd += " | " + profile;
   }
 
   return osd;
@@ -64,6 +89,9 @@ void DrawSVG::init() {
   software_renderer_imp->set_tex_sampler(sampler_imp);
   software_renderer_ref->set_tex_sampler(sampler_ref);
 
+  // render thread, with its own renderer
+  async_renderer = new AsyncRenderer(sampler_imp);
+
   // generate mipmaps & set initial viewports
   for (size_t i = 0; i < tabs.size(); ++i) {
 
@@ -78,6 +106,10 @@ void DrawSVG::init() {
 
     // generate mipmaps
     regenerate_mipmap(i);
+
+    // flatten for the software renderer
+    scenes.push_back(new SVGScene());
+    scenes[i]->sync(*tabs[i]);
   }
 
   // set tab and transformation if tabs loaded
@@ -86,15 +118,32 @@ void DrawSVG::init() {
   // initial osd
   osd = "Software Renderer";
 
+  screenshot_count = 0;
+
+  // DRAWSVG_TRACE=<file> records a profiler trace of the session
+  const char* trace = getenv("DRAWSVG_TRACE");
+  if (trace && *trace) Profiler::start_trace(trace);
+
 }
 
 void DrawSVG::render() {
 
+  // refine the view once input goes idle
+  if (interacting) {
+    chrono::duration<double> idle = chrono::steady_clock::now() - last_input;
+    if (idle.count() > INTERACTION_IDLE) {
+      interacting = false;
+      if (render_async()) redraw();
+    }
+  }
+
   if (method == Hardware ) {
     redraw();
   }
 
   if( method == Software ) {
+    // pick up the latest frame of the render thread, if there is one
+    async_renderer->present( framebuffer, width, height );
     display_pixels( &framebuffer[0] );
   }
 
@@ -178,12 +227,39 @@ void DrawSVG::key_event( char key ) {
       }
       break;
 
+    // toggle tiled rendering
+    case 'T':
+      tiled = !tiled;
+      async_renderer->set_tiled(tiled);
+      redraw();
+      break;
+
+    // toggle the profiler summary on the osd
+    case 'I':
+      Profiler::enable(!Profiler::enabled());
+      profile.clear();
+      redraw();
+      break;
+
     // toggle zoom
     case 'Z':
       show_zoom = !show_zoom;
       break;
 
-    // tab selection
+    // save the framebuffer to a png file
+    case 'P':
+      if (method == Software) save_framebuffer();
+      break;
+
+    // previous / next tab, for any number of tabs
+    case '[':
+      if (!tabs.empty()) setTab( (current_tab + tabs.size() - 1) % tabs.size() );
+      break;
+    case ']':
+      if (!tabs.empty()) setTab( (current_tab + 1) % tabs.size() );
+      break;
+
+    // tab selection (first ten tabs)
     case '0':
       setTab( 9 );
       break;
@@ -223,14 +299,17 @@ void DrawSVG::key_event( char key ) {
 void DrawSVG::cursor_event( float x, float y, unsigned char keys ) {
   
   // translate when left mouse button is held down
-  // diff is disabled when panning - it's too slow
   if (keys & (1 << 2)) {
   
-    show_diff = false;
-    float dx = (x - cursor_x) / width  * tabs[current_tab]->width;
-    float dy = (y - cursor_y) / height * tabs[current_tab]->height;
+    // move by whole screen pixels (the drawing follows the cursor), which
+    // lets the software renderer shift the last frame instead of
+    // drawing a new one
+    Matrix3x3 m = norm_to_screen * viewport_imp[current_tab]->get_canvas_to_norm();
+    float dx = round(x - cursor_x) / m(0,0);
+    float dy = round(y - cursor_y) / m(1,1);
     viewport_imp[current_tab]->update_viewbox(dx, dy, 1);
     viewport_ref[current_tab]->update_viewbox(dx, dy, 1);
+    interact();
     redraw();
   }
   
@@ -240,14 +319,20 @@ void DrawSVG::cursor_event( float x, float y, unsigned char keys ) {
 }
 
 void DrawSVG::scroll_event( float offset_x, float offset_y ) {
-  // diff is disabled when zooming - it's too slow
   if (offset_x || offset_y) {
-    show_diff = false;
     // prevent inverting axis when scrolling too fast
     float scale = 1 + 0.05 * offset_x + 0.05 * offset_y;
     scale = scale < 0.5 ? 0.5 : (scale > 1.5 ? 1.5 : scale); 
+
+    // tiles are drawn at discrete scales, zoom one level at a time
+    if (tiled && render_async() && scale != 1) {
+      Matrix3x3 m = norm_to_screen * viewport_imp[current_tab]->get_canvas_to_norm();
+      int level = TileCache::level(m(0,0)) + (scale > 1 ? -1 : 1);
+      scale = m(0,0) / TileCache::level_scale(level);
+    }
     viewport_imp[current_tab]->update_viewbox(0, 0, scale);
     viewport_ref[current_tab]->update_viewbox(0, 0, scale);
+    interact();
     redraw();
   }
 }
@@ -264,17 +349,18 @@ void DrawSVG::clear( void ) {
 }
 
 void DrawSVG::newTab( SVG* svg ) {
-  if (tabs.size() < 9) {
-    tabs.push_back(svg);
-  } else {
-    fprintf(stderr, "DrawSVG can only hold up to 9 tabs");
-  }
+  tabs.push_back(svg);
 }
 
 void DrawSVG::delTab( size_t tab_index ) {
+  async_renderer->invalidate();
   if (tab_index < tabs.size()) {
     tabs.erase(tabs.begin() + tab_index);
   }
+  if (tab_index < scenes.size()) {
+    delete scenes[tab_index];
+    scenes.erase(scenes.begin() + tab_index);
+  }
 }
 
 void DrawSVG::setTab( size_t tab_index ) {
@@ -291,36 +377,43 @@ void DrawSVG::setTab( size_t tab_index ) {
 
 void DrawSVG::draw_diff() {
 
-  // get reference output
+  // get reference output, and keep it
   software_renderer_ref->draw_svg(*tabs[current_tab]);
-  
-  // save reference output
-  vector<unsigned char> reference ( 4 * width * height );
-  memcpy(&reference[0], &framebuffer[0], 4 * width * height );
+  diff_reference.resize( 4 * width * height );
+  memcpy(&diff_reference[0], &framebuffer[0], 4 * width * height );
   memset(&framebuffer[0], 255, 4 * width * height);
 
   // get implementation output
-  software_renderer_imp->draw_svg(*tabs[current_tab]);
+  static_cast<SoftwareRendererImp*>(software_renderer_imp)->draw_scene(*scenes[current_tab]);
 
-  // take difference and count errors
-  int errorCount = 0;
-  for( size_t i = 0; i < width * height; i++ ) {
+  // replace it by the error heatmap
+  diff = diff_images(&diff_reference[0], &framebuffer[0], width, height,
+                     &framebuffer[0]);
 
-    framebuffer[i*4 + 0] = abs(reference[i*4 + 0] - framebuffer[i*4 + 0]);
-    framebuffer[i*4 + 1] = abs(reference[i*4 + 1] - framebuffer[i*4 + 1]);
-    framebuffer[i*4 + 2] = abs(reference[i*4 + 2] - framebuffer[i*4 + 2]);
-    framebuffer[i*4 + 3] = 255;
+  ostringstream info;
+  info << diff.different << " pixels different, max error " << diff.max_error
+       << ", RMSE " << fixed << setprecision(2) << diff.rmse << ", PSNR ";
+  if (diff.different) info << diff.psnr << " dB"; else info << "inf";
+  osd = info.str();
+}
 
-    for( int k = 0; k < 3; k++ ) {
-      if( framebuffer[i*4+k] ) {
-        errorCount++;
-        break;
-      }
-    }
-  
-    osd = to_string(errorCount) + " pixels different";
-  }
+int DrawSVG::getErrorCount( void ) const {
+  return diff.different;
+}
+
+void DrawSVG::save_framebuffer() {
 
+  PNG png;
+  png.width  = width;
+  png.height = height;
+  png.pixels = framebuffer;
+
+  string filename = "drawsvg_" + to_string(++screenshot_count) + ".png";
+  if (PNGParser::save(filename.c_str(), png)) {
+    cerr << "Could not save " << filename << endl;
+  } else {
+    cerr << "Saved framebuffer to " << filename << endl;
+  }
 }
 
 void DrawSVG::draw_zoom() {
@@ -415,8 +508,6 @@ void DrawSVG::dec_sample_rate() {
 
 void DrawSVG::redraw() {
 
-  clear();
-
   // set canvas_to_screen transformation
   Matrix3x3 m_imp = norm_to_screen * viewport_imp[current_tab]->get_canvas_to_norm();
   Matrix3x3 m_ref = norm_to_screen * viewport_ref[current_tab]->get_canvas_to_norm();
@@ -424,6 +515,23 @@ void DrawSVG::redraw() {
   software_renderer_ref->set_canvas_to_screen( m_ref ); 
   hardware_renderer->set_canvas_to_screen( m_ref );
 
+  // The software renderer (imp) draws on the render thread so that input
+  // events do not wait for it. The current frame stays up until render
+  // presents the new one.
+  if (render_async()) {
+    if (interacting && !tiled) {
+      async_renderer->preview( scenes[current_tab], m_imp, width, height );
+    } else {
+      async_renderer->request( scenes[current_tab], m_imp,
+                               width, height, sample_rate );
+    }
+    return;
+  }
+
+  // a frame drawn here replaces the one in flight
+  async_renderer->cancel();
+  clear();
+
   switch (method) {
 
     case Hardware:  
@@ -440,7 +548,21 @@ void DrawSVG::redraw() {
   }
 }
 
+bool DrawSVG::render_async() const {
+  return method == Software && !show_diff &&
+         software_renderer == software_renderer_imp;
+}
+
+void DrawSVG::interact() {
+  interacting = true;
+  last_input = chrono::steady_clock::now();
+}
+
 void DrawSVG::regenerate_mipmap(size_t tab_index) {
+
+  // the render thread may be sampling the textures, and has tiles of them
+  async_renderer->invalidate();
+
   if (tab_index < tabs.size()) {
     SVG* svg = tabs[tab_index];
     for ( size_t i = 0; i < svg->elements.size(); ++i ) {
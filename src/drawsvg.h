@@ -2,11 +2,15 @@
 #define CMU462_DRAWSVG_H
 
 #include <vector>
+#include <chrono>
 
 #include "CMU462.h"
 #include "svg.h"
+#include "png.h"
 #include "hardware_renderer.h"
 #include "software_renderer.h"
+#include "async_renderer.h"
+#include "image_diff.h"
 
 namespace CMU462 {
 
@@ -38,7 +42,10 @@ class DrawSVG : public Renderer {
     sample_rate (1),
     current_tab (0),
     show_diff (false),
+    diff (),
     show_zoom (false),
+    interacting (false),
+    tiled (false),
     norm_to_screen ( Matrix3x3::identity() )  { }
 
   /**
@@ -95,7 +102,8 @@ class DrawSVG : public Renderer {
   void drawIllustration( SVG& svg );
 
   /**
-   * Load a svg into a new tab if there is one available.
+   * Load a svg into a new tab. The number of tabs is unbounded, the
+   * number keys select the first ten and '[' / ']' cycle through all.
    */
   void newTab( SVG* svg );
 
@@ -128,6 +136,9 @@ class DrawSVG : public Renderer {
   /* info to post to viewer osd */
   std::string osd;
 
+  /* last profiler summary, shown on the osd while profiling */
+  std::string profile;
+
   /* hardware renderer */
   HardwareRenderer* hardware_renderer;
 
@@ -136,6 +147,20 @@ class DrawSVG : public Renderer {
   SoftwareRenderer* software_renderer_imp;
   SoftwareRenderer* software_renderer_ref;
 
+  /* render thread, for the software renderer (imp) */
+  AsyncRenderer* async_renderer;
+  bool render_async() const;
+
+  /* panning or zooming: the render thread draws fast previews until input
+   * has been idle for a moment, then refines the view */
+  bool interacting;
+  std::chrono::steady_clock::time_point last_input;
+  void interact();
+
+  /* draw the software renderer (imp) view from cached tiles, zooming by
+   * tile levels (see TileCache) */
+  bool tiled;
+
   /* texture sampler */
   Sampler2D* sampler;
   Sampler2D* sampler_imp;
@@ -143,17 +168,25 @@ class DrawSVG : public Renderer {
 
   /* tabs */
   std::vector<SVG*> tabs; size_t current_tab;
+  std::vector<SVGScene*> scenes; // flattened tabs, for the software renderer
   std::vector<Viewport*> viewport_imp;
   std::vector<Viewport*> viewport_ref;
   
-  /* diff */
+  /* diff: error heatmap of the software renderer (imp) against the
+   * reference, with its metrics on the osd */
   bool show_diff;
   void draw_diff();
+  std::vector<unsigned char> diff_reference;
+  ImageDiff diff;
   
   /* zoom */
   bool show_zoom;
   void draw_zoom();
 
+  /* save framebuffer to drawsvg_<n>.png */
+  size_t screenshot_count;
+  void save_framebuffer();
+
   /* samples rate (sqrt(s/pix)) */
   size_t sample_rate;
   void inc_sample_rate();
@@ -0,0 +1,398 @@
+#include "svg.h"
+#include "png.h"
+#include "texture.h"
+#include "viewport.h"
+#include "software_renderer.h"
+#include "profiler.h"
+#include "png_writer.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace CMU462;
+
+#define msg(s) cerr << "[drawsvg_cli] " << s << endl;
+
+/**
+ * Headless batch renderer.
+ * Renders svg files (or all the svg files in the given directories) with
+ * the software renderer and writes the results as png files, without
+ * opening a window. The view is framed the same way as in the viewer.
+ *
+ * Images too large to hold in memory (poster prints) are drawn in bands
+ * of rows that are streamed to the png file as they are done, so memory
+ * use depends on the band size only.
+ */
+
+// images whose target and sample buffer take more than this are drawn in
+// bands of about BAND_BYTES (unless a band height is given)
+static const size_t MAX_FRAME_BYTES = 1 << 30;
+static const size_t BAND_BYTES = 1 << 28;
+
+struct Options {
+  size_t width, height;
+  size_t sample_rate;
+  string output_dir;
+  string cache_dir;
+  PNGCompression compression;
+  bool stream;
+  size_t band; // rows per band, 0 to draw the whole image at once
+};
+
+static void usage() {
+  msg("Usage: drawsvg_cli [options] <svg file or directory> ...");
+  msg("  -o <dir>     output directory (default: current directory)");
+  msg("  -r <w>x<h>   output resolution (default: 800x600)");
+  msg("  -s <rate>    supersampling rate per axis (default: 1)");
+  msg("  -c <dir>     scene cache directory (default: none)");
+  msg("  --small      optimize the png files for size instead of speed");
+  msg("  --stream     draw elements as they are parsed, without building the");
+  msg("               element tree (ignores -c)");
+  msg("  -b <rows>    draw in bands of this many rows, streamed to the png");
+  msg("               file (default: only images too large for memory)");
+  msg("  --profile    print where the time went per file");
+  msg("  --trace <file>  also write a Chrome trace of the run");
+}
+
+static void collectPath( const string& path, vector<string>& files ) {
+
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
+    msg("File does not exist: " << path);
+    return;
+  }
+
+  if (st.st_mode & S_IFDIR) {
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+      msg("Could not open directory " << path);
+      return;
+    }
+
+    vector<string> entries;
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+      string name = ent->d_name;
+      if (name.size() > 4 && name.substr(name.size() - 4) == ".svg") {
+        entries.push_back(name);
+      }
+    }
+    closedir(dir);
+
+    sort(entries.begin(), entries.end());
+    string pathname = path;
+    if (pathname.back() != '/') pathname.push_back('/');
+    for (size_t i = 0; i < entries.size(); ++i) {
+      files.push_back(pathname + entries[i]);
+    }
+    return;
+  }
+
+  files.push_back(path);
+}
+
+// output file name: the svg file name with a png extension
+static string outputPath( const string& path, const Options& options ) {
+
+  size_t slash = path.find_last_of('/');
+  string name = slash == string::npos ? path : path.substr(slash + 1);
+  size_t dot = name.find_last_of('.');
+  if (dot != string::npos) name = name.substr(0, dot);
+
+  string dir = options.output_dir;
+  if (!dir.empty() && dir.back() != '/') dir.push_back('/');
+  return dir + name + ".png";
+}
+
+// generate the mipmaps that did not come from the scene cache
+static void generateMipmaps( vector<SVGElement*>& elements, Sampler2D& sampler ) {
+  for (size_t i = 0; i < elements.size(); ++i) {
+    if (elements[i]->type == IMAGE) {
+      Texture& tex = static_cast<Image*>(elements[i])->tex;
+      if (tex.mipmap.size() == 1) sampler.generate_mips(tex, 0);
+    } else if (elements[i]->type == GROUP) {
+      generateMipmaps(static_cast<Group*>(elements[i])->elements, sampler);
+    }
+  }
+}
+
+// frame the drawing like DrawSVG::auto_adjust
+static void frameView( SoftwareRendererImp& renderer, const Options& options,
+                       float width, float height ) {
+
+  ViewportImp viewport;
+  float span = 1.2 * max(width, height) / 2;
+  viewport.set_viewbox(width / 2, height / 2, span);
+
+  float scale = min(options.width, options.height);
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (options.width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (options.height - scale) / 2;
+
+  renderer.clear_target();
+  renderer.set_canvas_to_screen(norm_to_screen * viewport.get_canvas_to_norm());
+}
+
+// draws the elements of a svg as the parser emits them
+class StreamRenderer : public SVGHandler {
+ public:
+
+  StreamRenderer( SoftwareRendererImp& renderer, Sampler2D& sampler,
+                  const Options& options )
+    : renderer ( renderer ), sampler ( sampler ), options ( options ) { }
+
+  int begin_svg( float width, float height ) {
+    this->width = width; this->height = height;
+    frameView(renderer, options, width, height);
+    renderer.begin_frame();
+    transforms.assign(1, Matrix3x3::identity());
+    layered.clear();
+    return 0;
+  }
+
+  int end_svg() {
+    renderer.end_frame(width, height);
+    PROFILE_FRAME();
+    return 0;
+  }
+
+  // groups with an opacity are drawn into a layer, like draw_group does
+  int begin_group( Group* group ) {
+    transforms.push_back(transforms.back() * group->transform);
+    layered.push_back(group->opacity < 1);
+    if (layered.back()) renderer.begin_layer(group->opacity);
+    return 0;
+  }
+
+  int end_group( Group* /*group*/ ) {
+    if (layered.back()) renderer.end_layer();
+    layered.pop_back();
+    transforms.pop_back();
+    return 0;
+  }
+
+  int element( SVGElement* element ) {
+    if (element->type == IMAGE) {
+      sampler.generate_mips(static_cast<Image*>(element)->tex, 0);
+    }
+    renderer.draw_element(element, transforms.back());
+    return 0;
+  }
+
+ private:
+
+  SoftwareRendererImp& renderer;
+  Sampler2D& sampler;
+  const Options& options;
+
+  float width, height;
+  vector<Matrix3x3> transforms;
+  vector<bool> layered; // whether each open group has a layer
+
+};
+
+// writes the bands of an image to a png file as they are drawn
+class BandWriter : public BandHandler {
+ public:
+
+  BandWriter( PNGWriter& writer ) : writer ( writer ) { }
+
+  int band( const unsigned char* rgba, size_t /*y*/, size_t rows ) {
+    return writer.write_rows(rgba, rows);
+  }
+
+ private:
+
+  PNGWriter& writer;
+
+};
+
+static int renderBands( const string& path, const Options& options,
+                        SoftwareRendererImp& renderer, const SVGScene& scene ) {
+
+  string output = outputPath(path, options);
+
+  // PNGParser::save drops the alpha channel of opaque images when
+  // optimizing for size. Bands are always opaque, so the compression level
+  // alone makes the same choice, without looking at the pixels first.
+  PNGWriter writer(options.compression);
+  BandWriter bands(writer);
+  bool alpha = options.compression != PNG_COMPRESSION_SMALL;
+  int status = writer.open(output.c_str(), options.width, options.height, alpha);
+  if (!status) status = renderer.draw_scene_bands(scene, options.height, bands);
+  if (!status) status = writer.close();
+  if (status) {
+    msg("Could not write " << output);
+    return -1;
+  }
+
+  msg(path << " -> " << output << " (bands of " << options.band << " rows)");
+  return 0;
+}
+
+static int renderFile( const string& path, const Options& options,
+                       SoftwareRendererImp& renderer, Sampler2D& sampler,
+                       vector<unsigned char>& framebuffer ) {
+
+  if (options.stream) {
+
+    StreamRenderer handler(renderer, sampler, options);
+    if (SVGParser::stream(path.c_str(), handler)) {
+      msg("Could not load " << path);
+      return -1;
+    }
+
+  } else {
+
+    SVG svg;
+    int status = options.cache_dir.empty() ?
+      SVGParser::load(path.c_str(), &svg) :
+      SVGParser::loadCached(path.c_str(), &svg, options.cache_dir.c_str(), &sampler);
+    if (status < 0) {
+      msg("Could not load " << path);
+      return -1;
+    }
+    generateMipmaps(svg.elements, sampler);
+
+    frameView(renderer, options, svg.width, svg.height);
+    SVGScene scene;
+    scene.sync(svg);
+    if (options.band) return renderBands(path, options, renderer, scene);
+    renderer.draw_scene(scene);
+  }
+
+  // the png borrows the framebuffer without copying it, and gives it back
+  // (the same storage, which stays the render target) once written
+  PNG png;
+  png.width  = options.width;
+  png.height = options.height;
+  png.pixels.swap(framebuffer);
+
+  string output = outputPath(path, options);
+  int status = PNGParser::save(output.c_str(), png, options.compression);
+  png.pixels.swap(framebuffer);
+  if (status) {
+    msg("Could not write " << output);
+    return -1;
+  }
+
+  msg(path << " -> " << output);
+  return 0;
+}
+
+int main( int argc, char** argv ) {
+
+  Options options;
+  options.width = 800;
+  options.height = 600;
+  options.sample_rate = 1;
+  options.compression = PNG_COMPRESSION_FAST;
+  options.stream = false;
+  options.band = 0;
+  bool profile = false;
+  string trace;
+
+  vector<string> paths;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "-o" && i + 1 < argc) {
+      options.output_dir = argv[++i];
+    } else if (arg == "-r" && i + 1 < argc) {
+      int w = 0, h = 0;
+      if (sscanf(argv[++i], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+        msg("Invalid resolution: " << argv[i]);
+        return 1;
+      }
+      options.width = w; options.height = h;
+    } else if (arg == "-s" && i + 1 < argc) {
+      options.sample_rate = max(1, atoi(argv[++i]));
+    } else if (arg == "-b" && i + 1 < argc) {
+      options.band = max(1, atoi(argv[++i]));
+    } else if (arg == "-c" && i + 1 < argc) {
+      options.cache_dir = argv[++i];
+    } else if (arg == "--small") {
+      options.compression = PNG_COMPRESSION_SMALL;
+    } else if (arg == "--stream") {
+      options.stream = true;
+    } else if (arg == "--profile") {
+      profile = true;
+    } else if (arg == "--trace" && i + 1 < argc) {
+      trace = argv[++i];
+    } else if (arg == "--help") {
+      usage();
+      return 0;
+    } else if (!arg.empty() && arg[0] == '-') {
+      msg("Unknown option: " << arg);
+      usage();
+      return 1;
+    } else {
+      paths.push_back(arg);
+    }
+  }
+
+  if (paths.empty()) {
+    usage();
+    return 1;
+  }
+
+  vector<string> files;
+  for (size_t i = 0; i < paths.size(); ++i) collectPath(paths[i], files);
+  if (files.empty()) {
+    msg("No svg files found");
+    return 1;
+  }
+
+  // target and sample buffer bytes per row
+  size_t row_bytes = options.width * (4 + 4 * sizeof(float) *
+                                      options.sample_rate * options.sample_rate);
+  if (!options.band && row_bytes * options.height > MAX_FRAME_BYTES) {
+    options.band = max((size_t) 1, BAND_BYTES / row_bytes);
+  }
+  if (options.band >= options.height) options.band = 0;
+  if (options.band && options.stream) {
+    msg("Drawing in bands needs the whole scene, it cannot be combined with --stream");
+    return 1;
+  }
+
+  // the render target (a band, or the whole image) is set before the
+  // sample rate, which sizes the supersample buffer from the target
+  // dimensions
+  size_t rows = options.band ? options.band : options.height;
+  vector<unsigned char> framebuffer(4 * options.width * rows);
+  Sampler2DImp sampler;
+  SoftwareRendererImp renderer;
+  renderer.set_tex_sampler(&sampler);
+  renderer.set_render_target(&framebuffer[0], options.width, rows);
+  renderer.set_sample_rate(options.sample_rate);
+
+  if (!trace.empty()) Profiler::start_trace(trace);
+  else if (profile) Profiler::enable(true);
+
+  size_t failed = 0;
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (renderFile(files[i], options, renderer, sampler, framebuffer) < 0) failed++;
+    if (Profiler::enabled()) {
+      string summary = Profiler::summary();
+      if (!summary.empty()) msg(files[i] << ": " << summary);
+    }
+  }
+
+  if (Profiler::stop_trace()) {
+    msg("Could not write " << trace);
+    failed++;
+  } else if (!trace.empty()) {
+    msg("Trace written to " << trace);
+  }
+
+  msg("Rendered " << files.size() - failed << " of " << files.size() << " files");
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,158 @@
+#include "flattening.h"
+#include "profiler.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+const float PathCache::TOLERANCE = 0.2f;
+
+// segments of a cubic are uniform steps in t, at most this many
+static const int MAX_STEPS = 4096;
+
+// zoom buckets are octaves of scale in this range
+static const int MIN_BUCKET = -100, MAX_BUCKET = 100;
+
+static void add_point( FlatPath& flat, const Vector2D& p ) {
+  if ( flat.points.size() > (flat.ends.empty() ? 0 : flat.ends.back()) ) {
+    const Vector2D& last = flat.points.back();
+    if ( last.x == p.x && last.y == p.y ) return;
+  }
+  flat.points.push_back(p);
+}
+
+static void end_subpath( FlatPath& flat, bool closed ) {
+
+  uint32_t begin = flat.ends.empty() ? 0 : flat.ends.back();
+  if ( closed && flat.points.size() > begin + 1 ) {
+    const Vector2D& first = flat.points[begin];
+    const Vector2D& last  = flat.points.back();
+    if ( first.x == last.x && first.y == last.y ) flat.points.pop_back();
+  }
+  flat.ends.push_back(flat.points.size());
+  flat.closed.push_back(closed);
+}
+
+void flatten( const Path& path, float tolerance, FlatPath& flat ) {
+
+  PROFILE_SCOPE("flatten");
+  flat.points.clear(); flat.ends.clear(); flat.closed.clear();
+
+  const Vector2D* p = path.points.data();
+  const Vector2D* points_end = p + path.points.size();
+  Vector2D start, current;
+  bool open = false;
+
+  for ( size_t i = 0; i < path.commands.size(); ++i ) {
+
+    uint8_t command = path.commands[i];
+    size_t n = command == PATH_CUBIC ? 3 : command == PATH_CLOSE ? 0 : 1;
+    if ( (size_t) (points_end - p) < n ) break;
+
+    if ( command == PATH_MOVE ) {
+      if ( open ) end_subpath(flat, false);
+      start = current = *p++;
+      flat.points.push_back(current);
+      open = true;
+      continue;
+    }
+
+    if ( command == PATH_CLOSE ) {
+      if ( open ) end_subpath(flat, true);
+      open = false;
+      current = start;
+      continue;
+    }
+
+    // drawing after a close starts a new subpath where the last one began
+    if ( !open ) {
+      flat.points.push_back(start);
+      open = true;
+    }
+
+    if ( command == PATH_LINE ) {
+      current = *p++;
+      add_point(flat, current);
+      continue;
+    }
+
+    // Wang's formula: n uniform steps of a cubic are within tolerance of
+    // it when n >= sqrt(3/4 M / tolerance), M being the largest second
+    // difference of its control points
+    Vector2D p0 = current, p1 = p[0], p2 = p[1], p3 = p[2];
+    p += 3;
+    Vector2D d0 = p0 - 2 * p1 + p2, d1 = p1 - 2 * p2 + p3;
+    double m = sqrt(max(d0.norm2(), d1.norm2()));
+    double steps = ceil(sqrt(0.75 * m / tolerance));
+    int k = steps > 1 ? (int) min(steps, (double) MAX_STEPS) : 1;
+
+    // power basis, evaluated with Horner's rule
+    Vector2D b = 3 * (p1 - p0), c = 3 * d0, d = p3 - p0 + 3 * (p1 - p2);
+    for ( int j = 1; j < k; ++j ) {
+      double t = (double) j / k;
+      add_point(flat, p0 + t * (b + t * (c + t * d)));
+    }
+    add_point(flat, p3);
+    current = p3;
+  }
+
+  if ( open ) end_subpath(flat, false);
+}
+
+// Largest stretch of the linear part of an affine transformation (its
+// largest singular value), which bounds how much it scales distances.
+static double max_scale( const Matrix3x3& m ) {
+  double a = m(0,0), b = m(1,0), c = m(0,1), d = m(1,1);
+  double e = a * a + b * b + c * c + d * d;
+  double det = a * d - b * c;
+  return sqrt((e + sqrt(max(e * e - 4 * det * det, 0.0))) / 2);
+}
+
+const FlatPath& PathCache::get( const Path& path, const Matrix3x3& transform ) {
+
+  double scale = max_scale(transform);
+  int bucket = scale > 0 && isfinite(scale) ? (int) ceil(log2(scale)) : MIN_BUCKET;
+  bucket = min(max(bucket, MIN_BUCKET), MAX_BUCKET);
+  uint64_t key = path.id << 8 | (uint64_t) (bucket - MIN_BUCKET);
+
+  unordered_map<uint64_t, Entry>::iterator it = entries.find(key);
+  if ( it == entries.end() ) {
+    if ( num_points > max_points ) evict();
+    it = entries.insert(make_pair(key, Entry())).first;
+    flatten(path, TOLERANCE / ldexp(1.0, bucket), it->second.flat);
+    num_points += it->second.flat.points.size();
+  }
+
+  Entry& entry = it->second;
+  entry.used = ++clock;
+  return entry.flat;
+}
+
+void PathCache::evict( void ) {
+
+  if ( entries.empty() ) return;
+
+  vector<uint64_t> used;
+  used.reserve(entries.size());
+  for ( unordered_map<uint64_t, Entry>::iterator it = entries.begin();
+        it != entries.end(); ++it ) {
+    used.push_back(it->second.used);
+  }
+  nth_element(used.begin(), used.begin() + used.size() / 2, used.end());
+  uint64_t median = used[used.size() / 2];
+
+  for ( unordered_map<uint64_t, Entry>::iterator it = entries.begin();
+        it != entries.end(); ) {
+    if ( it->second.used < median ) {
+      num_points -= it->second.flat.points.size();
+      it = entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+} // namespace CMU462
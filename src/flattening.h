@@ -0,0 +1,79 @@
+#ifndef CMU462_FLATTENING_H
+#define CMU462_FLATTENING_H
+
+#include <vector>
+#include <stdint.h>
+#include <unordered_map>
+
+#include "svg.h"
+
+namespace CMU462 {
+
+/**
+ * A path flattened into polylines, in the coordinates of its points:
+ * subpath k is the points [ends[k - 1], ends[k]) (from 0 for the first),
+ * closed if closed[k] is set. Consecutive duplicate points are dropped,
+ * as is the last point of a closed subpath when it is back at the first.
+ * The fill is the polygons of all the subpaths together (open ones closed
+ * as for filling), under the fill rule of the path, so that subpaths
+ * inside others can cut holes in them.
+ */
+struct FlatPath {
+
+  std::vector<Vector2D> points;
+  std::vector<uint32_t> ends;
+  std::vector<uint8_t>  closed;
+
+};
+
+// Flatten a path, keeping its segments within tolerance of its curves.
+// Each cubic is cut in the fewest uniform steps that Wang's formula
+// guarantees are within tolerance, which grows with the square root of
+// how much the curve bends: flat and small curves take a step or two.
+void flatten( const Path& path, float tolerance, FlatPath& flat );
+
+/**
+ * Flattened paths, for drawing. Flattening depends on the zoom, which is
+ * split in buckets of one octave: a path is flattened for the largest
+ * scale of the bucket of its transformation, which keeps it within
+ * tolerance (in pixels) at every scale of the bucket, and the result is
+ * kept for the next draws of the path with a scale in the same bucket.
+ * Translations and rotations do not change the bucket, so panning reuses
+ * every flattening. The least recently used paths are dropped once the
+ * cache holds more than a budget of points.
+ */
+class PathCache {
+ public:
+
+  PathCache( size_t max_points = 1 << 22 )
+    : max_points ( max_points ), num_points ( 0 ), clock ( 0 ) { }
+
+  // the path flattened for drawing with transform (its points to screen).
+  // The reference is valid until the next call.
+  const FlatPath& get( const Path& path, const Matrix3x3& transform );
+
+  void clear( void ) { entries.clear(); num_points = 0; }
+
+  // error of the flattened paths on screen (pixels)
+  static const float TOLERANCE;
+
+ private:
+
+  struct Entry {
+    FlatPath flat;
+    uint64_t used;
+  };
+
+  // by path id and bucket
+  std::unordered_map<uint64_t, Entry> entries;
+  size_t max_points, num_points;
+  uint64_t clock;
+
+  // drop the least recently used half of the entries
+  void evict( void );
+
+}; // class PathCache
+
+} // namespace CMU462
+
+#endif // CMU462_FLATTENING_H
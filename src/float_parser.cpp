@@ -0,0 +1,126 @@
+#include "float_parser.h"
+
+#include <stdint.h>
+#include <cmath>
+#include <cstring>
+#include <locale>
+#include <sstream>
+
+namespace CMU462 {
+
+static inline bool is_space( char c ) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool is_digit( char c ) {
+  return (unsigned char) (c - '0') < 10;
+}
+
+// powers of ten that are exact in a double
+static const double POW10[23] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Is d exactly halfway between two floats (or outside the normal float
+// range)? Rounding a correctly rounded double to float gives the correctly
+// rounded float in every other case.
+static inline bool is_float_midpoint( double d ) {
+  uint64_t bits; memcpy(&bits, &d, sizeof(bits));
+  int exponent = (int) ((bits >> 52) & 0x7ff) - 1023;
+  if (exponent < -126 || exponent > 127) return true;
+  return (bits & ((1ULL << 29) - 1)) == (1ULL << 28);
+}
+
+const char* parse_float( const char* text, float& value ) {
+
+  const char* p = text;
+  while (is_space(*p)) p++;
+  const char* start = p;
+
+  bool negative = false;
+  if (*p == '+' || *p == '-') negative = *p++ == '-';
+
+  // up to 19 significant digits in mantissa, the rest only move exponent
+  uint64_t mantissa = 0;
+  int digits = 0, exponent = 0;
+  bool any = false, truncated = false;
+
+  while (*p == '0') { p++; any = true; }
+  for (; is_digit(*p); p++, any = true) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0'); digits++;
+    } else {
+      exponent++; truncated |= *p != '0';
+    }
+  }
+
+  if (*p == '.') {
+    p++;
+    if (!digits) {
+      for (; *p == '0'; p++, any = true) exponent--;
+    }
+    for (; is_digit(*p); p++, any = true) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0'); digits++; exponent--;
+      } else {
+        truncated |= *p != '0';
+      }
+    }
+  }
+
+  if (!any) return NULL;
+
+  // the exponent is only part of the number if it has digits
+  if (*p == 'e' || *p == 'E') {
+    const char* q = p + 1;
+    bool exp_negative = false;
+    if (*q == '+' || *q == '-') exp_negative = *q++ == '-';
+    if (is_digit(*q)) {
+      int e = 0;
+      for (; is_digit(*q); q++) if (e < 100000) e = e * 10 + (*q - '0');
+      exponent += exp_negative ? -e : e;
+      p = q;
+    }
+  }
+
+  if (mantissa == 0) {
+    value = negative ? -0.0f : 0.0f;
+    return p;
+  }
+
+  // fast path: both the mantissa and the power of ten are exact doubles,
+  // so a single multiplication or division is correctly rounded
+  if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+    double d = (double) mantissa;
+    d = exponent < 0 ? d / POW10[-exponent] : d * POW10[exponent];
+    if (!is_float_midpoint(d)) {
+      value = negative ? -(float) d : (float) d;
+      return p;
+    }
+  }
+
+  // slow path (long mantissas, large exponents, exact ties): let the
+  // standard library round, in the classic locale
+  std::istringstream in(std::string(start, p));
+  in.imbue(std::locale::classic());
+  float f;
+  if (in >> f) {
+    value = f;
+  } else {
+    // out of float range
+    double d = mantissa * pow(10.0, exponent);
+    value = negative ? -(float) d : (float) d;
+  }
+
+  return p;
+}
+
+const char* skip_separator( const char* text ) {
+  while (is_space(*text)) text++;
+  if (*text == ',') text++;
+  while (is_space(*text)) text++;
+  return text;
+}
+
+} // namespace CMU462
@@ -0,0 +1,26 @@
+#ifndef CMU462_FLOAT_PARSER_H
+#define CMU462_FLOAT_PARSER_H
+
+#include <stddef.h>
+
+namespace CMU462 {
+
+/**
+ * Parse a SVG number ([+-] digits [. digits] [e [+-] digits]) at text,
+ * after any leading whitespace. The result is correctly rounded and does
+ * not depend on the locale. Returns a pointer to the first character
+ * after the number, or NULL (leaving value untouched) if there is no
+ * number at text. A number ends wherever it can no longer continue, so
+ * "1-2" and ".5.5" both hold two numbers, as the SVG grammar requires.
+ */
+const char* parse_float( const char* text, float& value );
+
+/**
+ * Skip a SVG comma-wsp separator: whitespace, at most one comma and more
+ * whitespace.
+ */
+const char* skip_separator( const char* text );
+
+} // namespace CMU462
+
+#endif // CMU462_FLOAT_PARSER_H
@@ -0,0 +1,150 @@
+#include "image_diff.h"
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IMAGE_DIFF_X86
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace CMU462 {
+
+// pixels compared at a time, per thread
+static const size_t CHUNK = 256;
+
+// heatmap color of each error
+struct HeatColors {
+
+  unsigned char rgba[256][4];
+
+  HeatColors() {
+    static const float keys[5][3] = {
+      {   0,   0,  96 }, {   0,   0, 255 }, { 255,   0,   0 },
+      { 255, 255,   0 }, { 255, 255, 255 }
+    };
+    memset(rgba[0], 0, 3); rgba[0][3] = 255;
+    for (int e = 1; e < 256; ++e) {
+      // square root, so that small errors are not all dark blue
+      float t = sqrt(e / 255.0f) * 4;
+      int k = min((int) t, 3); t -= k;
+      for (int c = 0; c < 3; ++c) {
+        rgba[e][c] = (unsigned char) (keys[k][c] + t * (keys[k+1][c] - keys[k][c]) + 0.5f);
+      }
+      rgba[e][3] = 255;
+    }
+  }
+};
+
+// Errors (largest color channel difference) of n pixels into errors.
+// Returns the sum of the squared channel differences, and raises
+// max_error to the largest one.
+static uint64_t diff_scalar( const unsigned char* a, const unsigned char* b,
+                             size_t n, unsigned char* errors, int& max_error ) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; ++i) {
+    int e = 0;
+    for (int c = 0; c < 3; ++c) {
+      int d = abs(a[4*i + c] - b[4*i + c]);
+      sum += d * d;
+      e = max(e, d);
+    }
+    errors[i] = e;
+    max_error = max(max_error, e);
+  }
+  return sum;
+}
+
+#ifdef IMAGE_DIFF_X86
+
+// SSE2: 4 pixels at a time. n is at most CHUNK, so the 32-bit sums of
+// squares do not overflow.
+static uint64_t diff_sse2( const unsigned char* a, const unsigned char* b,
+                           size_t n, unsigned char* errors, int& max_error ) {
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i color = _mm_set1_epi32(0x00FFFFFF);
+  const __m128i low = _mm_set1_epi32(0xFF);
+  __m128i sum = zero, top = zero;
+
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (a + 4 * i));
+    __m128i y = _mm_loadu_si128((const __m128i*) (b + 4 * i));
+    __m128i d = _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+    d = _mm_and_si128(d, color);
+
+    // largest channel in the low byte of each pixel
+    __m128i e = _mm_max_epu8(d, _mm_srli_epi32(d, 8));
+    e = _mm_and_si128(_mm_max_epu8(e, _mm_srli_epi32(e, 16)), low);
+    top = _mm_max_epu8(top, e);
+    e = _mm_packus_epi16(_mm_packs_epi32(e, e), zero);
+    int packed = _mm_cvtsi128_si32(e);
+    memcpy(errors + i, &packed, 4);
+
+    __m128i lo = _mm_unpacklo_epi8(d, zero);
+    __m128i hi = _mm_unpackhi_epi8(d, zero);
+    sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(lo, lo),
+                                           _mm_madd_epi16(hi, hi)));
+  }
+
+  uint32_t sums[4]; unsigned char tops[16];
+  _mm_storeu_si128((__m128i*) sums, sum);
+  _mm_storeu_si128((__m128i*) tops, top);
+  for (int k = 0; k < 16; ++k) max_error = max(max_error, (int) tops[k]);
+
+  return (uint64_t) sums[0] + sums[1] + sums[2] + sums[3] +
+         diff_scalar(a + 4 * i, b + 4 * i, n - i, errors + i, max_error);
+}
+
+#endif
+
+ImageDiff diff_images( const unsigned char* reference, const unsigned char* image,
+                       size_t width, size_t height, unsigned char* heatmap ) {
+
+  static const HeatColors heat;
+
+  size_t different = 0;
+  uint64_t sum = 0;
+  int max_error = 0;
+
+  #pragma omp parallel for schedule(static) \
+          reduction(+:different, sum) reduction(max:max_error)
+  for (size_t y = 0; y < height; ++y) {
+
+    unsigned char errors[CHUNK];
+    for (size_t x = 0; x < width; x += CHUNK) {
+
+      size_t n = min(CHUNK, width - x);
+      size_t offset = 4 * (y * width + x);
+
+#ifdef IMAGE_DIFF_X86
+      sum += diff_sse2(reference + offset, image + offset, n, errors, max_error);
+#else
+      sum += diff_scalar(reference + offset, image + offset, n, errors, max_error);
+#endif
+
+      for (size_t i = 0; i < n; ++i) different += errors[i] != 0;
+
+      if (heatmap) {
+        for (size_t i = 0; i < n; ++i) {
+          memcpy(heatmap + offset + 4 * i, heat.rgba[errors[i]], 4);
+        }
+      }
+    }
+  }
+
+  ImageDiff diff;
+  diff.different = different;
+  diff.max_error = max_error;
+  double mse = width && height ? (double) sum / (3.0 * width * height) : 0;
+  diff.rmse = sqrt(mse);
+  diff.psnr = mse ? 10 * log10(255.0 * 255.0 / mse) : INFINITY;
+  return diff;
+}
+
+} // namespace CMU462
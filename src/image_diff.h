@@ -0,0 +1,30 @@
+#ifndef CMU462_IMAGE_DIFF_H
+#define CMU462_IMAGE_DIFF_H
+
+#include <stddef.h>
+
+namespace CMU462 {
+
+/**
+ * Difference of two RGBA images, over their color channels (alpha is
+ * ignored, as in the viewer's diff mode).
+ */
+struct ImageDiff {
+  size_t different; // pixels with any color channel different
+  int max_error;    // largest difference of a color channel
+  double rmse;      // root mean square difference of the color channels
+  double psnr;      // peak signal to noise ratio (dB), infinite if equal
+};
+
+// Compare image to reference (both width x height RGBA), in parallel.
+// If heatmap is not NULL it receives an RGBA image of the error of each
+// pixel (its largest channel difference): black where the images are
+// equal, then blue, red, yellow and white as it grows. heatmap may be
+// image itself.
+ImageDiff diff_images( const unsigned char* reference, const unsigned char* image,
+                       size_t width, size_t height,
+                       unsigned char* heatmap = NULL );
+
+} // namespace CMU462
+
+#endif // CMU462_IMAGE_DIFF_H
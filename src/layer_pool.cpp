@@ -0,0 +1,59 @@
+#include "layer_pool.h"
+
+#include <new>
+#include <cstdlib>
+
+namespace CMU462 {
+
+LayerPool::~LayerPool() {
+  trim();
+  for (size_t i = 0; i < used_buffers.size(); ++i) free(used_buffers[i].data);
+}
+
+float* LayerPool::acquire( size_t size ) {
+
+  size_t rounded = 1;
+  while (rounded < size) rounded <<= 1;
+
+  // smallest free buffer that fits
+  size_t best = free_buffers.size();
+  for (size_t i = 0; i < free_buffers.size(); ++i) {
+    if (free_buffers[i].size >= rounded &&
+        (best == free_buffers.size() || free_buffers[i].size < free_buffers[best].size)) {
+      best = i;
+    }
+  }
+
+  Buffer buffer;
+  if (best < free_buffers.size()) {
+    buffer = free_buffers[best];
+    free_buffers[best] = free_buffers.back();
+    free_buffers.pop_back();
+  } else {
+    buffer.data = (float*) malloc(rounded * sizeof(float));
+    if (!buffer.data) throw std::bad_alloc();
+    buffer.size = rounded;
+  }
+
+  used_buffers.push_back(buffer);
+  return buffer.data;
+}
+
+void LayerPool::release( float* data ) {
+
+  // layers nest, so the buffer is usually the last one handed out
+  for (size_t i = used_buffers.size(); i-- > 0; ) {
+    if (used_buffers[i].data == data) {
+      free_buffers.push_back(used_buffers[i]);
+      used_buffers.erase(used_buffers.begin() + i);
+      return;
+    }
+  }
+}
+
+void LayerPool::trim() {
+  for (size_t i = 0; i < free_buffers.size(); ++i) free(free_buffers[i].data);
+  free_buffers.clear();
+}
+
+} // namespace CMU462
@@ -0,0 +1,50 @@
+#ifndef CMU462_LAYER_POOL_H
+#define CMU462_LAYER_POOL_H
+
+#include <vector>
+#include <stddef.h>
+
+namespace CMU462 {
+
+/**
+ * Recycled float buffers for offscreen layers (group opacity, see
+ * SoftwareRendererImp). A released buffer is kept for the next layer that
+ * fits in it instead of being freed, so drawing nested groups frame after
+ * frame stops going through the allocator once the pool has warmed up.
+ * Sizes are rounded up to powers of two, so that layers which grow a
+ * little as the view moves still fit in the buffers of earlier frames.
+ */
+class LayerPool {
+ public:
+
+  LayerPool() { }
+  ~LayerPool();
+
+  // A buffer of at least size floats, with undefined contents. The
+  // smallest free buffer that fits is reused.
+  float* acquire( size_t size );
+
+  // Give back a buffer from acquire.
+  void release( float* buffer );
+
+  // Free the buffers not in use.
+  void trim();
+
+ private:
+
+  struct Buffer {
+    float* data;
+    size_t size;
+  };
+
+  std::vector<Buffer> free_buffers;
+  std::vector<Buffer> used_buffers;
+
+  LayerPool( const LayerPool& );
+  LayerPool& operator=( const LayerPool& );
+
+}; // class LayerPool
+
+} // namespace CMU462
+
+#endif // CMU462_LAYER_POOL_H
@@ -4,17 +4,26 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 using namespace CMU462;
 
 #define msg(s) cerr << "[DrawSVG] " << s << endl;
 
+// scene cache directory, NULL to always parse
+static const char* cache_dir = NULL;
+
+int parseFile( const char* path, SVG* svg ) {
+  return cache_dir ? SVGParser::loadCached( path, svg, cache_dir ) :
+                     SVGParser::load( path, svg );
+}
+
 int loadFile( DrawSVG* drawsvg, const char* path ) {
 
   SVG* svg = new SVG();
 
-  if( SVGParser::load( path, svg ) < 0) {
+  if( parseFile( path, svg ) < 0) {
     delete svg;
     return -1;
   }
@@ -28,27 +37,41 @@ int loadDirectory( DrawSVG* drawsvg, const char* path ) {
   DIR *dir = opendir (path);
   if(dir) {
     
-    struct dirent *ent; size_t n = 0;
-    
-    // load files
-    string pathname = path; 
-    if (pathname[pathname.back()] != '/') pathname.push_back('/');
-    while (((ent = readdir (dir)) != NULL) && (n < 9)) {
-
+    // collect svg files, sorted so that the tab order does not depend on
+    // the order in which the file system lists the directory
+    struct dirent *ent; vector<string> filenames;
+    while ((ent = readdir (dir)) != NULL) {
       string filename = ent->d_name;
       string filesufx = filename.substr(filename.find_last_of(".") + 1);
-      if (filesufx == "svg" ) {
-        cerr << "[DrawSVG] Loading " << filename << "... "; 
-        if (loadFile(drawsvg, (pathname + filename).c_str()) < 0) {
-          cerr << "Failed (Invalid SVG file)" << endl;
-        } else {
-          cerr << "Succeeded" << endl;
-          n++;
-        }
+      if (filesufx == "svg" ) filenames.push_back(filename);
+    }
+    closedir (dir);
+    sort(filenames.begin(), filenames.end());
+
+    // parse files in parallel, each into its own slot
+    string pathname = path; 
+    if (pathname.back() != '/') pathname.push_back('/');
+    vector<SVG*> svgs(filenames.size(), NULL);
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < filenames.size(); ++i) {
+      SVG* svg = new SVG();
+      if (parseFile((pathname + filenames[i]).c_str(), svg) < 0) {
+        delete svg;
+      } else {
+        svgs[i] = svg;
       }
     }
 
-    closedir (dir);
+    // add tabs in file name order
+    size_t n = 0;
+    for (size_t i = 0; i < filenames.size(); ++i) {
+      if (svgs[i]) {
+        drawsvg->newTab(svgs[i]);
+        n++;
+      } else {
+        msg("Failed to load " << filenames[i] << " (Invalid SVG file)");
+      }
+    }
 
     if (n) {
       msg("Successfully Loaded " << n << " files from " << path);
@@ -99,10 +122,13 @@ int main( int argc, char** argv ) {
   viewer.set_renderer(drawsvg);
 
   // load tests
-  if( argc == 2 ) {
+  if( argc == 4 && string(argv[1]) == "-c" ) {
+    cache_dir = argv[2];
+    if (loadPath(drawsvg, argv[3]) < 0) exit(0);
+  } else if( argc == 2 ) {
     if (loadPath(drawsvg, argv[1]) < 0) exit(0);
   } else {
-    msg("Usage: drawsvg <path to test file or directory>"); exit(0);
+    msg("Usage: drawsvg [-c <cache directory>] <path to test file or directory>"); exit(0);
   }
 
   // init viewer
@@ -1,13 +1,481 @@
 #include "png.h"
+#include "png_filter.h"
 
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
 
 using namespace std;
 
 namespace CMU462 {
 
+// Inflate //
+
+/* NOTE:
+ * Table-driven zlib inflate used by the PNG decoder. Codes are decoded by
+ * looking up the next LITLEN_BITS / DIST_BITS bits of a 64-bit bit buffer
+ * in a primary table, with small second level tables for the (rare) longer
+ * codes. Every table entry already carries the decoded meaning of a code
+ * (literal, length base, distance base plus the number of extra bits), so
+ * decoding a length/distance pair needs a single buffer refill. Matches
+ * are copied a word at a time whenever the distance allows it.
+ */
+
+static const unsigned LENBASE[29]   = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const unsigned LENEXTRA[29]  = {0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0};
+static const unsigned DISTBASE[30]  = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+static const unsigned DISTEXTRA[30] = {0,0,0,0,1,1,2, 2, 3, 3, 4, 4, 5, 5,  6,  6,  7,  7,  8,  8,   9,   9,  10,  10,  11,  11,  12,   12,   13,   13};
+static const unsigned CLCL[19]      = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15}; // code length code order
+
+// bits looked up at once in the primary tables
+static const unsigned LITLEN_BITS  = 10;
+static const unsigned DIST_BITS    = 8;
+static const unsigned CODELEN_BITS = 7;
+
+// slack kept at the end of the output so matches can be copied in words
+static const size_t COPY_SLACK = 8;
+
+// table entry layout:
+//   bits  0..3  number of bits consumed by this entry
+//   bits  4..7  entry kind
+//   bits  8..11 extra bits following the code (sub table bits for SUB)
+//   bits 16..31 value (literal, length/distance base or sub table offset)
+enum HuffmanKind {
+  HUFF_LITERAL = 0,
+  HUFF_LENGTH  = 1,
+  HUFF_END     = 2,
+  HUFF_SUB     = 3,
+  HUFF_INVALID = 4
+};
+
+static inline uint32_t huffman_entry( unsigned kind, unsigned extra, unsigned value ) {
+  return (kind << 4) | (extra << 8) | (value << 16);
+}
+
+static inline unsigned entry_bits ( uint32_t e ) { return e & 0xf; }
+static inline unsigned entry_kind ( uint32_t e ) { return (e >> 4) & 0xf; }
+static inline unsigned entry_extra( uint32_t e ) { return (e >> 8) & 0xf; }
+static inline unsigned entry_value( uint32_t e ) { return e >> 16; }
+
+struct HuffmanTable {
+
+  unsigned bits;
+  std::vector<uint32_t> entries;
+
+  // Build the lookup table for a canonical huffman code given the code
+  // length of every symbol and the decoded entry of every symbol (without
+  // its length). Returns 0 or a picoPNG compatible error code.
+  int build( const unsigned* lengths, size_t count,
+             const uint32_t* symbols, unsigned table_bits ) {
+
+    unsigned blcount[16] = {0}, nextcode[16] = {0};
+    for (size_t i = 0; i < count; i++) {
+      if (lengths[i] > 15) return 55;
+      blcount[lengths[i]]++;
+    }
+    blcount[0] = 0;
+
+    // reject over-subscribed codes, incomplete ones are decoded as invalid
+    int left = 1;
+    for (int len = 1; len <= 15; len++) {
+      left <<= 1; left -= blcount[len];
+      if (left < 0) return 55;
+    }
+
+    for (int len = 1; len <= 15; len++) {
+      nextcode[len] = (nextcode[len - 1] + blcount[len - 1]) << 1;
+    }
+
+    // deflate stores codes msb first, the bit buffer is read lsb first
+    std::vector<unsigned> codes(count, 0);
+    for (size_t i = 0; i < count; i++) {
+      unsigned len = lengths[i];
+      if (!len) continue;
+      unsigned code = nextcode[len]++, rev = 0;
+      for (unsigned b = 0; b < len; b++) rev |= ((code >> b) & 1) << (len - 1 - b);
+      codes[i] = rev;
+    }
+
+    bits = table_bits;
+    size_t size = (size_t) 1 << bits, mask = size - 1;
+    entries.assign(size, huffman_entry(HUFF_INVALID, 0, 0));
+
+    // size the sub tables of codes longer than the primary table
+    std::vector<unsigned char> subbits(size, 0);
+    for (size_t i = 0; i < count; i++) {
+      if (lengths[i] <= bits) continue;
+      unsigned char& sb = subbits[codes[i] & mask];
+      sb = std::max<unsigned char>(sb, lengths[i] - bits);
+    }
+    for (size_t p = 0; p < size; p++) {
+      if (!subbits[p]) continue;
+      entries[p] = huffman_entry(HUFF_SUB, subbits[p], entries.size()) | bits;
+      entries.resize(entries.size() + ((size_t) 1 << subbits[p]),
+                     huffman_entry(HUFF_INVALID, 0, 0));
+    }
+
+    // replicate every code over all the indices it is a prefix of
+    for (size_t i = 0; i < count; i++) {
+      unsigned len = lengths[i];
+      if (!len) continue;
+      if (len <= bits) {
+        for (size_t j = codes[i]; j < size; j += (size_t) 1 << len) {
+          entries[j] = symbols[i] | len;
+        }
+      } else {
+        uint32_t sub = entries[codes[i] & mask];
+        size_t offset = entry_value(sub), subsize = (size_t) 1 << entry_extra(sub);
+        unsigned sublen = len - bits;
+        for (size_t j = codes[i] >> bits; j < subsize; j += (size_t) 1 << sublen) {
+          entries[offset + j] = symbols[i] | sublen;
+        }
+      }
+    }
+
+    return 0;
+  }
+
+};
+
+// decoded meaning of the literal/length and distance alphabets
+struct HuffmanSymbols {
+
+  uint32_t litlen[288];
+  uint32_t dist[32];
+  uint32_t codelen[19];
+
+  HuffmanSymbols() {
+    for (unsigned i = 0; i < 288; i++) {
+      if      (i <  256) litlen[i] = huffman_entry(HUFF_LITERAL, 0, i);
+      else if (i == 256) litlen[i] = huffman_entry(HUFF_END, 0, 0);
+      else if (i <  286) litlen[i] = huffman_entry(HUFF_LENGTH, LENEXTRA[i - 257], LENBASE[i - 257]);
+      else               litlen[i] = huffman_entry(HUFF_INVALID, 0, 0);
+    }
+    for (unsigned i = 0; i < 32; i++) {
+      if (i < 30) dist[i] = huffman_entry(HUFF_LENGTH, DISTEXTRA[i], DISTBASE[i]);
+      else        dist[i] = huffman_entry(HUFF_INVALID, 0, 0);
+    }
+    for (unsigned i = 0; i < 19; i++) {
+      codelen[i] = huffman_entry(HUFF_LITERAL, 0, i);
+    }
+  }
+
+};
+
+static const HuffmanSymbols& huffman_symbols() {
+  static const HuffmanSymbols symbols;
+  return symbols;
+}
+
+// tables of the fixed huffman code (BTYPE 1), built once
+struct FixedTables {
+
+  HuffmanTable litlen, dist;
+
+  FixedTables() {
+    unsigned bitlen[288], bitlenD[32];
+    for (unsigned i = 0; i < 288; i++) bitlen[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    for (unsigned i = 0; i < 32; i++) bitlenD[i] = 5;
+    litlen.build(bitlen, 288, huffman_symbols().litlen, LITLEN_BITS);
+    dist.build(bitlenD, 32, huffman_symbols().dist, DIST_BITS);
+  }
+
+};
+
+static const FixedTables& fixed_tables() {
+  static const FixedTables tables;
+  return tables;
+}
+
+static inline uint64_t load64_le( const unsigned char* p ) {
+  uint64_t w; memcpy(&w, p, sizeof(w));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  w = __builtin_bswap64(w);
+#endif
+  return w;
+}
+
+// LSB first bit reader over a byte buffer with a 64-bit bit buffer. The
+// hot loops keep a local copy so that the compiler can hold it in registers
+// (output bytes are written through char pointers, which may alias anything
+// that lives in memory).
+struct BitReader {
+
+  const unsigned char* in; size_t size; size_t pos;
+  uint64_t bitbuf; unsigned bitcount;
+
+  // bytes of input consumed so far
+  inline size_t consumed() const {
+    return pos - (bitcount >> 3);
+  }
+
+  // fill the bit buffer to at least 56 bits
+  inline void refill() {
+    if (pos + 8 <= size) {
+      bitbuf |= load64_le(in + pos) << bitcount;
+      pos += (63 - bitcount) >> 3;
+      bitcount |= 56;
+    } else {
+      // past the end of the input pad with zeros, consumed() tells
+      // whether any of the padding has actually been used
+      while (bitcount <= 56) {
+        uint64_t b = pos < size ? in[pos] : 0;
+        bitbuf |= b << bitcount;
+        bitcount += 8; pos++;
+      }
+    }
+  }
+
+  inline unsigned bits( unsigned n ) {
+    unsigned v = (unsigned) (bitbuf & (((uint64_t) 1 << n) - 1));
+    bitbuf >>= n; bitcount -= n;
+    return v;
+  }
+
+  inline uint32_t decode( const uint32_t* table, unsigned table_bits ) {
+    uint32_t e = table[bitbuf & ((1u << table_bits) - 1)];
+    if (entry_kind(e) == HUFF_SUB) {
+      bits(table_bits);
+      e = table[entry_value(e) + (bitbuf & ((1u << entry_extra(e)) - 1))];
+    }
+    bits(entry_bits(e));
+    return e;
+  }
+
+};
+
+class Inflater {
+ public:
+
+  Inflater( const unsigned char* in, size_t size ) {
+    br.in = in; br.size = size; br.pos = 0;
+    br.bitbuf = 0; br.bitcount = 0;
+  }
+
+  // Inflate a raw deflate stream. The output vector is used as is for the
+  // first bytes and grown as needed, it is resized to the inflated size.
+  int inflate( std::vector<unsigned char>& out ) {
+
+    size_t outpos = 0;
+    int error = 0;
+
+    // the caller sizes out for the expected data, add room for a full
+    // match plus the word copy slack so that it never has to grow
+    out.resize(out.size() + 258 + COPY_SLACK);
+
+    unsigned final = 0;
+    while (!final && !error) {
+
+      br.refill();
+      final = br.bits(1);
+      unsigned type = br.bits(2);
+
+      switch (type) {
+        case 0:
+          error = inflate_stored(out, outpos);
+          break;
+        case 1:
+          error = inflate_block(out, outpos,
+                                fixed_tables().litlen, fixed_tables().dist);
+          break;
+        case 2:
+          error = read_dynamic_tables();
+          if (!error) error = inflate_block(out, outpos, litlen, dist);
+          break;
+        default:
+          error = 20; // invalid BTYPE
+          break;
+      }
+
+      // reading past the end of the input
+      if (!error && br.consumed() > br.size) error = 10;
+    }
+
+    if (!error) out.resize(outpos);
+    return error;
+  }
+
+ private:
+
+  // input stream
+  BitReader br;
+
+  // tables of the current dynamic block
+  HuffmanTable litlen, dist, codelen;
+
+  int inflate_stored( std::vector<unsigned char>& out, size_t& outpos ) {
+
+    // go to the byte boundary and hand the buffered bytes back
+    br.bits(br.bitcount & 7);
+    br.pos -= br.bitcount >> 3;
+    br.bitbuf = 0; br.bitcount = 0;
+
+    const unsigned char* in = br.in;
+    size_t pos = br.pos;
+    if (pos + 4 > br.size) return 52;
+    unsigned len  = in[pos] | (in[pos + 1] << 8);
+    unsigned nlen = in[pos + 2] | (in[pos + 3] << 8);
+    pos += 4;
+    if (len + nlen != 65535) return 21;
+    if (pos + len > br.size) return 23;
+
+    if (outpos + len + 258 + COPY_SLACK > out.size()) {
+      out.resize(outpos + len + 258 + COPY_SLACK);
+    }
+    memcpy(&out[outpos], in + pos, len);
+    outpos += len; br.pos = pos + len;
+    return 0;
+  }
+
+  int read_dynamic_tables() {
+
+    const HuffmanSymbols& symbols = huffman_symbols();
+
+    br.refill();
+    unsigned hlit  = br.bits(5) + 257;
+    unsigned hdist = br.bits(5) + 1;
+    unsigned hclen = br.bits(4) + 4;
+
+    unsigned codelengthcode[19] = {0};
+    for (unsigned i = 0; i < hclen; i++) {
+      if (br.bitcount < 3) br.refill();
+      codelengthcode[CLCL[i]] = br.bits(3);
+    }
+    if (codelen.build(codelengthcode, 19, symbols.codelen, CODELEN_BITS)) return 55;
+
+    // literal/length and distance code lengths are one sequence
+    unsigned lengths[288 + 32] = {0};
+    unsigned n = 0;
+    while (n < hlit + hdist) {
+
+      br.refill();
+      if (br.consumed() > br.size) return 50;
+
+      uint32_t e = br.decode(&codelen.entries[0], codelen.bits);
+      if (entry_kind(e) == HUFF_INVALID) return 16;
+      unsigned code = entry_value(e), value = 0, repeat = 0;
+
+      if (code <= 15) { lengths[n++] = code; continue; }
+      else if (code == 16) {
+        if (n == 0) return 54; // nothing to repeat
+        value = lengths[n - 1]; repeat = 3 + br.bits(2);
+      }
+      else if (code == 17) repeat = 3 + br.bits(3);
+      else                 repeat = 11 + br.bits(7);
+
+      if (n + repeat > hlit + hdist) return code == 16 ? 13 : code == 17 ? 14 : 15;
+      for (unsigned i = 0; i < repeat; i++) lengths[n++] = value;
+    }
+
+    if (lengths[256] == 0) return 64; // the end code must have a length
+    if (litlen.build(lengths, hlit, symbols.litlen, LITLEN_BITS)) return 55;
+    if (dist.build(lengths + hlit, hdist, symbols.dist, DIST_BITS)) return 55;
+    return 0;
+  }
+
+  int inflate_block( std::vector<unsigned char>& out, size_t& outpos,
+                     const HuffmanTable& litlen, const HuffmanTable& dist ) {
+
+    BitReader br = this->br;
+    int error = 0;
+
+    const uint32_t* lt = &litlen.entries[0]; unsigned lbits = litlen.bits;
+    const uint32_t* dt = &dist.entries[0];   unsigned dbits = dist.bits;
+
+    // output is written through op, there is always room for a full
+    // match plus the word copy slack before oend
+    unsigned char* base = &out[0];
+    unsigned char* op = base + outpos;
+    unsigned char* oend = base + out.size() - 258 - COPY_SLACK;
+
+    for (;;) {
+
+      if (op >= oend) {
+        size_t n = op - base;
+        out.resize(out.size() * 2);
+        base = &out[0]; op = base + n;
+        oend = base + out.size() - 258 - COPY_SLACK;
+      }
+
+      br.refill();
+
+      // give up on truncated input rather than decoding the zero padding
+      if (br.pos > br.size && br.consumed() > br.size) { error = 10; break; }
+
+      uint32_t e = br.decode(lt, lbits);
+      unsigned kind = entry_kind(e);
+
+      if (kind == HUFF_LITERAL) {
+        *op++ = (unsigned char) entry_value(e);
+
+        // the refill left room for a second code, and a third one
+        // when both were short
+        e = br.decode(lt, lbits); kind = entry_kind(e);
+        if (kind == HUFF_LITERAL) {
+          *op++ = (unsigned char) entry_value(e);
+          if (br.bitcount < 15) continue;
+          e = br.decode(lt, lbits); kind = entry_kind(e);
+          if (kind == HUFF_LITERAL) {
+            *op++ = (unsigned char) entry_value(e);
+            continue;
+          }
+        }
+        if (kind == HUFF_LENGTH && br.bitcount < 33) br.refill();
+      }
+
+      if (kind == HUFF_END) break;
+      if (kind != HUFF_LENGTH) { error = 11; break; } // invalid code
+
+      // 5 extra + 15 code + 13 extra bits at most
+      size_t length = entry_value(e) + br.bits(entry_extra(e));
+      uint32_t d = br.decode(dt, dbits);
+      if (entry_kind(d) != HUFF_LENGTH) { error = 18; break; } // invalid dist code
+      size_t distance = entry_value(d) + br.bits(entry_extra(d));
+      if (distance > (size_t) (op - base)) { error = 52; break; } // before the start
+
+      const unsigned char* ip = op - distance;
+      if (distance >= 8) {
+        // overlapping words are safe: every word read is already written
+        for (size_t i = 0; i < length; i += 8) {
+          memcpy(op + i, ip + i, 8);
+        }
+      } else if (distance == 1) {
+        memset(op, ip[0], length);
+      } else {
+        for (size_t i = 0; i < length; i++) op[i] = ip[i];
+      }
+      op += length;
+    }
+
+    outpos = op - base;
+    this->br = br;
+    return error;
+  }
+
+};
+
+// Decompress a zlib stream (PNG IDAT data) into out. Returns 0 or an error
+// code compatible with the picoPNG decoder. The adler32 checksum is ignored.
+static int zlib_decompress( std::vector<unsigned char>& out,
+                            const unsigned char* in, size_t size ) {
+
+  if (size < 2) return 53; // size of zlib data too small
+
+  // 256 * in[0] + in[1] must be a multiple of 31
+  if ((in[0] * 256 + in[1]) % 31 != 0) return 24;
+
+  // PNG only allows deflate with a 32k window and no preset dictionary
+  unsigned CM = in[0] & 15, CINFO = (in[0] >> 4) & 15, FDICT = (in[1] >> 5) & 1;
+  if (CM != 8 || CINFO > 7) return 25;
+  if (FDICT != 0) return 26;
+
+  Inflater inflater(in + 2, size - 2);
+  return inflater.inflate(out);
+}
+
 // Parser routines //
 
 /* picoPNG version 20101224
@@ -28,204 +496,12 @@ namespace CMU462 {
  * 2. Altered source versions must be plainly marked as such, and must not be
  *    misrepresented as being the original software.
  * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * Altered: the bit-serial zlib decoder of picoPNG has been replaced by the
+ * table-driven zlib_decompress above.
  */
 int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
     
-  static const unsigned long LENBASE[29] =  {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
-  static const unsigned long LENEXTRA[29] = {0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0};
-  static const unsigned long DISTBASE[30] =  {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
-  static const unsigned long DISTEXTRA[30] = {0,0,0,0,1,1,2, 2, 3, 3, 4, 4, 5, 5,  6,  6,  7,  7,  8,  8,   9,   9,  10,  10,  11,  11,  12,   12,   13,   13};
-  static const unsigned long CLCL[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15}; //code length code lengths
-  struct Zlib //nested functions for zlib decompression
-  {
-    static unsigned long readBitFromStream(size_t& bitp, const unsigned char* bits) { unsigned long result = (bits[bitp >> 3] >> (bitp & 0x7)) & 1; bitp++; return result;}
-    static unsigned long readBitsFromStream(size_t& bitp, const unsigned char* bits, size_t nbits)
-    {
-      unsigned long result = 0;
-      for(size_t i = 0; i < nbits; i++) result += (readBitFromStream(bitp, bits)) << i;
-      return result;
-    }
-    struct HuffmanTree
-    {
-      int makeFromLengths(const std::vector<unsigned long>& bitlen, unsigned long maxbitlen)
-      { //make tree given the lengths
-        unsigned long numcodes = (unsigned long)(bitlen.size()), treepos = 0, nodefilled = 0;
-        std::vector<unsigned long> tree1d(numcodes), blcount(maxbitlen + 1, 0), nextcode(maxbitlen + 1, 0);
-        for(unsigned long bits = 0; bits < numcodes; bits++) blcount[bitlen[bits]]++; //count number of instances of each code length
-        for(unsigned long bits = 1; bits <= maxbitlen; bits++) nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
-        for(unsigned long n = 0; n < numcodes; n++) if(bitlen[n] != 0) tree1d[n] = nextcode[bitlen[n]]++; //generate all the codes
-        tree2d.clear(); tree2d.resize(numcodes * 2, 32767); //32767 here means the tree2d isn't filled there yet
-        for(unsigned long n = 0; n < numcodes; n++) //the codes
-        for(unsigned long i = 0; i < bitlen[n]; i++) //the bits for this code
-        {
-          unsigned long bit = (tree1d[n] >> (bitlen[n] - i - 1)) & 1;
-          if(treepos > numcodes - 2) return 55;
-          if(tree2d[2 * treepos + bit] == 32767) //not yet filled in
-          {
-            if(i + 1 == bitlen[n]) { tree2d[2 * treepos + bit] = n; treepos = 0; } //last bit
-            else { tree2d[2 * treepos + bit] = ++nodefilled + numcodes; treepos = nodefilled; } //addresses are encoded as values > numcodes
-          }
-          else treepos = tree2d[2 * treepos + bit] - numcodes; //subtract numcodes from address to get address value
-        }
-        return 0;
-      }
-      int decode(bool& decoded, unsigned long& result, size_t& treepos, unsigned long bit) const
-      { //Decodes a symbol from the tree
-        unsigned long numcodes = (unsigned long)tree2d.size() / 2;
-        if(treepos >= numcodes) return 11; //error: you appeared outside the codetree
-        result = tree2d[2 * treepos + bit];
-        decoded = (result < numcodes);
-        treepos = decoded ? 0 : result - numcodes;
-        return 0;
-      }
-      std::vector<unsigned long> tree2d; //2D representation of a huffman tree: The one dimension is "0" or "1", the other contains all nodes and leaves of the tree.
-    };
-    struct Inflator
-    {
-      int error;
-      void inflate(std::vector<unsigned char>& out, const std::vector<unsigned char>& in, size_t inpos = 0)
-      {
-        size_t bp = 0, pos = 0; //bit pointer and byte pointer
-        error = 0;
-        unsigned long BFINAL = 0;
-        while(!BFINAL && !error)
-        {
-          if(bp >> 3 >= in.size()) { error = 52; return; } //error, bit pointer will jump past memory
-          BFINAL = readBitFromStream(bp, &in[inpos]);
-          unsigned long BTYPE = readBitFromStream(bp, &in[inpos]); BTYPE += 2 * readBitFromStream(bp, &in[inpos]);
-          if(BTYPE == 3) { error = 20; return; } //error: invalid BTYPE
-          else if(BTYPE == 0) inflateNoCompression(out, &in[inpos], bp, pos, in.size());
-          else inflateHuffmanBlock(out, &in[inpos], bp, pos, in.size(), BTYPE);
-        }
-        if(!error) out.resize(pos); //Only now we know the true size of out, resize it to that
-      }
-      void generateFixedTrees(HuffmanTree& tree, HuffmanTree& treeD) //get the tree of a deflated block with fixed tree
-      {
-        std::vector<unsigned long> bitlen(288, 8), bitlenD(32, 5);;
-        for(size_t i = 144; i <= 255; i++) bitlen[i] = 9;
-        for(size_t i = 256; i <= 279; i++) bitlen[i] = 7;
-        tree.makeFromLengths(bitlen, 15);
-        treeD.makeFromLengths(bitlenD, 15);
-      }
-      HuffmanTree codetree, codetreeD, codelengthcodetree; //the code tree for Huffman codes, dist codes, and code length codes
-      unsigned long huffmanDecodeSymbol(const unsigned char* in, size_t& bp, const HuffmanTree& codetree, size_t inlength)
-      { //decode a single symbol from given list of bits with given code tree. return value is the symbol
-        bool decoded; unsigned long ct;
-        for(size_t treepos = 0;;)
-        {
-          if((bp & 0x07) == 0 && (bp >> 3) > inlength) { error = 10; return 0; } //error: end reached without endcode
-          error = codetree.decode(decoded, ct, treepos, readBitFromStream(bp, in)); if(error) return 0; //stop, an error happened
-          if(decoded) return ct;
-        }
-      }
-      void getTreeInflateDynamic(HuffmanTree& tree, HuffmanTree& treeD, const unsigned char* in, size_t& bp, size_t inlength)
-      { //get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree
-        std::vector<unsigned long> bitlen(288, 0), bitlenD(32, 0);
-        if(bp >> 3 >= inlength - 2) { error = 49; return; } //the bit pointer is or will go past the memory
-        size_t HLIT =  readBitsFromStream(bp, in, 5) + 257; //number of literal/length codes + 257
-        size_t HDIST = readBitsFromStream(bp, in, 5) + 1; //number of dist codes + 1
-        size_t HCLEN = readBitsFromStream(bp, in, 4) + 4; //number of code length codes + 4
-        std::vector<unsigned long> codelengthcode(19); //lengths of tree to decode the lengths of the dynamic tree
-        for(size_t i = 0; i < 19; i++) codelengthcode[CLCL[i]] = (i < HCLEN) ? readBitsFromStream(bp, in, 3) : 0;
-        error = codelengthcodetree.makeFromLengths(codelengthcode, 7); if(error) return;
-        size_t i = 0, replength;
-        while(i < HLIT + HDIST)
-        {
-          unsigned long code = huffmanDecodeSymbol(in, bp, codelengthcodetree, inlength); if(error) return;
-          if(code <= 15)  { if(i < HLIT) bitlen[i++] = code; else bitlenD[i++ - HLIT] = code; } //a length code
-          else if(code == 16) //repeat previous
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 3 + readBitsFromStream(bp, in, 2);
-            unsigned long value; //set value to the previous code
-            if((i - 1) < HLIT) value = bitlen[i - 1];
-            else value = bitlenD[i - HLIT - 1];
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 13; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = value; else bitlenD[i++ - HLIT] = value;
-            }
-          }
-          else if(code == 17) //repeat "0" 3-10 times
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 3 + readBitsFromStream(bp, in, 3);
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 14; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = 0; else bitlenD[i++ - HLIT] = 0;
-            }
-          }
-          else if(code == 18) //repeat "0" 11-138 times
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 11 + readBitsFromStream(bp, in, 7);
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 15; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = 0; else bitlenD[i++ - HLIT] = 0;
-            }
-          }
-          else { error = 16; return; } //error: somehow an unexisting code appeared. This can never happen.
-        }
-        if(bitlen[256] == 0) { error = 64; return; } //the length of the end code 256 must be larger than 0
-        error = tree.makeFromLengths(bitlen, 15); if(error) return; //now we've finally got HLIT and HDIST, so generate the code trees, and the function is done
-        error = treeD.makeFromLengths(bitlenD, 15); if(error) return;
-      }
-      void inflateHuffmanBlock(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength, unsigned long btype) 
-      {
-        if(btype == 1) { generateFixedTrees(codetree, codetreeD); }
-        else if(btype == 2) { getTreeInflateDynamic(codetree, codetreeD, in, bp, inlength); if(error) return; }
-        for(;;)
-        {
-          unsigned long code = huffmanDecodeSymbol(in, bp, codetree, inlength); if(error) return;
-          if(code == 256) return; //end code
-          else if(code <= 255) //literal symbol
-          {
-            if(pos >= out.size()) out.resize((pos + 1) * 2); //reserve more room
-            out[pos++] = (unsigned char)(code);
-          }
-          else if(code >= 257 && code <= 285) //length code
-          {
-            size_t length = LENBASE[code - 257], numextrabits = LENEXTRA[code - 257];
-            if((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-            length += readBitsFromStream(bp, in, numextrabits);
-            unsigned long codeD = huffmanDecodeSymbol(in, bp, codetreeD, inlength); if(error) return;
-            if(codeD > 29) { error = 18; return; } //error: invalid dist code (30-31 are never used)
-            unsigned long dist = DISTBASE[codeD], numextrabitsD = DISTEXTRA[codeD];
-            if((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-            dist += readBitsFromStream(bp, in, numextrabitsD);
-            size_t start = pos, back = start - dist; //backwards
-            if(pos + length >= out.size()) out.resize((pos + length) * 2); //reserve more room
-            for(size_t i = 0; i < length; i++) { out[pos++] = out[back++]; if(back >= start) back = start - dist; }
-          }
-        }
-      }
-      void inflateNoCompression(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength)
-      {
-        while((bp & 0x7) != 0) bp++; //go to first boundary of byte
-        size_t p = bp / 8;
-        if(p >= inlength - 4) { error = 52; return; } //error, bit pointer will jump past memory
-        unsigned long LEN = in[p] + 256 * in[p + 1], NLEN = in[p + 2] + 256 * in[p + 3]; p += 4;
-        if(LEN + NLEN != 65535) { error = 21; return; } //error: NLEN is not one's complement of LEN
-        if(pos + LEN >= out.size()) out.resize(pos + LEN);
-        if(p + LEN > inlength) { error = 23; return; } //error: reading outside of in buffer
-        for(unsigned long n = 0; n < LEN; n++) out[pos++] = in[p++]; //read LEN bytes of literal data
-        bp = p * 8;
-      }
-    };
-    int decompress(std::vector<unsigned char>& out, const std::vector<unsigned char>& in) //returns error value
-    {
-      Inflator inflator;
-      if(in.size() < 2) { return 53; } //error, size of zlib data too small
-      if((in[0] * 256 + in[1]) % 31 != 0) { return 24; } //error: 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way
-      unsigned long CM = in[0] & 15, CINFO = (in[0] >> 4) & 15, FDICT = (in[1] >> 5) & 1;
-      if(CM != 8 || CINFO > 7) { return 25; } //error: only compression method 8: inflate with sliding window of 32k is supported by the PNG spec
-      if(FDICT != 0) { return 26; } //error: the specification of PNG says about the zlib stream: "The additional flags shall not specify a preset dictionary."
-      inflator.inflate(out, in, 2);
-      return inflator.error; //note: adler32 checksum was skipped and ignored
-    }
-  };
   struct PNGDecoder //nested functions for PNG decoding
   {
     struct Info
@@ -241,8 +517,9 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       if(size == 0 || in == 0) { error = 48; return; } //the given data is empty
       readPngHeader(&in[0], size); if(error) return;
       size_t pos = 33; //first byte of the first chunk after the header
-      std::vector<unsigned char> idat; //the data from idat chunks
-      bool IEND = false, known_type = true;
+      std::vector<unsigned char> idat; //the data from idat chunks, only gathered when there are several of them
+      const unsigned char* idat_data = 0; size_t idat_size = 0; //a single idat chunk is inflated in place
+      bool IEND = false;
       info.key_defined = false;
       while(!IEND) //loop through the chunks, ignoring unknown chunks and stopping at IEND chunk. IDAT data is put at the start of the in buffer
       {
@@ -252,7 +529,9 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
         if(pos + chunkLength >= size) { error = 35; return; } //error: size of the in buffer too small to contain next chunk
         if(in[pos + 0] == 'I' && in[pos + 1] == 'D' && in[pos + 2] == 'A' && in[pos + 3] == 'T') //IDAT chunk, containing compressed image data
         {
-          idat.insert(idat.end(), &in[pos + 4], &in[pos + 4 + chunkLength]);
+          if(idat_data) { idat.assign(idat_data, idat_data + idat_size); idat_data = 0; } //second chunk, start concatenating
+          if(idat.empty() && !idat_data) { idat_data = &in[pos + 4]; idat_size = chunkLength; }
+          else idat.insert(idat.end(), &in[pos + 4], &in[pos + 4 + chunkLength]);
           pos += (4 + chunkLength);
         }
         else if(in[pos + 0] == 'I' && in[pos + 1] == 'E' && in[pos + 2] == 'N' && in[pos + 3] == 'D')  { pos += 4; IEND = true; }
@@ -294,37 +573,38 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
         {
           if(!(in[pos + 0] & 32)) { error = 69; return; } //error: unknown critical chunk (5th bit of first byte of chunk type is 0)
           pos += (chunkLength + 4); //skip 4 letters and uninterpreted data of unimplemented chunk
-          known_type = false;
         }
         pos += 4; //step over CRC (which is ignored)
       }
       unsigned long bpp = getBpp(info);
       std::vector<unsigned char> scanlines(((info.width * (info.height * bpp + 7)) / 8) + info.height); //now the out buffer will be filled
-      Zlib zlib; //decompress with the Zlib decompressor
-      error = zlib.decompress(scanlines, idat); if(error) return; //stop if the zlib decompressor returned an error
+      if(!idat.empty()) { idat_data = &idat[0]; idat_size = idat.size(); }
+      error = zlib_decompress(scanlines, idat_data, idat_size); if(error) return; //stop if the zlib decompressor returned an error
       size_t bytewidth = (bpp + 7) / 8, outlength = (info.height * info.width * bpp + 7) / 8;
       out.resize(outlength); //time to fill the out buffer
       unsigned char* out_ = outlength ? &out[0] : 0; //use a regular pointer to the std::vector for faster code if compiled without optimization
       if(info.interlaceMethod == 0) //no interlace, just filter
       {
         size_t linestart = 0, linelength = (info.width * bpp + 7) / 8; //length in bytes of a scanline, excluding the filtertype byte
+        if(scanlines.size() < info.height * (1 + linelength)) { error = 91; return; } //error: not enough decompressed data
         if(bpp >= 8) //byte per byte
         for(unsigned long y = 0; y < info.height; y++)
         {
           unsigned long filterType = scanlines[linestart];
-          const unsigned char* prevline = (y == 0) ? 0 : &out_[(y - 1) * info.width * bytewidth];
-          unFilterScanline(&out_[linestart - y], &scanlines[linestart + 1], prevline, bytewidth, filterType,  linelength); if(error) return;
+          const unsigned char* prevline = (y == 0) ? 0 : &out_[(y - 1) * linelength];
+          unFilterScanline(&out_[y * linelength], &scanlines[linestart + 1], prevline, bytewidth, filterType,  linelength); if(error) return;
           linestart += (1 + linelength); //go to start of next scanline
         }
         else //less than 8 bits per pixel, so fill it up bit per bit
         {
-          std::vector<unsigned char> templine((info.width * bpp + 7) >> 3); //only used if bpp < 8
+          std::vector<unsigned char> templine(linelength), prevtempline(linelength); //only used if bpp < 8, the previous line is kept unpacked for the filters
           for(size_t y = 0, obp = 0; y < info.height; y++)
           {
             unsigned long filterType = scanlines[linestart];
-            const unsigned char* prevline = (y == 0) ? 0 : &out_[(y - 1) * info.width * bytewidth];
+            const unsigned char* prevline = (y == 0) ? 0 : &prevtempline[0];
             unFilterScanline(&templine[0], &scanlines[linestart + 1], prevline, bytewidth, filterType, linelength); if(error) return;
             for(size_t bp = 0; bp < info.width * bpp;) setBitOfReversedStream(obp, out_, readBitFromReversedStream(bp, &templine[0]));
+            templine.swap(prevtempline);
             linestart += (1 + linelength); //go to start of next scanline
           }
         }
@@ -336,13 +616,14 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
         size_t passstart[7] = {0};
         size_t pattern[28] = {0,4,0,2,0,1,0,0,0,4,0,2,0,1,8,8,4,4,2,2,1,8,8,8,4,4,2,2}; //values for the adam7 passes
         for(int i = 0; i < 6; i++) passstart[i + 1] = passstart[i] + passh[i] * ((passw[i] ? 1 : 0) + (passw[i] * bpp + 7) / 8);
+        if(scanlines.size() < passstart[6] + passh[6] * ((passw[6] ? 1 : 0) + (passw[6] * bpp + 7) / 8)) { error = 91; return; } //error: not enough decompressed data
         std::vector<unsigned char> scanlineo((info.width * bpp + 7) / 8), scanlinen((info.width * bpp + 7) / 8); //"old" and "new" scanline
         for(int i = 0; i < 7; i++)
           adam7Pass(&out_[0], &scanlinen[0], &scanlineo[0], &scanlines[passstart[i]], info.width, pattern[i], pattern[i + 7], pattern[i + 14], pattern[i + 21], passw[i], passh[i], bpp);
       }
       if(convert_to_rgba32 && (info.colorType != 6 || info.bitDepth != 8)) //conversion needed
       {
-        std::vector<unsigned char> data = out;
+        std::vector<unsigned char> data; data.swap(out); //convert into a fresh buffer, no copy needed
         error = convert(out, &data[0], info, info.width, info.height);
       }
     }
@@ -359,44 +640,8 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       error = checkColorValidity(info.colorType, info.bitDepth);
     }
     void unFilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, unsigned long filterType, size_t length)
-    {
-      switch(filterType)
-      {
-        case 0: for(size_t i = 0; i < length; i++) recon[i] = scanline[i]; break;
-        case 1:
-          for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
-          for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
-          break;
-        case 2:
-          if(precon) for(size_t i = 0; i < length; i++) recon[i] = scanline[i] + precon[i];
-          else       for(size_t i = 0; i < length; i++) recon[i] = scanline[i];
-          break;
-        case 3:
-          if(precon)
-          {
-            for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i] + precon[i] / 2;
-            for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) / 2);
-          }
-          else
-          {
-            for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
-            for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + recon[i - bytewidth] / 2;
-          }
-          break;
-        case 4:
-          if(precon)
-          {
-            for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i] + paethPredictor(0, precon[i], 0);
-            for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + paethPredictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]);
-          }
-          else
-          {
-            for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
-            for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + paethPredictor(recon[i - bytewidth], 0, 0);
-          }
-          break;
-        default: error = 36; return; //error: unexisting filter type given
-      }
+    { //the filters are reversed by the runtime selected kernels of png_filter.h
+      error = png_unfilter(recon, scanline, precon, bytewidth, filterType, length);
     }
     void adam7Pass(unsigned char* out, unsigned char* linen, unsigned char* lineo, const unsigned char* in, unsigned long w, size_t passleft, size_t passtop, size_t spacex, size_t spacey, size_t passw, size_t passh, unsigned long bpp)
     { //filter and reposition the pixels into the output when the image is Adam7 interlaced. This function can only do it after the full image is already decoded. The out buffer must have the correct allocated memory size already.
@@ -405,7 +650,7 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       for(unsigned long y = 0; y < passh; y++)
       {
         unsigned char filterType = in[y * linelength], *prevline = (y == 0) ? 0 : lineo;
-        unFilterScanline(linen, &in[y * linelength + 1], prevline, bytewidth, filterType, (w * bpp + 7) / 8); if(error) return;
+        unFilterScanline(linen, &in[y * linelength + 1], prevline, bytewidth, filterType, linelength - 1); if(error) return;
         if(bpp >= 8) for(size_t i = 0; i < passw; i++) for(size_t b = 0; b < bytewidth; b++) //b = current byte of this pixel
           out[bytewidth * w * (passtop + spacey * y) + bytewidth * (passleft + spacex * i) + b] = linen[bytewidth * i + b];
         else for(size_t i = 0; i < passw; i++)
@@ -443,31 +688,19 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       size_t numpixels = w * h, bp = 0;
       out.resize(numpixels * 4);
       unsigned char* out_ = out.empty() ? 0 : &out[0]; //faster if compiled without optimization
+      //the 8-bit color types use the runtime selected kernels of png_filter.h
       if(infoIn.bitDepth == 8 && infoIn.colorType == 0) //greyscale
-      for(size_t i = 0; i < numpixels; i++)
-      {
-        out_[4 * i + 0] = out_[4 * i + 1] = out_[4 * i + 2] = in[i];
-        out_[4 * i + 3] = (infoIn.key_defined && in[i] == infoIn.key_r) ? 0 : 255;
-      }
+        png_expand_grey(out_, in, numpixels, infoIn.key_defined ? (long)infoIn.key_r : -1);
       else if(infoIn.bitDepth == 8 && infoIn.colorType == 2) //RGB color
-      for(size_t i = 0; i < numpixels; i++)
       {
-        for(size_t c = 0; c < 3; c++) out_[4 * i + c] = in[3 * i + c];
-        out_[4 * i + 3] = (infoIn.key_defined == 1 && in[3 * i + 0] == infoIn.key_r && in[3 * i + 1] == infoIn.key_g && in[3 * i + 2] == infoIn.key_b) ? 0 : 255;
+        bool key = infoIn.key_defined && infoIn.key_r < 256 && infoIn.key_g < 256 && infoIn.key_b < 256;
+        png_expand_rgb(out_, in, numpixels, key, infoIn.key_r, infoIn.key_g, infoIn.key_b);
       }
       else if(infoIn.bitDepth == 8 && infoIn.colorType == 3) //indexed color (palette)
-      for(size_t i = 0; i < numpixels; i++)
-      {
-        if(4U * in[i] >= infoIn.palette.size()) return 46;
-        for(size_t c = 0; c < 4; c++) out_[4 * i + c] = infoIn.palette[4 * in[i] + c]; //get rgb colors from the palette
-      }
+        return png_expand_palette(out_, in, numpixels, infoIn.palette.empty() ? 0 : &infoIn.palette[0], infoIn.palette.size() / 4);
       else if(infoIn.bitDepth == 8 && infoIn.colorType == 4) //greyscale with alpha
-      for(size_t i = 0; i < numpixels; i++)
-      {
-        out_[4 * i + 0] = out_[4 * i + 1] = out_[4 * i + 2] = in[2 * i + 0];
-        out_[4 * i + 3] = in[2 * i + 1];
-      }
-      else if(infoIn.bitDepth == 8 && infoIn.colorType == 6) for(size_t i = 0; i < numpixels; i++) for(size_t c = 0; c < 4; c++) out_[4 * i + c] = in[4 * i + c]; //RGB with alpha
+        png_expand_grey_alpha(out_, in, numpixels);
+      else if(infoIn.bitDepth == 8 && infoIn.colorType == 6) memcpy(out_, in, 4 * numpixels); //RGB with alpha
       else if(infoIn.bitDepth == 16 && infoIn.colorType == 0) //greyscale
       for(size_t i = 0; i < numpixels; i++)
       {
@@ -503,11 +736,6 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       }
       return 0;
     }
-    unsigned char paethPredictor(short a, short b, short c) //Paeth predicter, used by PNG filter type 4
-    {
-      short p = a + b - c, pa = p > a ? (p - a) : (a - p), pb = p > b ? (p - b) : (b - p), pc = p > c ? (p - c) : (c - p);
-      return (unsigned char)((pa <= pb && pa <= pc) ? a : pb <= pc ? b : c);
-    }
   };
   
   // always convert to 32 bit
@@ -520,12 +748,8 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
   png.height = decoder.info.height;
   
   // premultiply by alpha
-  for (size_t i = 0; i < png.pixels.size(); i+= 4) {
-    if( ! png.pixels[i + 3] ) {
-      png.pixels[  i  ] = 0; 
-      png.pixels[i + 1] = 0; 
-      png.pixels[i + 2] = 0; 
-    }
+  if (!png.pixels.empty()) {
+    png_clear_transparent(&png.pixels[0], png.pixels.size() / 4);
   }
 
   return decoder.error;
@@ -554,8 +778,28 @@ int PNGParser::load(const char* filename, PNG& png) {
 
 }
 
-int PNGParser::save(const char *filename, const PNG& png) {
-  return 0;
+int PNGParser::save(const char *filename, const PNG& png,
+                    PNGCompression compression) {
+
+  size_t numpixels = (size_t) png.width * png.height;
+  if (png.width <= 0 || png.height <= 0 || png.pixels.size() < 4 * numpixels) {
+    return -1;
+  }
+
+  // drop the alpha channel of opaque images when optimizing for size
+  bool alpha = true;
+  if (compression == PNG_COMPRESSION_SMALL) {
+    alpha = false;
+    for (size_t i = 0; i < numpixels && !alpha; i++) {
+      alpha = png.pixels[4 * i + 3] != 255;
+    }
+  }
+
+  PNGWriter writer(compression);
+  int error = writer.open(filename, png.width, png.height, alpha);
+  if (!error) error = writer.write_rows(&png.pixels[0], png.height);
+  if (!error) error = writer.close();
+  return error;
 }
 
 
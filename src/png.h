@@ -7,6 +7,7 @@
 #include "color.h"
 #include "vector2D.h"
 #include "tinyxml2.h"
+#include "png_writer.h"
 
 namespace CMU462 {
 
@@ -20,7 +21,8 @@ class PNGParser {
  public:
   static int load( const unsigned char* buffer, size_t size, PNG& png );
   static int load( const char* filename, PNG& png );
-  static int save( const char* filename, const PNG& png );
+  static int save( const char* filename, const PNG& png,
+                   PNGCompression compression = PNG_COMPRESSION_FAST );
 }; // class PNGParser
 
 } // namespace CMU462
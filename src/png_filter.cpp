@@ -0,0 +1,628 @@
+#include "png_filter.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PNG_FILTER_X86
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace CMU462 {
+
+// Scalar kernels //
+
+static unsigned char paeth_predictor( short a, short b, short c ) {
+  short p = a + b - c;
+  short pa = p > a ? (p - a) : (a - p);
+  short pb = p > b ? (p - b) : (b - p);
+  short pc = p > c ? (p - c) : (c - p);
+  return (unsigned char) ((pa <= pb && pa <= pc) ? a : pb <= pc ? b : c);
+}
+
+static void sub_scalar( unsigned char* recon, const unsigned char* scanline,
+                        size_t bytewidth, size_t length ) {
+  size_t n = min(bytewidth, length);
+  for (size_t i = 0; i < n; i++) recon[i] = scanline[i];
+  for (size_t i = n; i < length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
+}
+
+static void up_scalar( unsigned char* recon, const unsigned char* scanline,
+                       const unsigned char* precon, size_t length ) {
+  for (size_t i = 0; i < length; i++) recon[i] = scanline[i] + precon[i];
+}
+
+// average filter of the first scanline (no previous scanline)
+static void avg_first_scalar( unsigned char* recon, const unsigned char* scanline,
+                              size_t bytewidth, size_t length ) {
+  size_t n = min(bytewidth, length);
+  for (size_t i = 0; i < n; i++) recon[i] = scanline[i];
+  for (size_t i = n; i < length; i++) recon[i] = scanline[i] + recon[i - bytewidth] / 2;
+}
+
+static void avg_scalar( unsigned char* recon, const unsigned char* scanline,
+                        const unsigned char* precon, size_t bytewidth,
+                        size_t length ) {
+  size_t n = min(bytewidth, length);
+  for (size_t i = 0; i < n; i++) recon[i] = scanline[i] + precon[i] / 2;
+  for (size_t i = n; i < length; i++) {
+    recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) / 2);
+  }
+}
+
+static void paeth_scalar( unsigned char* recon, const unsigned char* scanline,
+                          const unsigned char* precon, size_t bytewidth,
+                          size_t length ) {
+  size_t n = min(bytewidth, length);
+  for (size_t i = 0; i < n; i++) recon[i] = scanline[i] + paeth_predictor(0, precon[i], 0);
+  for (size_t i = n; i < length; i++) {
+    recon[i] = scanline[i] + paeth_predictor(recon[i - bytewidth], precon[i],
+                                             precon[i - bytewidth]);
+  }
+}
+
+static void grey_scalar( unsigned char* rgba, const unsigned char* in,
+                         size_t n, long key ) {
+  for (size_t i = 0; i < n; i++) {
+    rgba[4 * i + 0] = rgba[4 * i + 1] = rgba[4 * i + 2] = in[i];
+    rgba[4 * i + 3] = (key == in[i]) ? 0 : 255;
+  }
+}
+
+static void grey_alpha_scalar( unsigned char* rgba, const unsigned char* in,
+                               size_t n ) {
+  for (size_t i = 0; i < n; i++) {
+    rgba[4 * i + 0] = rgba[4 * i + 1] = rgba[4 * i + 2] = in[2 * i + 0];
+    rgba[4 * i + 3] = in[2 * i + 1];
+  }
+}
+
+static void rgb_scalar( unsigned char* rgba, const unsigned char* in, size_t n,
+                        bool has_key, unsigned char key_r,
+                        unsigned char key_g, unsigned char key_b ) {
+  for (size_t i = 0; i < n; i++) {
+    const unsigned char* p = in + 3 * i;
+    rgba[4 * i + 0] = p[0];
+    rgba[4 * i + 1] = p[1];
+    rgba[4 * i + 2] = p[2];
+    rgba[4 * i + 3] = (has_key && p[0] == key_r && p[1] == key_g && p[2] == key_b) ? 0 : 255;
+  }
+}
+
+static void palette_scalar( unsigned char* rgba, const unsigned char* in,
+                            size_t n, const uint32_t* lut ) {
+  for (size_t i = 0; i < n; i++) memcpy(rgba + 4 * i, &lut[in[i]], 4);
+}
+
+static void clear_transparent_scalar( unsigned char* rgba, size_t n ) {
+  for (size_t i = 0; i < n; i++) {
+    if (!rgba[4 * i + 3]) rgba[4 * i] = rgba[4 * i + 1] = rgba[4 * i + 2] = 0;
+  }
+}
+
+// sums of absolute residuals of the five filter types for the bytes of a
+// scanline past the first pixel
+static void filter_costs_scalar( const unsigned char* scanline,
+                                 const unsigned char* precon, size_t bytewidth,
+                                 size_t length, uint64_t* costs ) {
+  for (size_t i = bytewidth; i < length; i++) {
+    short x = scanline[i], a = scanline[i - bytewidth];
+    short b = precon[i], c = precon[i - bytewidth];
+    costs[0] += abs((signed char) x);
+    costs[1] += abs((signed char) (x - a));
+    costs[2] += abs((signed char) (x - b));
+    costs[3] += abs((signed char) (x - ((a + b) >> 1)));
+    costs[4] += abs((signed char) (x - paeth_predictor(a, b, c)));
+  }
+}
+
+#ifdef PNG_FILTER_X86
+
+// SSE2 kernels //
+
+/* NOTE:
+ * Sub, average and paeth depend on the pixel to the left, so the vector
+ * versions work one pixel (3 or 4 bytes) at a time and keep the previous
+ * pixel in a register; the sub filter of 4-byte pixels does 4 pixels at a
+ * time with a prefix sum. Other pixel sizes use the scalar kernels.
+ */
+
+static inline __m128i load4( const unsigned char* p ) {
+  int v; memcpy(&v, p, 4); return _mm_cvtsi32_si128(v);
+}
+
+static inline void store4( unsigned char* p, __m128i v ) {
+  int x = _mm_cvtsi128_si32(v); memcpy(p, &x, 4);
+}
+
+static inline __m128i select( __m128i mask, __m128i a, __m128i b ) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i abs_epi16( __m128i x ) {
+  return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static void sub_sse2( unsigned char* recon, const unsigned char* scanline,
+                      size_t bytewidth, size_t length ) {
+
+  size_t i = 0;
+  if (bytewidth == 4) {
+    __m128i a = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i*) (scanline + i));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+      x = _mm_add_epi8(x, a);
+      _mm_storeu_si128((__m128i*) (recon + i), x);
+      a = _mm_shuffle_epi32(x, 0xff);
+    }
+  } else if (bytewidth == 3) {
+    // the fourth byte stored is rewritten by the next pixel
+    __m128i a = _mm_setzero_si128();
+    for (; i + 4 <= length; i += 3) {
+      a = _mm_add_epi8(a, load4(scanline + i));
+      store4(recon + i, a);
+    }
+  } else {
+    sub_scalar(recon, scanline, bytewidth, length);
+    return;
+  }
+
+  for (; i < length; i++) {
+    recon[i] = scanline[i] + (i >= bytewidth ? recon[i - bytewidth] : 0);
+  }
+}
+
+static void up_sse2( unsigned char* recon, const unsigned char* scanline,
+                     const unsigned char* precon, size_t length ) {
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (scanline + i));
+    __m128i b = _mm_loadu_si128((const __m128i*) (precon + i));
+    _mm_storeu_si128((__m128i*) (recon + i), _mm_add_epi8(x, b));
+  }
+  for (; i < length; i++) recon[i] = scanline[i] + precon[i];
+}
+
+static void avg_sse2( unsigned char* recon, const unsigned char* scanline,
+                      const unsigned char* precon, size_t bytewidth,
+                      size_t length ) {
+
+  if (bytewidth != 3 && bytewidth != 4) {
+    avg_scalar(recon, scanline, precon, bytewidth, length);
+    return;
+  }
+
+  // _mm_avg_epu8 rounds up, the filter rounds down
+  const __m128i ones = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= length; i += bytewidth) {
+    __m128i b = load4(precon + i);
+    __m128i avg = _mm_avg_epu8(a, b);
+    avg = _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b), ones));
+    a = _mm_add_epi8(avg, load4(scanline + i));
+    store4(recon + i, a);
+  }
+  for (; i < length; i++) {
+    unsigned left = i >= bytewidth ? recon[i - bytewidth] : 0;
+    recon[i] = scanline[i] + ((left + precon[i]) / 2);
+  }
+}
+
+static void paeth_sse2( unsigned char* recon, const unsigned char* scanline,
+                        const unsigned char* precon, size_t bytewidth,
+                        size_t length ) {
+
+  if (bytewidth != 3 && bytewidth != 4) {
+    paeth_scalar(recon, scanline, precon, bytewidth, length);
+    return;
+  }
+
+  // a: left, b: above, c: above left, as 16-bit lanes
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  size_t i = 0;
+  for (; i + 4 <= length; i += bytewidth) {
+
+    __m128i b = _mm_unpacklo_epi8(load4(precon + i), zero);
+
+    // pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|
+    __m128i pa = _mm_sub_epi16(b, c);
+    __m128i pb = _mm_sub_epi16(a, c);
+    __m128i pc = _mm_add_epi16(pa, pb);
+    pa = abs_epi16(pa); pb = abs_epi16(pb); pc = abs_epi16(pc);
+
+    // pick a if pa is the smallest, else b if pb is, else c
+    __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    __m128i pred = select(_mm_cmpeq_epi16(pa, smallest), a,
+                          select(_mm_cmpeq_epi16(pb, smallest), b, c));
+
+    __m128i x = _mm_add_epi8(_mm_packus_epi16(pred, pred), load4(scanline + i));
+    store4(recon + i, x);
+
+    a = _mm_unpacklo_epi8(x, zero);
+    c = b;
+  }
+  for (; i < length; i++) {
+    short left = i >= bytewidth ? recon[i - bytewidth] : 0;
+    short upleft = i >= bytewidth ? precon[i - bytewidth] : 0;
+    recon[i] = scanline[i] + paeth_predictor(left, precon[i], upleft);
+  }
+}
+
+static void grey_sse2( unsigned char* rgba, const unsigned char* in,
+                       size_t n, long key ) {
+
+  const __m128i opaque = _mm_set1_epi8((char) 0xff);
+  const __m128i keyv = _mm_set1_epi8((char) key);
+  const bool has_key = key >= 0 && key <= 255;
+
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i g = _mm_loadu_si128((const __m128i*) (in + i));
+    __m128i a = has_key ? _mm_andnot_si128(_mm_cmpeq_epi8(g, keyv), opaque) : opaque;
+    __m128i gg_lo = _mm_unpacklo_epi8(g, g), gg_hi = _mm_unpackhi_epi8(g, g);
+    __m128i ga_lo = _mm_unpacklo_epi8(g, a), ga_hi = _mm_unpackhi_epi8(g, a);
+    __m128i* out = (__m128i*) (rgba + 4 * i);
+    _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(gg_lo, ga_lo));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg_lo, ga_lo));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(gg_hi, ga_hi));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(gg_hi, ga_hi));
+  }
+  grey_scalar(rgba + 4 * i, in + i, n - i, key);
+}
+
+static void grey_alpha_sse2( unsigned char* rgba, const unsigned char* in,
+                             size_t n ) {
+
+  const __m128i lo = _mm_set1_epi16(0xff);
+
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i ga = _mm_loadu_si128((const __m128i*) (in + 2 * i));
+    __m128i g = _mm_and_si128(ga, lo);
+    __m128i gg = _mm_or_si128(g, _mm_slli_epi16(g, 8));
+    __m128i* out = (__m128i*) (rgba + 4 * i);
+    _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(gg, ga));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg, ga));
+  }
+  grey_alpha_scalar(rgba + 4 * i, in + 2 * i, n - i);
+}
+
+static void clear_transparent_sse2( unsigned char* rgba, size_t n ) {
+
+  const __m128i alpha = _mm_set1_epi32((int) 0xff000000);
+  const __m128i zero = _mm_setzero_si128();
+
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i* p = (__m128i*) (rgba + 4 * i);
+    __m128i x = _mm_loadu_si128(p);
+    __m128i clear = _mm_cmpeq_epi32(_mm_and_si128(x, alpha), zero);
+    _mm_storeu_si128(p, _mm_andnot_si128(clear, x));
+  }
+  clear_transparent_scalar(rgba + 4 * i, n - i);
+}
+
+// absolute value of signed bytes, as unsigned bytes
+static inline __m128i abs_epi8( __m128i x ) {
+  return _mm_min_epu8(x, _mm_sub_epi8(_mm_setzero_si128(), x));
+}
+
+// paeth predictor of 8 bytes in 16-bit lanes
+static inline __m128i paeth_epi16( __m128i a, __m128i b, __m128i c ) {
+  __m128i pa = _mm_sub_epi16(b, c);
+  __m128i pb = _mm_sub_epi16(a, c);
+  __m128i pc = _mm_add_epi16(pa, pb);
+  pa = abs_epi16(pa); pb = abs_epi16(pb); pc = abs_epi16(pc);
+  __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+  return select(_mm_cmpeq_epi16(pa, smallest), a,
+                select(_mm_cmpeq_epi16(pb, smallest), b, c));
+}
+
+// Encoding only reads unfiltered scanlines, so unlike the inverse filters
+// the costs can be computed 16 bytes at a time for any pixel size.
+static void filter_costs_sse2( const unsigned char* scanline,
+                               const unsigned char* precon, size_t bytewidth,
+                               size_t length, uint64_t* costs ) {
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i sum0 = zero, sum1 = zero, sum2 = zero, sum3 = zero, sum4 = zero;
+
+  size_t i = bytewidth;
+  for (; i + 16 <= length; i += 16) {
+
+    __m128i x = _mm_loadu_si128((const __m128i*) (scanline + i));
+    __m128i a = _mm_loadu_si128((const __m128i*) (scanline + i - bytewidth));
+    __m128i b = _mm_loadu_si128((const __m128i*) (precon + i));
+    __m128i c = _mm_loadu_si128((const __m128i*) (precon + i - bytewidth));
+
+    // floor((a + b) / 2) from the rounding up average
+    __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b),
+                               _mm_and_si128(_mm_xor_si128(a, b), one));
+
+    __m128i paeth = _mm_packus_epi16(
+        paeth_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                    _mm_unpacklo_epi8(c, zero)),
+        paeth_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                    _mm_unpackhi_epi8(c, zero)));
+
+    sum0 = _mm_add_epi64(sum0, _mm_sad_epu8(abs_epi8(x), zero));
+    sum1 = _mm_add_epi64(sum1, _mm_sad_epu8(abs_epi8(_mm_sub_epi8(x, a)), zero));
+    sum2 = _mm_add_epi64(sum2, _mm_sad_epu8(abs_epi8(_mm_sub_epi8(x, b)), zero));
+    sum3 = _mm_add_epi64(sum3, _mm_sad_epu8(abs_epi8(_mm_sub_epi8(x, avg)), zero));
+    sum4 = _mm_add_epi64(sum4, _mm_sad_epu8(abs_epi8(_mm_sub_epi8(x, paeth)), zero));
+  }
+
+  __m128i sums[5] = { sum0, sum1, sum2, sum3, sum4 };
+  for (int t = 0; t < 5; t++) {
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*) lanes, sums[t]);
+    costs[t] += lanes[0] + lanes[1];
+  }
+
+  // the scalar kernel starts one pixel in
+  if (i < length) {
+    size_t start = i - bytewidth;
+    filter_costs_scalar(scanline + start, precon + start, bytewidth,
+                        length - start, costs);
+  }
+}
+
+// SSSE3 kernels //
+
+__attribute__((target("ssse3")))
+static void rgb_ssse3( unsigned char* rgba, const unsigned char* in, size_t n,
+                       bool has_key, unsigned char key_r,
+                       unsigned char key_g, unsigned char key_b ) {
+
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128,
+                                        6, 7, 8, -128, 9, 10, 11, -128);
+  const __m128i alpha = _mm_set1_epi32((int) 0xff000000);
+  const __m128i keyv = _mm_set1_epi32(key_r | (key_g << 8) | (key_b << 16));
+
+  // 4 pixels per iteration, reading 16 of the 18 bytes of 6 pixels
+  size_t i = 0;
+  for (; i + 6 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (in + 3 * i));
+    x = _mm_shuffle_epi8(x, shuffle);
+    __m128i a = has_key ? _mm_andnot_si128(_mm_cmpeq_epi32(x, keyv), alpha) : alpha;
+    _mm_storeu_si128((__m128i*) (rgba + 4 * i), _mm_or_si128(x, a));
+  }
+  rgb_scalar(rgba + 4 * i, in + 3 * i, n - i, has_key, key_r, key_g, key_b);
+}
+
+// AVX2 kernels //
+
+__attribute__((target("avx2")))
+static void palette_avx2( unsigned char* rgba, const unsigned char* in,
+                          size_t n, const uint32_t* lut ) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (in + i)));
+    __m256i color = _mm256_i32gather_epi32((const int*) lut, index, 4);
+    _mm256_storeu_si256((__m256i*) (rgba + 4 * i), color);
+  }
+  palette_scalar(rgba + 4 * i, in + i, n - i, lut);
+}
+
+#endif // PNG_FILTER_X86
+
+// Kernel selection //
+
+struct PNGKernels {
+
+  PNGKernelLevel level;
+
+  void (*sub)   ( unsigned char*, const unsigned char*, size_t, size_t );
+  void (*up)    ( unsigned char*, const unsigned char*, const unsigned char*, size_t );
+  void (*avg)   ( unsigned char*, const unsigned char*, const unsigned char*, size_t, size_t );
+  void (*paeth) ( unsigned char*, const unsigned char*, const unsigned char*, size_t, size_t );
+
+  void (*grey)       ( unsigned char*, const unsigned char*, size_t, long );
+  void (*grey_alpha) ( unsigned char*, const unsigned char*, size_t );
+  void (*rgb)        ( unsigned char*, const unsigned char*, size_t, bool,
+                       unsigned char, unsigned char, unsigned char );
+  void (*palette)    ( unsigned char*, const unsigned char*, size_t, const uint32_t* );
+
+  void (*clear_transparent) ( unsigned char*, size_t );
+
+  void (*filter_costs) ( const unsigned char*, const unsigned char*, size_t,
+                         size_t, uint64_t* );
+
+};
+
+static PNGKernelLevel supported_level() {
+#ifdef PNG_FILTER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))  return PNG_KERNEL_AVX2;
+  if (__builtin_cpu_supports("ssse3")) return PNG_KERNEL_SSSE3;
+  if (__builtin_cpu_supports("sse2"))  return PNG_KERNEL_SSE2;
+#endif
+  return PNG_KERNEL_SCALAR;
+}
+
+static PNGKernels make_kernels( PNGKernelLevel level ) {
+
+  PNGKernels k;
+  k.level = min(level, supported_level());
+
+  k.sub        = sub_scalar;
+  k.up         = up_scalar;
+  k.avg        = avg_scalar;
+  k.paeth      = paeth_scalar;
+  k.grey       = grey_scalar;
+  k.grey_alpha = grey_alpha_scalar;
+  k.rgb        = rgb_scalar;
+  k.palette    = palette_scalar;
+  k.clear_transparent = clear_transparent_scalar;
+  k.filter_costs = filter_costs_scalar;
+
+#ifdef PNG_FILTER_X86
+  if (k.level >= PNG_KERNEL_SSE2) {
+    k.sub        = sub_sse2;
+    k.up         = up_sse2;
+    k.avg        = avg_sse2;
+    k.paeth      = paeth_sse2;
+    k.grey       = grey_sse2;
+    k.grey_alpha = grey_alpha_sse2;
+    k.clear_transparent = clear_transparent_sse2;
+    k.filter_costs = filter_costs_sse2;
+  }
+  if (k.level >= PNG_KERNEL_SSSE3) {
+    k.rgb = rgb_ssse3;
+  }
+  if (k.level >= PNG_KERNEL_AVX2) {
+    k.palette = palette_avx2;
+  }
+#endif
+
+  return k;
+}
+
+static PNGKernels& kernels() {
+  static PNGKernels k = make_kernels(PNG_KERNEL_BEST);
+  return k;
+}
+
+PNGKernelLevel png_select_kernels( PNGKernelLevel level ) {
+  kernels() = make_kernels(level);
+  return kernels().level;
+}
+
+const char* png_kernel_name( void ) {
+  switch (kernels().level) {
+    case PNG_KERNEL_SSE2:  return "sse2";
+    case PNG_KERNEL_SSSE3: return "ssse3";
+    case PNG_KERNEL_AVX2:  return "avx2";
+    default:               return "scalar";
+  }
+}
+
+// Kernel entry points //
+
+int png_unfilter( unsigned char* recon, const unsigned char* scanline,
+                  const unsigned char* precon, size_t bytewidth,
+                  unsigned long filter_type, size_t length ) {
+
+  const PNGKernels& k = kernels();
+
+  // without a previous scanline up is none and paeth is sub
+  switch (filter_type) {
+    case 0:
+      memcpy(recon, scanline, length);
+      return 0;
+    case 1:
+      k.sub(recon, scanline, bytewidth, length);
+      return 0;
+    case 2:
+      if (precon) k.up(recon, scanline, precon, length);
+      else        memcpy(recon, scanline, length);
+      return 0;
+    case 3:
+      if (precon) k.avg(recon, scanline, precon, bytewidth, length);
+      else        avg_first_scalar(recon, scanline, bytewidth, length);
+      return 0;
+    case 4:
+      if (precon) k.paeth(recon, scanline, precon, bytewidth, length);
+      else        k.sub(recon, scanline, bytewidth, length);
+      return 0;
+    default:
+      return 36; // unexisting filter type
+  }
+}
+
+void png_expand_grey( unsigned char* rgba, const unsigned char* in,
+                      size_t n, long key ) {
+  kernels().grey(rgba, in, n, key);
+}
+
+void png_expand_grey_alpha( unsigned char* rgba, const unsigned char* in,
+                            size_t n ) {
+  kernels().grey_alpha(rgba, in, n);
+}
+
+void png_expand_rgb( unsigned char* rgba, const unsigned char* in, size_t n,
+                     bool has_key, unsigned char key_r,
+                     unsigned char key_g, unsigned char key_b ) {
+  kernels().rgb(rgba, in, n, has_key, key_r, key_g, key_b);
+}
+
+int png_expand_palette( unsigned char* rgba, const unsigned char* in, size_t n,
+                        const unsigned char* palette, size_t entries ) {
+
+  // indices past the palette are an error
+  unsigned char largest = 0;
+  for (size_t i = 0; i < n; i++) largest = max(largest, in[i]);
+  if (n && largest >= entries) return 46;
+
+  uint32_t lut[256] = {0};
+  memcpy(lut, palette, 4 * min(entries, (size_t) 256));
+  kernels().palette(rgba, in, n, lut);
+  return 0;
+}
+
+void png_clear_transparent( unsigned char* rgba, size_t n ) {
+  kernels().clear_transparent(rgba, n);
+}
+
+void png_filter_scanline( unsigned char* out, const unsigned char* scanline,
+                          const unsigned char* precon, size_t bytewidth,
+                          size_t length ) {
+
+  // the first pixel has no left neighbour
+  size_t n = min(bytewidth, length);
+  uint64_t costs[5] = {0};
+  for (size_t i = 0; i < n; i++) {
+    short x = scanline[i], b = precon[i];
+    costs[0] += abs((signed char) x);
+    costs[1] += abs((signed char) x);
+    costs[2] += abs((signed char) (x - b));
+    costs[3] += abs((signed char) (x - (b >> 1)));
+    costs[4] += abs((signed char) (x - b));
+  }
+  kernels().filter_costs(scanline, precon, bytewidth, length, costs);
+
+  int type = 0;
+  for (int t = 1; t < 5; t++) if (costs[t] < costs[type]) type = t;
+
+  // these loops have no dependency between bytes and are vectorized by
+  // the compiler
+  *out++ = type;
+  switch (type) {
+    case 0:
+      memcpy(out, scanline, length);
+      break;
+    case 1:
+      for (size_t i = 0; i < n; i++) out[i] = scanline[i];
+      for (size_t i = n; i < length; i++) out[i] = scanline[i] - scanline[i - bytewidth];
+      break;
+    case 2:
+      for (size_t i = 0; i < length; i++) out[i] = scanline[i] - precon[i];
+      break;
+    case 3:
+      for (size_t i = 0; i < n; i++) out[i] = scanline[i] - (precon[i] >> 1);
+      for (size_t i = n; i < length; i++) {
+        out[i] = scanline[i] - ((scanline[i - bytewidth] + precon[i]) >> 1);
+      }
+      break;
+    case 4:
+      for (size_t i = 0; i < n; i++) out[i] = scanline[i] - precon[i];
+      for (size_t i = n; i < length; i++) {
+        int a = scanline[i - bytewidth], b = precon[i], c = precon[i - bytewidth];
+        int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+        out[i] = scanline[i] - ((pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c);
+      }
+      break;
+  }
+}
+
+} // namespace CMU462
@@ -0,0 +1,71 @@
+#ifndef CMU462_PNG_FILTER_H
+#define CMU462_PNG_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace CMU462 {
+
+/**
+ * Scanline kernels of the PNG decoder and encoder: reversing the per
+ * scanline filters, expanding 8-bit color types to RGBA32 and choosing
+ * and applying the filter of a scanline to encode. Each kernel has a scalar
+ * implementation and vectorized ones; the fastest one supported by the
+ * CPU is selected at runtime the first time a kernel is used.
+ */
+typedef enum PNGKernelLevel {
+  PNG_KERNEL_SCALAR = 0,
+  PNG_KERNEL_SSE2,
+  PNG_KERNEL_SSSE3,
+  PNG_KERNEL_AVX2,
+  PNG_KERNEL_BEST
+} PNGKernelLevel;
+
+// Select the kernels to use, capped at what the CPU supports.
+// Returns the level actually selected.
+PNGKernelLevel png_select_kernels( PNGKernelLevel level );
+
+// Name of the currently selected kernels.
+const char* png_kernel_name( void );
+
+// Reverse the filter of one scanline. precon is the previous reconstructed
+// scanline or NULL for the first one. Returns 0 or the picoPNG error code
+// for an unknown filter type.
+int png_unfilter( unsigned char* recon, const unsigned char* scanline,
+                  const unsigned char* precon, size_t bytewidth,
+                  unsigned long filter_type, size_t length );
+
+// Expand n 8-bit greyscale pixels to RGBA. Pixels equal to key are made
+// transparent when key is in [0,255].
+void png_expand_grey( unsigned char* rgba, const unsigned char* in,
+                      size_t n, long key );
+
+// Expand n 8-bit greyscale + alpha pixels to RGBA.
+void png_expand_grey_alpha( unsigned char* rgba, const unsigned char* in,
+                            size_t n );
+
+// Expand n 8-bit RGB pixels to RGBA. Pixels equal to the color key are
+// made transparent when has_key is set.
+void png_expand_rgb( unsigned char* rgba, const unsigned char* in, size_t n,
+                     bool has_key, unsigned char key_r,
+                     unsigned char key_g, unsigned char key_b );
+
+// Expand n 8-bit palette indices to RGBA using a palette of RGBA entries.
+// Returns 0 or the picoPNG error code for an index outside the palette.
+int png_expand_palette( unsigned char* rgba, const unsigned char* in, size_t n,
+                        const unsigned char* palette, size_t entries );
+
+// Clear the color of fully transparent RGBA pixels.
+void png_clear_transparent( unsigned char* rgba, size_t n );
+
+// Filter a scanline for encoding, with the filter type minimizing the sum
+// of absolute (signed) residuals. out receives the filter type byte then
+// length filtered bytes. precon is the previous scanline, all zeros for
+// the first one.
+void png_filter_scanline( unsigned char* out, const unsigned char* scanline,
+                          const unsigned char* precon, size_t bytewidth,
+                          size_t length );
+
+} // namespace CMU462
+
+#endif // CMU462_PNG_FILTER_H
@@ -0,0 +1,694 @@
+#include "png_writer.h"
+#include "png_filter.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+// Checksums //
+
+struct CRCTable {
+  uint32_t value[256];
+  CRCTable() {
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      value[n] = c;
+    }
+  }
+};
+
+static uint32_t crc32_update( uint32_t crc, const unsigned char* p, size_t n ) {
+  static const CRCTable table;
+  crc = ~crc;
+  for (size_t i = 0; i < n; i++) crc = table.value[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static const uint32_t ADLER_BASE = 65521;
+
+static uint32_t adler32_update( uint32_t adler, const unsigned char* p, size_t n ) {
+  uint32_t s1 = adler & 0xffff, s2 = adler >> 16;
+  while (n > 0) {
+    // largest block for which s2 cannot overflow before the modulo
+    size_t block = min(n, (size_t) 5552);
+    for (size_t i = 0; i < block; i++) { s1 += p[i]; s2 += s1; }
+    s1 %= ADLER_BASE; s2 %= ADLER_BASE;
+    p += block; n -= block;
+  }
+  return (s2 << 16) | s1;
+}
+
+// checksum of the concatenation of two buffers, the second one of size n2
+static uint32_t adler32_combine( uint32_t adler1, uint32_t adler2, size_t n2 ) {
+  uint64_t rem = n2 % ADLER_BASE;
+  uint64_t s1 = adler1 & 0xffff;
+  uint64_t s2 = (rem * s1) % ADLER_BASE;
+  s1 += (adler2 & 0xffff) + ADLER_BASE - 1;
+  s2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+  s1 %= ADLER_BASE; s2 %= ADLER_BASE;
+  return (uint32_t) ((s2 << 16) | s1);
+}
+
+// Deflate //
+
+static const unsigned LENEXTRA[29]  = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const unsigned DISTEXTRA[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+static const unsigned CLCL[19]      = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15}; // code length code order
+
+static const size_t WINDOW_SIZE = 32768;
+static const unsigned MIN_MATCH = 4; // matches are found through a hash of 4 bytes
+static const unsigned MAX_MATCH = 258;
+
+// bytes of filtered data deflated per chunk (and per parallel task)
+static const size_t CHUNK_SIZE = 1 << 17;
+
+// symbols buffered before a block is emitted
+static const size_t BLOCK_SYMBOLS = 1 << 15;
+
+// symbol layout: literals are stored as is, matches as
+//   bit  31     set
+//   bits 15..22 length - 3
+//   bits  0..14 distance - 1
+static const uint32_t MATCH_FLAG = 0x80000000u;
+
+struct DeflateParams {
+  unsigned hash_bits;
+  unsigned max_chain;   // candidates tried per position
+  unsigned nice_length; // stop searching once a match this long is found
+  size_t   max_insert;  // positions inside a match added to the hash chains
+  bool     lazy;        // defer a match if the next position has a longer one
+  bool     skip;        // search less often after many positions without a match
+};
+
+static const DeflateParams DEFLATE_FAST  = { 15,   8, 128,   8, false, true  };
+static const DeflateParams DEFLATE_SMALL = { 16, 512, 258, ~(size_t) 0, true, false };
+
+static inline uint32_t load32( const unsigned char* p ) {
+  uint32_t v; memcpy(&v, p, 4); return v;
+}
+
+static inline uint64_t load64( const unsigned char* p ) {
+  uint64_t v; memcpy(&v, p, 8); return v;
+}
+
+static inline unsigned length_code( unsigned length ) {
+  unsigned x = length - 3;
+  if (x < 8) return 257 + x;
+  if (x == 255) return 285;
+  unsigned hb = 31 - __builtin_clz(x);
+  return 257 + 4 * (hb - 1) + ((x >> (hb - 2)) & 3);
+}
+
+static inline unsigned dist_code( unsigned dist ) {
+  unsigned x = dist - 1;
+  if (x < 4) return x;
+  unsigned hb = 31 - __builtin_clz(x);
+  return 2 * hb + ((x >> (hb - 1)) & 1);
+}
+
+static inline unsigned length_extra_value( unsigned length, unsigned code ) {
+  static const unsigned LENBASE[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+  return length - LENBASE[code - 257];
+}
+
+static inline unsigned dist_extra_value( unsigned dist, unsigned code ) {
+  static const unsigned DISTBASE[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+  return dist - DISTBASE[code];
+}
+
+static inline unsigned reverse_bits( unsigned code, unsigned length ) {
+  unsigned r = 0;
+  for (unsigned i = 0; i < length; i++) { r = (r << 1) | (code & 1); code >>= 1; }
+  return r;
+}
+
+// Canonical codes (bit reversed, for LSB first output) from code lengths.
+static void huffman_codes( const unsigned char* lengths, size_t n, uint16_t* codes ) {
+  unsigned count[16] = {0}, next[16] = {0};
+  for (size_t i = 0; i < n; i++) count[lengths[i]]++;
+  count[0] = 0;
+  unsigned code = 0;
+  for (unsigned bits = 1; bits < 16; bits++) {
+    code = (code + count[bits - 1]) << 1;
+    next[bits] = code;
+  }
+  for (size_t i = 0; i < n; i++) {
+    codes[i] = lengths[i] ? reverse_bits(next[lengths[i]]++, lengths[i]) : 0;
+  }
+}
+
+struct SymbolFreq {
+  uint32_t key; // frequency, then code length
+  uint16_t symbol;
+  bool operator<( const SymbolFreq& s ) const {
+    return key != s.key ? key < s.key : symbol < s.symbol;
+  }
+};
+
+// Length limited Huffman code lengths. The optimal lengths are computed in
+// place (A. Moffat, J. Katajainen, "In-Place Calculation of Minimum-
+// Redundancy Codes") and then flattened to max_bits if needed. At least
+// two symbols get a code so that the code is always complete.
+static void huffman_lengths( const uint32_t* freq, size_t n, unsigned max_bits,
+                             unsigned char* lengths ) {
+
+  SymbolFreq a[288];
+  size_t used = 0;
+  for (size_t i = 0; i < n; i++) {
+    lengths[i] = 0;
+    if (freq[i]) { a[used].key = freq[i]; a[used].symbol = i; used++; }
+  }
+  for (size_t i = 0; used < 2; i++) {
+    if (!freq[i]) { a[used].key = 0; a[used].symbol = i; used++; }
+  }
+  sort(a, a + used);
+
+  // Moffat-Katajainen
+  int m = used;
+  a[0].key += a[1].key;
+  int root = 0, leaf = 2;
+  for (int next = 1; next < m - 1; next++) {
+    if (leaf >= m || a[root].key < a[leaf].key) {
+      a[next].key = a[root].key; a[root++].key = next;
+    } else {
+      a[next].key = a[leaf++].key;
+    }
+    if (leaf >= m || (root < next && a[root].key < a[leaf].key)) {
+      a[next].key += a[root].key; a[root++].key = next;
+    } else {
+      a[next].key += a[leaf++].key;
+    }
+  }
+  a[m - 2].key = 0;
+  for (int next = m - 3; next >= 0; next--) a[next].key = a[a[next].key].key + 1;
+  int avail = 1, nodes = 0, depth = 0;
+  root = m - 2;
+  int next = m - 1;
+  while (avail > 0) {
+    while (root >= 0 && (int) a[root].key == depth) { nodes++; root--; }
+    while (avail > nodes) { a[next--].key = depth; avail--; }
+    avail = 2 * nodes; depth++; nodes = 0;
+  }
+
+  // limit the code lengths, keeping the Kraft sum at exactly one
+  unsigned count[290] = {0};
+  for (int i = 0; i < m; i++) count[a[i].key]++;
+  for (int i = max_bits + 1; i < m; i++) { count[max_bits] += count[i]; count[i] = 0; }
+  uint32_t total = 0;
+  for (unsigned i = max_bits; i > 0; i--) total += count[i] << (max_bits - i);
+  while (total != (1u << max_bits)) {
+    count[max_bits]--;
+    for (unsigned i = max_bits - 1; i > 0; i--) {
+      if (count[i]) { count[i]--; count[i + 1] += 2; break; }
+    }
+    total--;
+  }
+
+  // the most frequent symbols get the shortest codes
+  int j = m;
+  for (unsigned bits = 1; bits <= max_bits; bits++) {
+    for (unsigned k = count[bits]; k > 0; k--) lengths[a[--j].symbol] = bits;
+  }
+}
+
+// LSB first bit writer appending to a byte vector
+struct BitWriter {
+
+  std::vector<unsigned char>& out;
+  uint64_t bitbuf;
+  unsigned bitcount;
+
+  BitWriter( std::vector<unsigned char>& out ) : out(out), bitbuf(0), bitcount(0) { }
+
+  inline void put( uint32_t value, unsigned n ) {
+    bitbuf |= (uint64_t) value << bitcount;
+    bitcount += n;
+    if (bitcount >= 32) {
+      unsigned char b[4] = { (unsigned char) bitbuf,         (unsigned char) (bitbuf >> 8),
+                             (unsigned char) (bitbuf >> 16), (unsigned char) (bitbuf >> 24) };
+      out.insert(out.end(), b, b + 4);
+      bitbuf >>= 32; bitcount -= 32;
+    }
+  }
+
+  // pad to a byte boundary and flush
+  inline void align() {
+    while (bitcount > 0) {
+      out.push_back((unsigned char) bitbuf);
+      bitbuf >>= 8; bitcount = bitcount > 8 ? bitcount - 8 : 0;
+    }
+    bitbuf = 0;
+  }
+};
+
+// code lengths of the fixed huffman code (BTYPE 1)
+struct FixedCodes {
+  unsigned char litlen_lengths[288], dist_lengths[30];
+  uint16_t litlen[288], dist[30];
+  FixedCodes() {
+    for (int i = 0; i < 288; i++) litlen_lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    for (int i = 0; i < 30; i++) dist_lengths[i] = 5;
+    huffman_codes(litlen_lengths, 288, litlen);
+    huffman_codes(dist_lengths, 30, dist);
+  }
+};
+
+static const FixedCodes& fixed_codes() {
+  static const FixedCodes codes;
+  return codes;
+}
+
+/**
+ * Deflate compressor producing non-final blocks followed by a sync flush,
+ * so that the output of independent chunks can be concatenated into one
+ * stream. Matches are found through hash chains over 4 byte prefixes.
+ */
+class Deflater {
+ public:
+
+  Deflater( const DeflateParams& params )
+    : params(params), head(1u << params.hash_bits), prev(2 * WINDOW_SIZE) { }
+
+  // Compress data[start, end) to out, using data[0, start) (at most
+  // WINDOW_SIZE bytes) as preset dictionary.
+  void deflate( const unsigned char* data, size_t start, size_t end,
+                std::vector<unsigned char>& out ) {
+
+    this->data = data; this->end = end;
+    fill(head.begin(), head.end(), -1);
+    for (size_t p = 0; p < start && p + MIN_MATCH <= end; p++) insert(p);
+    next_insert = start;
+
+    BitWriter writer(out);
+    symbols.clear();
+    size_t block_start = start, pos = start;
+    unsigned misses = 0;
+    while (pos < end) {
+
+      unsigned dist = 0;
+      unsigned length = longest_match(pos, dist);
+
+      if (params.lazy) {
+        while (length >= MIN_MATCH && length < params.nice_length && pos + 1 < end) {
+          unsigned next_dist = 0;
+          unsigned next_length = longest_match(pos + 1, next_dist);
+          if (next_length <= length) break;
+          symbols.push_back(data[pos++]);
+          length = next_length; dist = next_dist;
+        }
+      }
+
+      if (length >= MIN_MATCH) {
+        symbols.push_back(MATCH_FLAG | ((length - 3) << 15) | (dist - 1));
+        pos += length;
+        misses = 0;
+      } else {
+        // in incompressible data, emit a growing run of literals per search
+        size_t run = params.skip ? min((size_t) 1 + (misses++ >> 5), end - pos) : 1;
+        for (size_t k = 0; k < run; k++) symbols.push_back(data[pos++]);
+      }
+
+      if (symbols.size() >= BLOCK_SYMBOLS) {
+        write_block(writer, data + block_start, pos - block_start);
+        block_start = pos; symbols.clear();
+      }
+    }
+    if (!symbols.empty()) write_block(writer, data + block_start, pos - block_start);
+
+    // sync flush: empty stored block, leaving the stream byte aligned
+    writer.put(0, 3);
+    writer.align();
+    const unsigned char sync[4] = { 0x00, 0x00, 0xff, 0xff };
+    out.insert(out.end(), sync, sync + 4);
+  }
+
+ private:
+
+  DeflateParams params;
+  std::vector<int32_t> head, prev;
+  std::vector<uint32_t> symbols;
+
+  const unsigned char* data;
+  size_t end, next_insert;
+
+  inline uint32_t hash( size_t pos ) const {
+    return (load32(data + pos) * 2654435761u) >> (32 - params.hash_bits);
+  }
+
+  inline void insert( size_t pos ) {
+    uint32_t h = hash(pos);
+    prev[pos & (2 * WINDOW_SIZE - 1)] = head[h];
+    head[h] = pos;
+  }
+
+  void insert_until( size_t pos ) {
+    if (pos > next_insert && pos - next_insert > params.max_insert) next_insert = pos - params.max_insert;
+    size_t last = min(pos, end >= MIN_MATCH ? end - MIN_MATCH + 1 : 0);
+    for (size_t p = next_insert; p < last; p++) insert(p);
+    next_insert = max(next_insert, pos);
+  }
+
+  static inline unsigned match_length( const unsigned char* a, const unsigned char* b,
+                                       unsigned max_length ) {
+    unsigned n = 0;
+    while (n + 8 <= max_length) {
+      uint64_t diff = load64(a + n) ^ load64(b + n);
+      if (diff) return n + (__builtin_ctzll(diff) >> 3);
+      n += 8;
+    }
+    while (n < max_length && a[n] == b[n]) n++;
+    return n;
+  }
+
+  // Longest match for the string at pos, which is added to the hash chains.
+  unsigned longest_match( size_t pos, unsigned& dist ) {
+
+    insert_until(pos);
+    if (pos + MIN_MATCH > end) { next_insert = pos + 1; return 0; }
+
+    uint32_t h = hash(pos);
+    int64_t candidate = head[h];
+    prev[pos & (2 * WINDOW_SIZE - 1)] = head[h];
+    head[h] = pos;
+    next_insert = pos + 1;
+
+    const unsigned char* p = data + pos;
+    unsigned max_length = min((size_t) MAX_MATCH, end - pos);
+    unsigned best = MIN_MATCH - 1;
+    int64_t limit = (int64_t) pos - (int64_t) WINDOW_SIZE;
+    uint32_t prefix = load32(p);
+
+    for (unsigned chain = params.max_chain; candidate >= 0 && candidate >= limit && chain > 0; chain--) {
+      const unsigned char* c = data + candidate;
+      if (c[best] == p[best] && load32(c) == prefix) {
+        unsigned length = match_length(c, p, max_length);
+        if (length > best) {
+          best = length; dist = pos - candidate;
+          if (length >= params.nice_length || length == max_length) break;
+        }
+      }
+      candidate = prev[candidate & (2 * WINDOW_SIZE - 1)];
+    }
+
+    return best >= MIN_MATCH ? best : 0;
+  }
+
+  // emit the symbols of one block covering raw[0, size)
+  void write_block( BitWriter& writer, const unsigned char* raw, size_t size ) {
+
+    uint32_t litlen_freq[286] = {0}, dist_freq[30] = {0};
+    for (size_t i = 0; i < symbols.size(); i++) {
+      uint32_t s = symbols[i];
+      if (s & MATCH_FLAG) {
+        litlen_freq[length_code(((s >> 15) & 0xff) + 3)]++;
+        dist_freq[dist_code((s & 0x7fff) + 1)]++;
+      } else {
+        litlen_freq[s]++;
+      }
+    }
+    litlen_freq[256] = 1;
+
+    unsigned char litlen_lengths[286], dist_lengths[30];
+    huffman_lengths(litlen_freq, 286, 15, litlen_lengths);
+    huffman_lengths(dist_freq, 30, 15, dist_lengths);
+
+    // run length encoding of the code lengths
+    unsigned hlit = 286, hdist = 30;
+    while (hlit > 257 && !litlen_lengths[hlit - 1]) hlit--;
+    while (hdist > 1 && !dist_lengths[hdist - 1]) hdist--;
+    unsigned char lengths[316];
+    memcpy(lengths, litlen_lengths, hlit);
+    memcpy(lengths + hlit, dist_lengths, hdist);
+
+    std::vector<uint16_t> rle; // symbol | extra value << 8
+    uint32_t clen_freq[19] = {0};
+    for (unsigned i = 0, n = hlit + hdist; i < n;) {
+      unsigned l = lengths[i], run = 1;
+      while (i + run < n && lengths[i + run] == l) run++;
+      i += run;
+      if (l == 0) {
+        while (run >= 11) { unsigned r = min(run, 138u); rle.push_back(18 | (r - 11) << 8); clen_freq[18]++; run -= r; }
+        if (run >= 3) { rle.push_back(17 | (run - 3) << 8); clen_freq[17]++; run = 0; }
+      } else {
+        rle.push_back(l); clen_freq[l]++; run--;
+        while (run >= 3) { unsigned r = min(run, 6u); rle.push_back(16 | (r - 3) << 8); clen_freq[16]++; run -= r; }
+      }
+      while (run > 0) { rle.push_back(l); clen_freq[l]++; run--; }
+    }
+
+    unsigned char clen_lengths[19];
+    huffman_lengths(clen_freq, 19, 7, clen_lengths);
+    unsigned hclen = 19;
+    while (hclen > 4 && !clen_lengths[CLCL[hclen - 1]]) hclen--;
+
+    // pick the cheapest block type
+    const FixedCodes& fixed = fixed_codes();
+    uint64_t dynamic_bits = 3 + 14 + 3 * hclen, fixed_bits = 3;
+    for (unsigned i = 0; i < 19; i++) {
+      static const unsigned clen_extra[19] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,2,3,7};
+      dynamic_bits += (uint64_t) clen_freq[i] * (clen_lengths[i] + clen_extra[i]);
+    }
+    for (unsigned i = 0; i < 286; i++) {
+      unsigned extra = i > 256 ? LENEXTRA[i - 257] : 0;
+      dynamic_bits += (uint64_t) litlen_freq[i] * (litlen_lengths[i] + extra);
+      fixed_bits   += (uint64_t) litlen_freq[i] * (fixed.litlen_lengths[i] + extra);
+    }
+    for (unsigned i = 0; i < 30; i++) {
+      dynamic_bits += (uint64_t) dist_freq[i] * (dist_lengths[i] + DISTEXTRA[i]);
+      fixed_bits   += (uint64_t) dist_freq[i] * (5 + DISTEXTRA[i]);
+    }
+    uint64_t stored_bits = 8 * (size + 5 * ((size + 65534) / 65535)) + 7;
+
+    if (stored_bits <= dynamic_bits && stored_bits <= fixed_bits) {
+      for (size_t offset = 0; offset < size; offset += 65535) {
+        unsigned len = min(size - offset, (size_t) 65535);
+        writer.put(0, 3); // BFINAL 0, BTYPE 00
+        writer.align();
+        unsigned char header[4] = { (unsigned char) len,  (unsigned char) (len >> 8),
+                                    (unsigned char) ~len, (unsigned char) (~len >> 8) };
+        writer.out.insert(writer.out.end(), header, header + 4);
+        writer.out.insert(writer.out.end(), raw + offset, raw + offset + len);
+      }
+      return;
+    }
+
+    uint16_t litlen_codes[288], dist_codes[30];
+    if (fixed_bits <= dynamic_bits) {
+      writer.put(1 << 1, 3); // BFINAL 0, BTYPE 01
+      write_symbols(writer, fixed.litlen, fixed.litlen_lengths, fixed.dist, fixed.dist_lengths);
+      return;
+    }
+
+    uint16_t clen_codes[19];
+    huffman_codes(litlen_lengths, 286, litlen_codes);
+    huffman_codes(dist_lengths, 30, dist_codes);
+    huffman_codes(clen_lengths, 19, clen_codes);
+
+    writer.put(2 << 1, 3); // BFINAL 0, BTYPE 10
+    writer.put(hlit - 257, 5);
+    writer.put(hdist - 1, 5);
+    writer.put(hclen - 4, 4);
+    for (unsigned i = 0; i < hclen; i++) writer.put(clen_lengths[CLCL[i]], 3);
+    for (size_t i = 0; i < rle.size(); i++) {
+      unsigned s = rle[i] & 0xff;
+      writer.put(clen_codes[s], clen_lengths[s]);
+      if (s == 16) writer.put(rle[i] >> 8, 2);
+      if (s == 17) writer.put(rle[i] >> 8, 3);
+      if (s == 18) writer.put(rle[i] >> 8, 7);
+    }
+    write_symbols(writer, litlen_codes, litlen_lengths, dist_codes, dist_lengths);
+  }
+
+  void write_symbols( BitWriter& writer,
+                      const uint16_t* litlen_codes, const unsigned char* litlen_lengths,
+                      const uint16_t* dist_codes,   const unsigned char* dist_lengths ) {
+    for (size_t i = 0; i < symbols.size(); i++) {
+      uint32_t s = symbols[i];
+      if (s & MATCH_FLAG) {
+        unsigned length = ((s >> 15) & 0xff) + 3, dist = (s & 0x7fff) + 1;
+        unsigned lc = length_code(length), dc = dist_code(dist);
+        writer.put(litlen_codes[lc], litlen_lengths[lc]);
+        writer.put(length_extra_value(length, lc), LENEXTRA[lc - 257]);
+        writer.put(dist_codes[dc], dist_lengths[dc]);
+        writer.put(dist_extra_value(dist, dc), DISTEXTRA[dc]);
+      } else {
+        writer.put(litlen_codes[s], litlen_lengths[s]);
+      }
+    }
+    writer.put(litlen_codes[256], litlen_lengths[256]);
+  }
+
+}; // class Deflater
+
+// PNG writer //
+
+static inline void store32_be( unsigned char* p, uint32_t v ) {
+  p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+PNGWriter::PNGWriter( PNGCompression compression )
+  : compression(compression), file(NULL) { }
+
+PNGWriter::~PNGWriter() {
+  if (file) fclose(file);
+}
+
+int PNGWriter::open( const char* filename, size_t width, size_t height,
+                     bool alpha ) {
+
+  if (file) { fclose(file); file = NULL; }
+  if (width == 0 || height == 0 || width > 0x7fffffff || height > 0x7fffffff) return -1;
+
+  file = fopen(filename, "wb");
+  if (!file) return -1;
+
+  this->width = width;
+  this->height = height;
+  channels = alpha ? 4 : 3;
+  rows_written = 0;
+  prev_row.assign(channels * width, 0);
+  data.clear();
+  window = 0;
+  adler = 1;
+  header_written = false;
+
+  static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  unsigned char ihdr[13];
+  store32_be(ihdr + 0, width);
+  store32_be(ihdr + 4, height);
+  ihdr[8]  = 8;               // bit depth
+  ihdr[9]  = alpha ? 6 : 2;   // color type: RGBA or RGB
+  ihdr[10] = 0;               // compression method
+  ihdr[11] = 0;               // filter method
+  ihdr[12] = 0;               // no interlace
+
+  if (fwrite(signature, 1, 8, file) != 8) return -1;
+  return write_chunk("IHDR", ihdr, 13);
+}
+
+int PNGWriter::write_rows( const unsigned char* rgba, size_t rows ) {
+
+  if (!file || rows_written + rows > height) return -1;
+  if (rows == 0) return 0;
+
+  // drop the alpha channel if storing RGB
+  std::vector<unsigned char> rgb;
+  const unsigned char* raw = rgba;
+  size_t stride = channels * width;
+  if (channels == 3) {
+    rgb.resize(stride * rows);
+    for (size_t i = 0, n = width * rows; i < n; i++) {
+      rgb[3 * i + 0] = rgba[4 * i + 0];
+      rgb[3 * i + 1] = rgba[4 * i + 1];
+      rgb[3 * i + 2] = rgba[4 * i + 2];
+    }
+    raw = &rgb[0];
+  }
+
+  // filter rows in parallel
+  size_t offset = data.size();
+  data.resize(offset + rows * (1 + stride));
+  #pragma omp parallel for schedule(static)
+  for (long y = 0; y < (long) rows; y++) {
+    const unsigned char* cur  = raw + y * stride;
+    const unsigned char* prev = y ? cur - stride : &prev_row[0];
+    png_filter_scanline(&data[offset + y * (1 + stride)], cur, prev, channels, stride);
+  }
+  memcpy(&prev_row[0], raw + (rows - 1) * stride, stride);
+  rows_written += rows;
+
+  return deflate_pending(false);
+}
+
+int PNGWriter::close() {
+
+  if (!file) return -1;
+
+  int error = rows_written == height ? deflate_pending(true) : -1;
+  if (!error) {
+    // empty final block (fixed code, end of block only), then the checksum
+    unsigned char trailer[6] = { 0x03, 0x00 };
+    store32_be(trailer + 2, adler);
+    error = write_chunk("IDAT", trailer, 6);
+  }
+  if (!error) error = write_chunk("IEND", NULL, 0);
+
+  if (fclose(file) && !error) error = -1;
+  file = NULL;
+  data.clear();
+  return error;
+}
+
+int PNGWriter::deflate_pending( bool last ) {
+
+  size_t pending = data.size() - window;
+  size_t chunks = last ? (pending + CHUNK_SIZE - 1) / CHUNK_SIZE : pending / CHUNK_SIZE;
+  if (chunks == 0) return 0;
+
+  const DeflateParams& params = compression == PNG_COMPRESSION_SMALL ? DEFLATE_SMALL
+                                                                     : DEFLATE_FAST;
+  std::vector<std::vector<unsigned char> > compressed(chunks);
+  std::vector<uint32_t> checksums(chunks);
+
+  #pragma omp parallel
+  {
+    Deflater deflater(params);
+    #pragma omp for schedule(dynamic)
+    for (long k = 0; k < (long) chunks; k++) {
+      size_t start = window + k * CHUNK_SIZE;
+      size_t end = min(start + CHUNK_SIZE, data.size());
+      size_t dict = start > WINDOW_SIZE ? start - WINDOW_SIZE : 0;
+      compressed[k].reserve(end - start + 64);
+      deflater.deflate(&data[dict], start - dict, end - dict, compressed[k]);
+      checksums[k] = adler32_update(1, &data[start], end - start);
+    }
+  }
+
+  size_t consumed = min(window + chunks * CHUNK_SIZE, data.size());
+  for (size_t k = 0; k < chunks; k++) {
+
+    size_t start = window + k * CHUNK_SIZE;
+    size_t end = min(start + CHUNK_SIZE, data.size());
+    adler = adler32_combine(adler, checksums[k], end - start);
+
+    if (!header_written) {
+      // zlib header: deflate, 32K window, compression level hint
+      unsigned char header[2] = { 0x78, (unsigned char) (compression == PNG_COMPRESSION_SMALL ? 0xda : 0x5e) };
+      compressed[k].insert(compressed[k].begin(), header, header + 2);
+      header_written = true;
+    }
+    int error = write_chunk("IDAT", &compressed[k][0], compressed[k].size());
+    if (error) return error;
+  }
+
+  // keep the last window of deflated data as dictionary for the next chunk
+  size_t keep = min(consumed, WINDOW_SIZE);
+  data.erase(data.begin(), data.begin() + (consumed - keep));
+  window = keep;
+
+  return 0;
+}
+
+int PNGWriter::write_chunk( const char* type, const unsigned char* bytes,
+                            size_t size ) {
+
+  unsigned char header[8], footer[4];
+  store32_be(header, size);
+  memcpy(header + 4, type, 4);
+
+  uint32_t crc = crc32_update(0, header + 4, 4);
+  crc = crc32_update(crc, bytes, size);
+  store32_be(footer, crc);
+
+  if (fwrite(header, 1, 8, file) != 8) return -1;
+  if (size && fwrite(bytes, 1, size, file) != size) return -1;
+  if (fwrite(footer, 1, 4, file) != 4) return -1;
+  return 0;
+}
+
+} // namespace CMU462
@@ -0,0 +1,67 @@
+#ifndef CMU462_PNG_WRITER_H
+#define CMU462_PNG_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+namespace CMU462 {
+
+typedef enum PNGCompression {
+  PNG_COMPRESSION_FAST,  // greedy matching, short hash chains
+  PNG_COMPRESSION_SMALL  // lazy matching, long hash chains
+} PNGCompression;
+
+/**
+ * Streaming PNG encoder for RGBA8 images.
+ * Rows are appended top to bottom in any number of calls to write_rows.
+ * Every row is filtered with the filter type that minimizes the sum of
+ * absolute differences, and the filtered data is deflated in independent
+ * chunks compressed in parallel (each primed with the 32KB preceding it,
+ * pigz style) and written as one IDAT chunk each. The output does not
+ * depend on how the rows were split between calls.
+ */
+class PNGWriter {
+ public:
+
+  PNGWriter( PNGCompression compression = PNG_COMPRESSION_FAST );
+  ~PNGWriter();
+
+  // Start a new image. If alpha is false the alpha channel of the rows
+  // written is dropped and an RGB image is stored.
+  int open( const char* filename, size_t width, size_t height,
+            bool alpha = true );
+
+  // Append rows of 4 * width bytes each.
+  int write_rows( const unsigned char* rgba, size_t rows );
+
+  // Flush the remaining data and close the file. Fails if fewer rows
+  // than the image height were written.
+  int close();
+
+ private:
+
+  PNGCompression compression;
+  FILE* file;
+
+  size_t width, height;
+  size_t channels;
+  size_t rows_written;
+
+  std::vector<unsigned char> prev_row; // previous raw row, for the filters
+  std::vector<unsigned char> data;     // window + filtered data not deflated yet
+  size_t window;                       // bytes at the front of data already deflated
+
+  uint32_t adler;
+  bool header_written;
+
+  // deflate and write the full chunks in data (all of it if last is set)
+  int deflate_pending( bool last );
+
+  int write_chunk( const char* type, const unsigned char* bytes, size_t size );
+
+}; // class PNGWriter
+
+} // namespace CMU462
+
+#endif // CMU462_PNG_WRITER_H
@@ -0,0 +1,302 @@
+#include "profiler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+const int Profiler::MAX_SCOPES;
+const size_t Profiler::MAX_EVENTS;
+
+atomic<bool> Profiler::on ( false );
+
+namespace {
+
+struct Event {
+  int scope;
+  uint64_t start, end;
+};
+
+// counters (summed over threads) at the end of a traced frame
+struct CounterEvent {
+  uint64_t time;
+  uint64_t counters[PROFILE_COUNTERS];
+};
+
+// Totals of a thread. Only the thread adds to them, so they are updated
+// without read-modify-write atomics, and read by summary at any time.
+struct ThreadData {
+
+  atomic<uint64_t> time[Profiler::MAX_SCOPES];
+  atomic<uint64_t> counters[PROFILE_COUNTERS];
+
+  // trace events, appended by the thread and written by stop_trace
+  mutex events_mutex;
+  vector<Event> events;
+  int tid;
+
+  ThreadData( int tid ) : tid ( tid ) {
+    for (int i = 0; i < Profiler::MAX_SCOPES; ++i) time[i] = 0;
+    for (int i = 0; i < PROFILE_COUNTERS; ++i) counters[i] = 0;
+  }
+};
+
+struct State {
+
+  mutex lock; // guards everything but the atomics
+  vector<const char*> names;
+  vector<ThreadData*> threads; // never freed, threads may outlive the profiler
+  atomic<uint64_t> frames;
+
+  // trace
+  atomic<bool> tracing;
+  atomic<size_t> events;
+  string trace_file;
+  uint64_t trace_start;
+  vector<CounterEvent> counter_events;
+
+  // totals at the last summary
+  uint64_t last_frames;
+  uint64_t last_time[Profiler::MAX_SCOPES];
+  uint64_t last_counters[PROFILE_COUNTERS];
+
+  State() : frames ( 0 ), tracing ( false ), events ( 0 ), trace_start ( 0 ),
+            last_frames ( 0 ) {
+    fill(last_time, last_time + Profiler::MAX_SCOPES, 0);
+    fill(last_counters, last_counters + PROFILE_COUNTERS, 0);
+  }
+};
+
+State& state() {
+  static State s;
+  return s;
+}
+
+thread_local ThreadData* thread_data = NULL;
+
+ThreadData& local() {
+  if (!thread_data) {
+    State& s = state();
+    lock_guard<mutex> guard(s.lock);
+    thread_data = new ThreadData(s.threads.size() + 1);
+    s.threads.push_back(thread_data);
+  }
+  return *thread_data;
+}
+
+inline void add( atomic<uint64_t>& total, uint64_t n ) {
+  total.store(total.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// counters summed over threads, with the state locked
+void sum_counters( State& s, uint64_t* counters ) {
+  fill(counters, counters + PROFILE_COUNTERS, 0);
+  for (size_t t = 0; t < s.threads.size(); ++t) {
+    for (int c = 0; c < PROFILE_COUNTERS; ++c) {
+      counters[c] += s.threads[t]->counters[c].load(memory_order_relaxed);
+    }
+  }
+}
+
+const char* counter_names[PROFILE_COUNTERS] = {
+  "samples", "triangles", "lines", "points", "images"
+};
+
+// 1234567 -> 1.2M
+string human( double n ) {
+  ostringstream out;
+  out << fixed << setprecision(1);
+  if (n >= 1e9) out << n / 1e9 << "G";
+  else if (n >= 1e6) out << n / 1e6 << "M";
+  else if (n >= 1e3) out << n / 1e3 << "k";
+  else out << setprecision(0) << n;
+  return out.str();
+}
+
+} // namespace
+
+void Profiler::enable( bool enabled ) {
+  on = enabled;
+}
+
+uint64_t Profiler::now( void ) {
+  return chrono::duration_cast<chrono::nanoseconds>(
+    chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int Profiler::scope( const char* name ) {
+
+  State& s = state();
+  lock_guard<mutex> guard(s.lock);
+  for (size_t i = 0; i < s.names.size(); ++i) {
+    if (string(s.names[i]) == name) return i;
+  }
+
+  // past the limit, scopes are merged in the last one
+  if (s.names.size() == MAX_SCOPES) return MAX_SCOPES - 1;
+  s.names.push_back(s.names.size() == MAX_SCOPES - 1 ? "other" : name);
+  return s.names.size() - 1;
+}
+
+void Profiler::record( int scope, uint64_t start, uint64_t end ) {
+
+  ThreadData& t = local();
+  add(t.time[scope], end - start);
+
+  State& s = state();
+  if (s.tracing.load(memory_order_relaxed) &&
+      s.events.fetch_add(1, memory_order_relaxed) < MAX_EVENTS) {
+    Event event = { scope, start, end };
+    lock_guard<mutex> guard(t.events_mutex);
+    t.events.push_back(event);
+  }
+}
+
+void Profiler::count( ProfileCounter counter, uint64_t n ) {
+  add(local().counters[counter], n);
+}
+
+void Profiler::end_frame( void ) {
+
+  State& s = state();
+  s.frames.fetch_add(1, memory_order_relaxed);
+
+  if (s.tracing.load(memory_order_relaxed)) {
+    CounterEvent event;
+    event.time = now();
+    lock_guard<mutex> guard(s.lock);
+    sum_counters(s, event.counters);
+    s.counter_events.push_back(event);
+  }
+}
+
+string Profiler::summary( void ) {
+
+  State& s = state();
+  lock_guard<mutex> guard(s.lock);
+
+  uint64_t frames = s.frames.load(memory_order_relaxed);
+  if (frames == s.last_frames) return "";
+  double n = frames - s.last_frames;
+  s.last_frames = frames;
+
+  // time of each scope since the last summary
+  vector<pair<double, int> > times;
+  double frame_time = 0;
+  for (size_t i = 0; i < s.names.size(); ++i) {
+    uint64_t total = 0;
+    for (size_t t = 0; t < s.threads.size(); ++t) {
+      total += s.threads[t]->time[i].load(memory_order_relaxed);
+    }
+    double ms = (total - s.last_time[i]) / n * 1e-6;
+    s.last_time[i] = total;
+    if (string(s.names[i]) == "frame") frame_time = ms;
+    else times.push_back(make_pair(ms, (int) i));
+  }
+  sort(times.rbegin(), times.rend());
+
+  uint64_t counters[PROFILE_COUNTERS];
+  sum_counters(s, counters);
+
+  ostringstream out;
+  out << fixed << setprecision(1) << "frame " << frame_time << " ms:";
+  for (size_t i = 0; i < min(times.size(), (size_t) 3); ++i) {
+    out << (i ? ", " : " ") << s.names[times[i].second] << " " << times[i].first;
+  }
+  out << " |";
+  for (int c = 0; c < PROFILE_COUNTERS; ++c) {
+    double per_frame = (counters[c] - s.last_counters[c]) / n;
+    s.last_counters[c] = counters[c];
+    if (per_frame) out << " " << human(per_frame) << " " << counter_names[c];
+  }
+  return out.str();
+}
+
+void Profiler::start_trace( const string& filename ) {
+
+  State& s = state();
+  {
+    lock_guard<mutex> guard(s.lock);
+    for (size_t t = 0; t < s.threads.size(); ++t) {
+      lock_guard<mutex> events_guard(s.threads[t]->events_mutex);
+      s.threads[t]->events.clear();
+    }
+    s.trace_file = filename;
+    s.trace_start = now();
+    s.events = 0;
+
+    // counters before the first frame
+    CounterEvent start;
+    start.time = s.trace_start;
+    sum_counters(s, start.counters);
+    s.counter_events.assign(1, start);
+  }
+  s.tracing = true;
+  enable(true);
+}
+
+bool Profiler::tracing( void ) {
+  return state().tracing.load();
+}
+
+int Profiler::stop_trace( void ) {
+
+  State& s = state();
+  if (!s.tracing.exchange(false)) return 0;
+
+  lock_guard<mutex> guard(s.lock);
+  FILE* out = fopen(s.trace_file.c_str(), "w");
+  if (!out) return -1;
+
+  // complete events, timestamps in microseconds from the start
+  fprintf(out, "{\"traceEvents\":[\n");
+  bool first = true;
+  for (size_t t = 0; t < s.threads.size(); ++t) {
+    ThreadData& thread = *s.threads[t];
+    lock_guard<mutex> events_guard(thread.events_mutex);
+    for (size_t i = 0; i < thread.events.size(); ++i) {
+      const Event& e = thread.events[i];
+      if (e.start < s.trace_start) continue;
+      fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"drawsvg\",\"ph\":\"X\","
+                   "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+              first ? "" : ",\n", s.names[e.scope],
+              (e.start - s.trace_start) * 1e-3, (e.end - e.start) * 1e-3, thread.tid);
+      first = false;
+    }
+    thread.events.clear();
+  }
+
+  // counters per frame
+  uint64_t last[PROFILE_COUNTERS];
+  if (!s.counter_events.empty()) {
+    copy(s.counter_events[0].counters, s.counter_events[0].counters + PROFILE_COUNTERS, last);
+  }
+  for (size_t i = 1; i < s.counter_events.size(); ++i) {
+    const CounterEvent& e = s.counter_events[i];
+    fprintf(out, "%s{\"name\":\"frame counters\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{",
+            first ? "" : ",\n", (e.time - s.trace_start) * 1e-3);
+    for (int c = 0; c < PROFILE_COUNTERS; ++c) {
+      fprintf(out, "%s\"%s\":%llu", c ? "," : "", counter_names[c],
+              (unsigned long long) (e.counters[c] - last[c]));
+      last[c] = e.counters[c];
+    }
+    fprintf(out, "}}");
+    first = false;
+  }
+  s.counter_events.clear();
+
+  size_t events = s.events.load();
+  fprintf(out, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":%zu}}\n",
+          events > MAX_EVENTS ? events - MAX_EVENTS : 0);
+
+  return fclose(out) ? -1 : 0;
+}
+
+} // namespace CMU462
@@ -0,0 +1,126 @@
+#ifndef CMU462_PROFILER_H
+#define CMU462_PROFILER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+namespace CMU462 {
+
+/**
+ * Frame profiler: scoped timers and counters on the hot paths (parsing,
+ * triangulation, drawing elements, rasterizing and resolving).
+ *
+ * Code is instrumented with PROFILE_SCOPE("name"), which times the rest of
+ * the enclosing block, PROFILE_COUNT(counter, n), and PROFILE_FRAME() at
+ * the end of every frame. Built without DRAWSVG_PROFILE these compile to
+ * nothing; built with it, they cost a single branch until the profiler is
+ * enabled at runtime.
+ *
+ * When enabled, the time of every scope and the counters are
+ * accumulated per thread, and summary reports what they add up to per
+ * frame since it was last called. When tracing, every timed scope is also
+ * recorded as an event (up to MAX_EVENTS) and written to a Chrome trace
+ * file (chrome://tracing, or Perfetto) when the trace is stopped.
+ */
+
+typedef enum ProfileCounter {
+  PROFILE_SAMPLES = 0,  // samples written by the rasterizers
+  PROFILE_TRIANGLES,
+  PROFILE_LINES,
+  PROFILE_POINTS,
+  PROFILE_IMAGES,
+  PROFILE_COUNTERS
+} ProfileCounter;
+
+class Profiler {
+ public:
+
+  // scopes (distinct names) that can be timed
+  static const int MAX_SCOPES = 64;
+
+  // trace events kept per trace, later ones are dropped
+  static const size_t MAX_EVENTS = 1 << 21;
+
+  // turn timing and counting on or off
+  static void enable( bool enabled );
+  static bool enabled( void ) {
+    return on.load(std::memory_order_relaxed);
+  }
+
+  // Start recording trace events (enabling the profiler), and write them
+  // to a Chrome trace_event JSON file when stopped. Returns 0, or -1 if
+  // the file cannot be written.
+  static void start_trace( const std::string& filename );
+  static int stop_trace( void );
+  static bool tracing( void );
+
+  // One line summary of the frames drawn since the last call: time per
+  // frame, the scopes that took most of it and the counters per frame.
+  // Empty if no frame was drawn since.
+  static std::string summary( void );
+
+  // Instrumentation, used through the macros //
+
+  // id of a scope name (names must outlive the profiler)
+  static int scope( const char* name );
+
+  // time of a scope, in nanoseconds of a steady clock
+  static void record( int scope, uint64_t start, uint64_t end );
+  static uint64_t now( void );
+
+  static void count( ProfileCounter counter, uint64_t n );
+  static void end_frame( void );
+
+ private:
+
+  static std::atomic<bool> on;
+
+}; // class Profiler
+
+// times its lifetime
+class ProfileScope {
+ public:
+
+  ProfileScope( int scope ) : scope ( scope ) {
+    start = Profiler::enabled() ? Profiler::now() : 0;
+  }
+
+  ~ProfileScope( void ) {
+    if (start) Profiler::record(scope, start, Profiler::now());
+  }
+
+ private:
+
+  int scope; uint64_t start;
+
+}; // class ProfileScope
+
+} // namespace CMU462
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef DRAWSVG_PROFILE
+
+#define PROFILE_SCOPE(name) \
+  static const int PROFILE_CONCAT(profile_scope_id_, __LINE__) = \
+    CMU462::Profiler::scope(name); \
+  CMU462::ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__) \
+    ( PROFILE_CONCAT(profile_scope_id_, __LINE__) )
+
+#define PROFILE_COUNT(counter, n) \
+  do { if (CMU462::Profiler::enabled()) CMU462::Profiler::count(counter, n); } while (0)
+
+#define PROFILE_FRAME() \
+  do { if (CMU462::Profiler::enabled()) CMU462::Profiler::end_frame(); } while (0)
+
+#else
+
+#define PROFILE_SCOPE(name) do { } while (0)
+#define PROFILE_COUNT(counter, n) do { } while (0)
+#define PROFILE_FRAME() do { } while (0)
+
+#endif // DRAWSVG_PROFILE
+
+#endif // CMU462_PROFILER_H
@@ -0,0 +1,193 @@
+#include "scene.h"
+#include "triangulation.h"
+#include "profiler.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+static bool is_identity( const Matrix3x3& m ) {
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      if (m(i,j) != (i == j ? 1.0 : 0.0)) return false;
+    }
+  }
+  return true;
+}
+
+void SVGScene::sync( SVG& svg ) {
+
+  PROFILE_SCOPE("sync");
+  width  = svg.width;
+  height = svg.height;
+
+  types.clear(); transforms.clear(); styles.clear();
+  first.clear(); count.clear(); aux.clear();
+  sources.clear(); parents.clear();
+  fill_colors.clear(); stroke_colors.clear(); fill_gradients.clear();
+  vertices.clear(); textures.clear(); paths.clear();
+  layer_begin.clear(); layer_end.clear(); layer_opacity.clear();
+
+  local_transforms.assign(1, Matrix3x3::identity());
+  parent_transforms.assign(1, 0);
+
+  add_elements(svg.elements, 0);
+}
+
+uint32_t SVGScene::add_style( const Style& style, const Gradient* gradient ) {
+
+  // consecutive elements mostly share their style
+  size_t n = fill_colors.size();
+  if (n && fill_colors[n - 1]    == style.fillColor &&
+           stroke_colors[n - 1]  == style.strokeColor &&
+           fill_gradients[n - 1] == gradient) {
+    return n - 1;
+  }
+
+  fill_colors.push_back(style.fillColor);
+  stroke_colors.push_back(style.strokeColor);
+  fill_gradients.push_back(gradient);
+  return n;
+}
+
+bool SVGScene::geometry( SVGElement* element, vector<Vector2D>& points,
+                         uint32_t& triangles ) {
+
+  points.clear();
+  triangles = 0;
+
+  switch (element->type) {
+    case POINT:
+      points.push_back(static_cast<Point*>(element)->position);
+      return true;
+    case LINE:
+      points.push_back(static_cast<Line*>(element)->from);
+      points.push_back(static_cast<Line*>(element)->to);
+      return true;
+    case POLYLINE:
+      points = static_cast<Polyline*>(element)->points;
+      return true;
+    case RECT:
+      points.push_back(static_cast<Rect*>(element)->position);
+      points.push_back(static_cast<Rect*>(element)->dimension);
+      return true;
+    case POLYGON: {
+      Polygon* polygon = static_cast<Polygon*>(element);
+      points = polygon->points;
+      if (polygon->style.fillColor.a != 0) {
+        vector<Vector2D> triangulated;
+        triangulate(*polygon, triangulated);
+        points.insert(points.end(), triangulated.begin(), triangulated.end());
+        triangles = triangulated.size();
+      }
+      return true;
+    }
+    case ELLIPSE:
+      points.push_back(static_cast<Ellipse*>(element)->center);
+      points.push_back(static_cast<Ellipse*>(element)->radius);
+      return true;
+    case IMAGE: {
+      Image* image = static_cast<Image*>(element);
+      points.push_back(image->position);
+      points.push_back(image->position + image->dimension);
+      return true;
+    }
+    case PATH:
+      points = static_cast<Path*>(element)->points;
+      return true;
+    default:
+      return false;
+  }
+}
+
+void SVGScene::add_elements( vector<SVGElement*>& elements, uint32_t parent ) {
+
+  vector<Vector2D> points;
+  for (size_t i = 0; i < elements.size(); ++i) {
+
+    SVGElement* element = elements[i];
+
+    uint32_t transform = parent;
+    if (!is_identity(element->transform)) {
+      transform = local_transforms.size();
+      local_transforms.push_back(element->transform);
+      parent_transforms.push_back(parent);
+    }
+
+    if (element->type == GROUP) {
+      Group* group = static_cast<Group*>(element);
+      size_t layer = layer_begin.size();
+      if (group->opacity < 1) {
+        layer_begin.push_back(size());
+        layer_end.push_back(size());
+        layer_opacity.push_back(group->opacity);
+      }
+      add_elements(group->elements, transform);
+      if (group->opacity < 1) layer_end[layer] = size();
+      continue;
+    }
+
+    uint32_t triangles;
+    if (!geometry(element, points, triangles)) continue;
+
+    uint32_t begin = vertices.size();
+    vertices.insert(vertices.end(), points.begin(), points.end());
+
+    // polygons count their outline, images and paths refer to their
+    // texture and path
+    uint32_t extra = triangles;
+    if (element->type == IMAGE) {
+      extra = textures.size();
+      textures.push_back(&static_cast<Image*>(element)->tex);
+    } else if (element->type == PATH) {
+      extra = paths.size();
+      paths.push_back(static_cast<Path*>(element));
+    }
+
+    types.push_back(element->type);
+    transforms.push_back(transform);
+    styles.push_back(add_style(element->style, fillGradient(element)));
+    first.push_back(begin);
+    count.push_back(points.size() - triangles);
+    aux.push_back(extra);
+    sources.push_back(element);
+    parents.push_back(parent);
+  }
+}
+
+void SVGScene::update( size_t i ) {
+
+  SVGElement* element = sources[i];
+
+  styles[i] = add_style(element->style, fillGradient(element));
+
+  // transform: back to the node of the group, the node of the primitive
+  // updated, or a new one
+  if (is_identity(element->transform)) {
+    transforms[i] = parents[i];
+  } else if (transforms[i] != parents[i]) {
+    local_transforms[transforms[i]] = element->transform;
+  } else {
+    transforms[i] = local_transforms.size();
+    local_transforms.push_back(element->transform);
+    parent_transforms.push_back(parents[i]);
+  }
+
+  // geometry, in place if its size did not change
+  vector<Vector2D> points; uint32_t triangles;
+  geometry(element, points, triangles);
+
+  uint32_t size = count[i] + (types[i] == POLYGON ? aux[i] : 0);
+  if (points.size() != size) {
+    first[i] = vertices.size();
+    vertices.resize(vertices.size() + points.size());
+  }
+  copy(points.begin(), points.end(), vertices.begin() + first[i]);
+
+  count[i] = points.size() - triangles;
+  if (types[i] == POLYGON) aux[i] = triangles;
+}
+
+} // namespace CMU462
@@ -0,0 +1,106 @@
+#ifndef CMU462_SCENE_H
+#define CMU462_SCENE_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "svg.h"
+
+namespace CMU462 {
+
+/**
+ * Flattened structure-of-arrays form of a svg, for renderers that want to
+ * walk a document linearly instead of chasing element pointers. The SVG
+ * element tree stays the representation that is parsed and edited; a scene
+ * is a snapshot of it, rebuilt explicitly with sync() after the tree (or
+ * any texture in it) changes.
+ *
+ * Groups are flattened away. Every drawable element becomes a primitive,
+ * in draw order, made of its type, the node of its transform, its colors
+ * and a range of the shared vertex pool:
+ *
+ *   POINT     position
+ *   LINE      from, to
+ *   POLYLINE  points
+ *   RECT      position, dimension
+ *   POLYGON   points, followed by aux triangle vertices (triangulated once
+ *             here rather than every frame)
+ *   ELLIPSE   center, radius
+ *   IMAGE     position, position + dimension; aux is the texture index
+ *   PATH      points (the control points, whose hull holds the curves);
+ *             aux is the path index. Renderers flatten the path itself,
+ *             as that depends on the zoom.
+ *
+ * Transforms form a tree mirroring the nested element transforms: node 0
+ * is the canvas, and every element with a non-identity transform adds a
+ * node whose parent is the node of its enclosing group. Parents are
+ * stored before their children, so a renderer can evaluate all nodes in
+ * one pass, composing them in the same order as a walk of the tree.
+ */
+struct SVGScene {
+
+  SVGScene() : width( 0 ), height( 0 ) { }
+
+  // rebuild the scene from a svg
+  void sync( SVG& svg );
+
+  // Update a primitive from its element after the element changed (its
+  // style, transform or geometry, but not its type). New vertices or
+  // transform nodes are appended, so a scene that is updated a lot should
+  // eventually be synced again.
+  void update( size_t primitive );
+
+  // canvas size
+  float width, height;
+
+  // primitives
+  std::vector<uint8_t>  types;
+  std::vector<uint32_t> transforms;
+  std::vector<uint32_t> styles;
+  std::vector<uint32_t> first;
+  std::vector<uint32_t> count;
+  std::vector<uint32_t> aux;
+
+  // element and transform node of the enclosing group of each primitive
+  std::vector<SVGElement*> sources;
+  std::vector<uint32_t> parents;
+
+  // Layers: the primitives [layer_begin, layer_end) of every group with an
+  // opacity below 1, to draw together and composite with layer_opacity.
+  // Layers nest and are listed in the order they begin, outer ones first.
+  // Group opacities changed after sync need a new sync.
+  std::vector<uint32_t> layer_begin;
+  std::vector<uint32_t> layer_end;
+  std::vector<float>    layer_opacity;
+
+  // transform tree
+  std::vector<Matrix3x3> local_transforms;
+  std::vector<uint32_t>  parent_transforms;
+
+  // styles (fill gradients are NULL for flat fills)
+  std::vector<Color> fill_colors;
+  std::vector<Color> stroke_colors;
+  std::vector<const Gradient*> fill_gradients;
+
+  // shared pools
+  std::vector<Vector2D> vertices;
+  std::vector<Texture*> textures;
+  std::vector<const Path*> paths;
+
+  size_t size() const { return types.size(); }
+
+ private:
+
+  void add_elements( std::vector<SVGElement*>& elements, uint32_t transform );
+  uint32_t add_style( const Style& style, const Gradient* gradient );
+
+  // vertices of a drawable element (and for polygons the number of them
+  // that are triangles), false for elements that are not drawn
+  static bool geometry( SVGElement* element, std::vector<Vector2D>& points,
+                        uint32_t& triangles );
+
+}; // struct SVGScene
+
+} // namespace CMU462
+
+#endif // CMU462_SCENE_H
@@ -2,10 +2,15 @@
 #define CMU462_SOFTWARE_RENDERER_H
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <vector>
+#include <atomic>
 
 #include "CMU462.h"
+#include "scene.h"
 #include "texture.h"
+#include "flattening.h"
+#include "layer_pool.h"
 #include "svg_renderer.h"
 
 namespace CMU462 { // CMU462
@@ -63,14 +68,86 @@ class SoftwareRenderer : public SVGRenderer {
 }; // class SoftwareRenderer
 
 
+// Receives the rows of an image drawn in bands (see draw_scene_bands)
+class BandHandler {
+ public:
+
+  virtual ~BandHandler() { }
+
+  // rows [y, y + rows) of the image, 4 * width bytes each. A non-zero
+  // return value stops the drawing.
+  virtual int band( const unsigned char* rgba, size_t y, size_t rows ) = 0;
+
+}; // class BandHandler
+
 class SoftwareRendererImp : public SoftwareRenderer {
  public:
 
-  SoftwareRendererImp( ) : SoftwareRenderer( ) { super_sample_buffer = NULL;} // { super_sample_buffer = NULL;}
+  SoftwareRendererImp( ) : SoftwareRenderer( ) {
+    super_sample_buffer = NULL; super_sample_size = 0;
+    cancel_flag = NULL; frame_scene = NULL;
+    bounds_valid = false;
+    clip_x0 = clip_y0 = clip_x1 = clip_y1 = 0;
+    band_y = 0; next_layer = 0;
+  } // { super_sample_buffer = NULL;}
+
+  ~SoftwareRendererImp( ) { free(super_sample_buffer); }
 
   // draw an svg input to render target
   void draw_svg( SVG& svg );
 
+  // draw a flattened svg to render target, walking its arrays linearly
+  // (same output as draw_svg on the svg it was synced from)
+  void draw_scene( const SVGScene& scene );
+
+  // Same as draw_scene, but when the last frame drawn was of the same
+  // scene and the view only moved by whole pixels, the frame is shifted
+  // and only the exposed strips are drawn. The render target must still
+  // hold that frame.
+  void update_scene( const SVGScene& scene );
+
+  // forget the last frame, so that update_scene draws the next one whole
+  // (for instance after its textures changed)
+  void discard_frame( void ) { frame_scene = NULL; }
+
+  // Edits: redraw only what changed in the last frame drawn of a scene.
+  // Mark the primitives that are about to change with mark_dirty, change
+  // their elements and update them in the scene (SVGScene::update), then
+  // call redraw_dirty. The union of the old and new screen bounds of the
+  // marked primitives is cleared and the primitives over it are drawn
+  // again, in paint order. If the view changed, the frame is drawn whole.
+  void mark_dirty( const SVGScene& scene, size_t primitive );
+  void redraw_dirty( const SVGScene& scene );
+
+  // Out-of-core drawing, for images too large to hold: the scene is drawn
+  // into an image of the render target's width and the given height (with
+  // canvas_to_screen set for the whole image) one band of the render
+  // target's height at a time, top to bottom, and each band is handed to
+  // the handler once resolved. Primitives are sorted by the bands their
+  // bounds reach, so a band only visits the primitives over it. Memory is
+  // bounded by the band size whatever the image size. Returns 0, or -1 if
+  // cancelled or stopped by the handler.
+  int draw_scene_bands( const SVGScene& scene, size_t height,
+                        BandHandler& handler );
+
+  // Incremental drawing, for elements that arrive one at a time (see
+  // SVGParser::stream): begin_frame, then draw_element for each element
+  // with the transform of its enclosing groups, then end_frame with the
+  // size of the canvas.
+  void begin_frame( void );
+  void draw_element( SVGElement* element, const Matrix3x3& group_transform );
+  void end_frame( float width, float height );
+
+  // The elements of a group with an opacity below 1 are drawn between
+  // begin_layer and end_layer. Its bounds are not known until it ends, so
+  // the layer covers the whole target.
+  void begin_layer( float opacity );
+  void end_layer( void );
+
+  // Make draw_scene give up (leaving the frame unfinished) as soon as the
+  // flag is set, checked between primitives. NULL to never give up.
+  void set_cancel_flag( const std::atomic<bool>* flag ) { cancel_flag = flag; }
+
   // set sample rate
   void set_sample_rate( size_t sample_rate );
   void set_sample_buf(int x, int y, Color color);
@@ -79,12 +156,16 @@ class SoftwareRendererImp : public SoftwareRenderer {
                           size_t width, size_t height );
  private:
   float* super_sample_buffer;
+  size_t super_sample_size; // floats in the buffer
   // float* super_sample_dep_buffer;
 
 
   // Init //
   // allocates a buf of the correct size for the supersampling target
   float* create_supersampling_buf(float default_value);
+  // clears the buffer to white for a new frame, reallocating it only if
+  // the target size or the sample rate changed
+  void reset_supersampling_buf( void );
   // Primitive Drawing //
 
   // Draws an SVG element
@@ -114,8 +195,136 @@ class SoftwareRendererImp : public SoftwareRenderer {
   // Draw a group
   void draw_group( Group& group );
 
+  // Draw a path
+  void draw_path( Path& path );
+
+  // Shared by the element and scene paths //
+
+  // Draw the outline of a list of points (closing it if closed is set)
+  void draw_outline( const Vector2D* points, size_t n, bool closed,
+                     Color color );
+
+  // Draw a rectangle from its corner and size
+  void draw_rect( float x, float y, float w, float h,
+                  Color fill, Color stroke, const Gradient* gradient = NULL );
+
+  // Draw a triangle list
+  void draw_triangles( const Vector2D* triangles, size_t n, Color color );
+
+  // Draw a triangle list filled with a gradient (with the opacity of the
+  // fill), whose bounding box is that of the points of the element
+  void draw_gradient( const Vector2D* triangles, size_t n,
+                      const Gradient& gradient, float opacity,
+                      const Vector2D* points, size_t num_points );
+
+  // Draw a path, flattened for the current transformation
+  void draw_path( const Path& path, Color fill, Color stroke,
+                  const Gradient* gradient );
+
+  // flattened paths of the zoom levels drawn lately
+  PathCache path_cache;
+
+  // screen space transforms of the scene being drawn
+  std::vector<Matrix3x3> scene_transforms;
+
+  // draw the primitives of a scene, false if cancelled. If cull is set,
+  // primitives whose frame bounds are outside the scissor are skipped.
+  bool draw_primitives( const SVGScene& scene, bool cull = false );
+  void draw_primitive( const SVGScene& scene, size_t i );
+
+  // screen space transforms of the nodes of a scene (scene_transforms)
+  void evaluate_transforms( const SVGScene& scene );
+
+  // reset the samples of the pixels in [x0, x1) x [y0, y1)
+  void clear_samples( int x0, int y0, int x1, int y1 );
+
+  // draw the canvas outline
+  void draw_canvas_outline( float width, float height );
+
+  // last complete frame drawn by draw_scene / update_scene (NULL if the
+  // render target and sample buffer hold anything else) and the canvas to
+  // screen transformation it was drawn with
+  const SVGScene* frame_scene;
+  Matrix3x3 frame_transform;
+
+  // move the render target and sample buffer contents by whole pixels
+  void shift_frame( int dx, int dy );
+
+  // screen bounds (x0, y0, x1, y1, with room for antialiasing) of each
+  // primitive of the frame, computed when first needed
+  std::vector<float> frame_bounds; bool bounds_valid;
+  void primitive_bounds( const SVGScene& scene, size_t i, float* bounds );
+
+  // primitives marked dirty and pixel rectangles (x0, y0, x1, y1) to redraw
+  std::vector<size_t> dirty;
+  std::vector<int> dirty_rects;
+  void add_dirty_rect( const float* bounds );
+
+  // Scissor rectangle, in samples: writes to samples outside of it are
+  // dropped, and rasterization skips what lies outside of it.
+  int clip_x0, clip_y0, clip_x1, clip_y1;
+  void set_scissor( int x0, int y0, int x1, int y1 ); // in pixels
+  void reset_scissor( void );
+
+  // image row of the first row of the sample buffer, in samples (non-zero
+  // while drawing a band, see draw_scene_bands)
+  int band_y;
+
+  // Group opacity //
+
+  // An offscreen layer: the samples [x0, x1) x [y0, y1) of a group with an
+  // opacity below 1, premultiplied by their alpha. While a layer is open,
+  // samples are written to it and the scissor is its rectangle; closing it
+  // composites it over what is below (the sample buffer or the enclosing
+  // layer) and restores the scissor. Groups with no opacity draw straight
+  // into the sample buffer, as if there were no layers at all.
+  struct Layer {
+    float* samples; // NULL for empty layers
+    int x0, y0, x1, y1;
+    int clip[4];
+    float opacity;
+    size_t end;     // end of the primitives of a scene layer
+  };
+  std::vector<Layer> layers;
+  LayerPool layer_pool;
+
+  // the sample at (x, y), in the open layer or the sample buffer
+  float* sample( int x, int y ) {
+    if ( layers.empty() ) {
+      return super_sample_buffer + 4 * (x + (y - band_y) * target_w * sample_rate);
+    }
+    const Layer& l = layers.back();
+    return l.samples + 4 * ((x - l.x0) + (y - l.y0) * (l.x1 - l.x0));
+  }
+
+  // open a layer over the pixel bounds (x0, y0, x1, y1), within the scissor
+  void push_layer( const float* bounds, float opacity );
+  void pop_layer( void );
+
+  // drop the open layers without compositing them (cancelled frames)
+  void discard_layers( void );
+
+  // Layers of a scene: open_layers opens and closes them so that the ones
+  // around primitive i (none when i is the scene size) are open, for
+  // primitives drawn in increasing order (possibly skipping some) since
+  // the last reset_layers.
+  std::vector<float> scene_layer_bounds;
+  size_t next_layer;
+  void layer_bounds( const SVGScene& scene );
+  void reset_layers( void ) { next_layer = 0; }
+  void open_layers( const SVGScene& scene, size_t i );
+
+  // see set_cancel_flag
+  const std::atomic<bool>* cancel_flag;
+  bool cancelled( void ) const {
+    return cancel_flag && cancel_flag->load(std::memory_order_relaxed);
+  }
+
   // Rasterization //
 
+  // the raster microbenchmark (bench/raster_bench.cpp) calls these directly
+  friend struct RasterBench;
+
   // rasterize a point
   void rasterize_point( float x, float y, Color color );
 
@@ -135,9 +344,68 @@ class SoftwareRendererImp : public SoftwareRenderer {
                         float x1, float y1,
                         Texture& tex );
 
+  // A gradient set up for drawing with the current transformation: how
+  // the position in the gradient changes from sample to sample. For a
+  // linear gradient, the offset at sample (x, y) is t0 + x tx + y ty. For
+  // a radial one, the position d relative to the focus is d0 + x dx + y dy
+  // and the offset is the positive root t of a t^2 + 2 (e.d) t + d.d = 0,
+  // e being the focus relative to the center and a = e.e - r^2. Either way
+  // a row of samples is shaded by stepping the same increments.
+  struct GradientPaint {
+    const Color* lut;
+    float opacity;
+    bool radial;
+    Gradient::Spread spread;
+    float t0, tx, ty;
+    float d0[2], dx[2], dy[2], e[2], a;
+  };
+
+  // set up a gradient over the bounding box of points, false if nothing
+  // is to be painted (the box or the gradient is degenerate)
+  bool gradient_paint( const Gradient& gradient, float opacity,
+                       const Vector2D* points, size_t n, GradientPaint& paint );
+
+  // rasterize a triangle filled with a gradient, one span of samples per
+  // row
+  void rasterize_triangle( float x0, float y0,
+                           float x1, float y1,
+                           float x2, float y2,
+                           const GradientPaint& paint );
+
+  // shade the samples [x0, x1) of row y with a gradient
+  void shade_span( const GradientPaint& paint, int y, int x0, int x1 );
+
+  // An edge of a path fill, in samples: from its top y0 to its bottom y1,
+  // with x at y0 and its change per row. Its winding is 1 if it goes down
+  // and -1 if it goes up.
+  struct PathEdge {
+    float y0, y1;
+    float x0, dxdy;
+    int winding;
+  };
+
+  // kept from path to path, for their capacity
+  std::vector<PathEdge> path_edges;
+  std::vector<size_t> path_active;
+  std::vector<std::pair<float, int> > path_crossings;
+
+  // Rasterize the fill of a flattened path by scanlines: the edges of all
+  // its subpaths that cross a row of samples, sorted, split it in spans
+  // with a winding number each, and the spans inside by the fill rule are
+  // filled with the color, or shaded with paint if it is not NULL. Each
+  // sample is covered once, whichever subpath it is in.
+  void rasterize_path( const FlatPath& flat, bool evenodd,
+                       Color color, const GradientPaint* paint );
+
+  // fill the samples [x0, x1) of row y with a color
+  void fill_span( int y, int x0, int x1, Color color );
+
   // resolve samples to render target
   void resolve( void );
 
+  // resolve the samples of the pixels in [x0, x1) x [y0, y1)
+  void resolve( int x0, int y0, int x1, int y1 );
+
 }; // class SoftwareRendererImp
 
 
@@ -189,6 +457,9 @@ class SoftwareRendererRef : public SoftwareRenderer {
 
   // Rasterization //
 
+  // the raster microbenchmark (bench/raster_bench.cpp) calls these directly
+  friend struct RasterBench;
+
   // rasterize a point
   void rasterize_point( float x, float y, Color color );
 
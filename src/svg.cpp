@@ -1,10 +1,15 @@
 #include "svg.h"
 #include "png.h"
-#include "base64.h"
-
+#include "base64_decoder.h"
+#include "float_parser.h"
+#include "xml_reader.h"
+#include "profiler.h"
+
+#include <cmath>
+#include <atomic>
+#include <cctype>
+#include <cstring>
 #include <string>
-#include <fstream>
-#include <sstream>
 #include <iostream>
 #include <algorithm>
 
@@ -14,50 +19,384 @@ using namespace std;
 
 namespace CMU462 {
 
-Group::~Group() {
+Group::~Group() { }
+
+uint64_t Path::new_id() {
+  static std::atomic<uint64_t> next ( 1 );
+  return next++;
+}
+
+void Gradient::update() {
+
+  // between two stops the color is interpolated, past the ends it is the
+  // end color, and without stops nothing is painted
+  size_t k = 0;
+  Color sum ( 0, 0, 0, 0 );
+  for ( size_t i = 0; i < LUT_SIZE; ++i ) {
+    float t = (float) i / (LUT_SIZE - 1);
+    while ( k < stops.size() && stops[k].offset <= t ) k++;
+    Color& c = lut[i];
+    if ( stops.empty() ) {
+      c = Color( 0, 0, 0, 0 );
+    } else if ( k == 0 ) {
+      c = stops[0].color;
+    } else if ( k == stops.size() ) {
+      c = stops[k - 1].color;
+    } else {
+      const GradientStop& a = stops[k - 1];
+      const GradientStop& b = stops[k];
+      float u = (t - a.offset) / (b.offset - a.offset);
+      c = a.color * (1 - u) + b.color * u;
+    }
+    sum = sum + c;
+  }
+  average = sum * (1.0f / LUT_SIZE);
+}
+
+// where an element that can fill with a gradient keeps it
+static shared_ptr<const Gradient>* gradientSlot( SVGElement* element ) {
+  switch ( element->type ) {
+    case RECT:    return &static_cast<Rect*>   (element)->gradient;
+    case POLYGON: return &static_cast<Polygon*>(element)->gradient;
+    case PATH:    return &static_cast<Path*>   (element)->gradient;
+    default:      return NULL;
+  }
+}
+
+const Gradient* fillGradient( const SVGElement* element ) {
+  shared_ptr<const Gradient>* slot = gradientSlot( const_cast<SVGElement*>(element) );
+  return slot ? slot->get() : NULL;
+}
+
+// Run the destructors of the elements that own memory outside the arena
+// (point arrays, textures, child lists). The others have nothing to free
+// and are dropped with the arena.
+static void destroyElements( vector<SVGElement*>& elements ) {
   for (size_t i = 0; i < elements.size(); i++) {
-    delete elements[i];
-  } elements.clear();
+    SVGElement* element = elements[i];
+    switch (element->type) {
+      case GROUP:
+        destroyElements( static_cast<Group*>(element)->elements );
+        element->~SVGElement();
+        break;
+      case POLYLINE:
+      case RECT:
+      case POLYGON:
+      case IMAGE:
+      case PATH:
+        element->~SVGElement();
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void SVG::clear() {
+  destroyElements( elements );
+  elements.clear();
+  arena.release();
 }
 
 SVG::~SVG() {
-  for (size_t i = 0; i < elements.size(); i++) {
-    delete elements[i];
-  } elements.clear();
+  destroyElements( elements );
 }
 
 // Parser //
 
-int SVGParser::load( const char* filename, SVG* svg ) {
+// numeric attribute, or value if there is none
+static float floatAttribute( XMLElement* xml, const char* name, float value = 0 ) {
+  const char* text = xml->Attribute( name );
+  if ( text ) parse_float( text, value );
+  return value;
+}
+
+// coordinate pairs of a points attribute, scanned in place
+static void parsePoints( const char* text, vector<Vector2D>& points ) {
+
+  if ( !text ) return;
+
+  // one point per comma in the usual "x,y x,y" form, one per two
+  // whitespace separated numbers otherwise
+  size_t commas = 0, spaces = 0;
+  for (const char* p = text; *p; p++) {
+    commas += *p == ',';
+    spaces += *p == ' ';
+  }
+  points.reserve( points.size() + (commas ? commas : spaces / 2 + 1) );
+
+  float x, y;
+  const char* p = text;
+  while ( (p = parse_float( p, x )) ) {
+    p = parse_float( skip_separator( p ), y );
+    if ( !p ) break;
+    points.push_back( Vector2D( x, y ) );
+    p = skip_separator( p );
+  }
+}
+
+// Gradients //
+
+typedef map<string, shared_ptr<Gradient> > GradientMap;
+
+static Matrix3x3 parseTransform( const char* trans );
+
+// a gradient length: a number, or a percentage of size
+static float gradientLength( XMLElement* xml, const char* name, float value,
+                             float size ) {
+  const char* text = xml->Attribute( name );
+  if ( !text ) return value;
+  const char* end = parse_float( text, value );
+  if ( end && *end == '%' ) value = value / 100 * size;
+  return value;
+}
+
+// the value of a property in a style attribute ("name: value; ...")
+static bool styleProperty( const char* style, const char* name, string& value ) {
+
+  size_t length = strlen( name );
+  for ( const char* p = style; p && *p; ) {
+    while ( isspace(*p) || *p == ';' ) p++;
+    const char* end = strchr( p, ';' );
+    if ( !end ) end = p + strlen( p );
+    if ( !strncmp( p, name, length ) ) {
+      const char* v = p + length;
+      while ( isspace(*v) ) v++;
+      if ( *v == ':' ) {
+        v++;
+        while ( isspace(*v) ) v++;
+        const char* v_end = end;
+        while ( v_end > v && isspace(v_end[-1]) ) v_end--;
+        value.assign( v, v_end );
+        return true;
+      }
+    }
+    p = end;
+  }
+  return false;
+}
+
+// A linearGradient or radialGradient, registered by its id. What it does
+// not set is taken from the gradient it links to (xlink:href) if that one
+// was defined before, and otherwise has the SVG defaults.
+static shared_ptr<Gradient> parseGradient( XMLElement* xml, Gradient::Type type,
+                                           GradientMap& gradients,
+                                           float width, float height ) {
+
+  shared_ptr<Gradient> gradient = make_shared<Gradient>();
+
+  const char* href = xml->Attribute( "xlink:href" );
+  if ( !href ) href = xml->Attribute( "href" );
+  GradientMap::iterator link = href && *href == '#' ? gradients.find( href + 1 )
+                                                    : gradients.end();
+  bool linked = link != gradients.end();
+  if ( linked ) *gradient = *link->second;
+  gradient->type = type;
+
+  const char* units = xml->Attribute( "gradientUnits" );
+  if ( units ) gradient->userSpace = !strcmp( units, "userSpaceOnUse" );
+
+  const char* spread = xml->Attribute( "spreadMethod" );
+  if ( spread ) {
+    gradient->spread = !strcmp( spread, "reflect" ) ? Gradient::REFLECT :
+                       !strcmp( spread, "repeat" )  ? Gradient::REPEAT  :
+                                                      Gradient::PAD;
+  }
+
+  const char* trans = xml->Attribute( "gradientTransform" );
+  if ( trans ) gradient->transform = parseTransform( trans );
+
+  // percentages, and the defaults, are of the viewport in user space
+  float w = gradient->userSpace ? width  : 1;
+  float h = gradient->userSpace ? height : 1;
+  float d = sqrt( (w * w + h * h) / 2 );
+  if ( !linked && gradient->userSpace ) {
+    gradient->end    = Vector2D( w, 0 );
+    gradient->center = gradient->focus = Vector2D( w / 2, h / 2 );
+    gradient->radius = d / 2;
+  }
+
+  if ( type == Gradient::LINEAR ) {
+    Vector2D& a = gradient->start;
+    Vector2D& b = gradient->end;
+    a = Vector2D( gradientLength( xml, "x1", a.x, w ), gradientLength( xml, "y1", a.y, h ) );
+    b = Vector2D( gradientLength( xml, "x2", b.x, w ), gradientLength( xml, "y2", b.y, h ) );
+  } else {
+    Vector2D& c = gradient->center;
+    c = Vector2D( gradientLength( xml, "cx", c.x, w ), gradientLength( xml, "cy", c.y, h ) );
+    gradient->radius = gradientLength( xml, "r", gradient->radius, d );
+
+    // the focus is the center unless set
+    Vector2D& f = gradient->focus;
+    f = Vector2D( gradientLength( xml, "fx", xml->Attribute( "fx" ) ? f.x : c.x, w ),
+                  gradientLength( xml, "fy", xml->Attribute( "fy" ) ? f.y : c.y, h ) );
+  }
+
+  const char* id = xml->Attribute( "id" );
+  if ( id ) gradients[id] = gradient;
+  return gradient;
+}
+
+// a stop of a gradient, after those it has (offsets do not go back)
+static void parseStop( XMLElement* xml, Gradient& gradient ) {
+
+  GradientStop stop;
+  stop.offset = min( max( gradientLength( xml, "offset", 0, 1 ), 0.0f ), 1.0f );
+  if ( !gradient.stops.empty() ) {
+    stop.offset = max( stop.offset, gradient.stops.back().offset );
+  }
+
+  // the style attribute comes before presentation attributes
+  string color = "#000000", opacity;
+  const char* style = xml->Attribute( "style" );
+  if ( !styleProperty( style, "stop-color", color ) &&
+       xml->Attribute( "stop-color" ) ) {
+    color = xml->Attribute( "stop-color" );
+  }
+  if ( !styleProperty( style, "stop-opacity", opacity ) &&
+       xml->Attribute( "stop-opacity" ) ) {
+    opacity = xml->Attribute( "stop-opacity" );
+  }
+
+  stop.color = Color::fromHex( color.c_str() );
+  float alpha = 1;
+  parse_float( opacity.c_str(), alpha );
+  stop.color.a = min( max( alpha, 0.0f ), 1.0f );
+  gradient.stops.push_back( stop );
+}
+
+// what follows "url(" in a paint attribute (fill or stroke), NULL if the
+// paint is not a reference
+static const char* paintURL( const char* paint ) {
+  if ( !paint ) return NULL;
+  while ( isspace(*paint) ) paint++;
+  return strncmp( paint, "url(", 4 ) ? NULL : paint + 4;
+}
+
+// the gradient a reference ("#id)") is to, none if it is not defined
+static shared_ptr<const Gradient> findGradient( const char* url,
+                                               const GradientMap& gradients ) {
+  while ( isspace(*url) ) url++;
+  if ( *url++ != '#' ) return shared_ptr<const Gradient>();
+  const char* end = url;
+  while ( *end && *end != ')' && !isspace(*end) ) end++;
+  GradientMap::const_iterator it = gradients.find( string( url, end ) );
+  return it == gradients.end() ? shared_ptr<const Gradient>() : it->second;
+}
+
+// Fill and stroke gradients of an element (see fillGradient). Strokes,
+// and fills of elements that do not take gradients, are painted with the
+// average color of the gradient, and references to gradients that are not
+// defined (yet) paint nothing.
+static void resolvePaint( XMLElement* xml, SVGElement* element,
+                          const GradientMap& gradients ) {
+
+  shared_ptr<const Gradient>* slot = gradientSlot( element );
+  if ( slot ) slot->reset();
+
+  const char* names[2] = { "fill", "stroke" };
+  for ( int i = 0; i < 2; ++i ) {
+
+    const char* url = paintURL( xml->Attribute( names[i] ) );
+    if ( !url ) continue;
+
+    shared_ptr<const Gradient> gradient = findGradient( url, gradients );
+    float opacity = floatAttribute( xml, i ? "stroke-opacity" : "fill-opacity", 1 );
+    Color& color = i ? element->style.strokeColor : element->style.fillColor;
+    if ( !gradient ) {
+      color = Color( 0, 0, 0, 0 );
+    } else if ( i == 0 && slot ) {
+      color = gradient->average;
+      color.a = opacity;
+      *slot = gradient;
+    } else {
+      color = gradient->average;
+      color.a *= opacity;
+    }
+  }
+}
+
+// Handler building the element tree of a svg, in its arena
+class SVGBuilder : public SVGHandler {
+ public:
+
+  SVGBuilder( SVG* svg ) : svg ( svg ) {
+    parents.push_back( &svg->elements );
+  }
+
+  int begin_svg( float width, float height ) {
+    svg->width  = width;
+    svg->height = height;
+    return 0;
+  }
 
-  ifstream in( filename );
-  if( !in.is_open() ) {
-     return -1;
+  int begin_group( Group* group ) {
+    Group* copy = svg->arena.create<Group>();
+    copy->style     = group->style;
+    copy->transform = group->transform;
+    copy->opacity   = group->opacity;
+    parents.back()->push_back( copy );
+    parents.push_back( &copy->elements );
+    return 0;
   }
-  in.close();
 
-  XMLDocument doc;
-  doc.LoadFile( filename );
-  if( doc.Error() ) {
-     doc.PrintError();
-     exit( 1 );
+  int end_group( Group* /*group*/ ) {
+    parents.pop_back();
+    return 0;
   }
 
-  XMLElement* root = doc.FirstChildElement( "svg" );
-  if( !root ) {
-     cerr << "Error: not an SVG file!" << endl;
-     exit( 1 );
+  int element( SVGElement* element ) {
+    SVGElement* copy = NULL;
+    switch ( element->type ) {
+      case POINT:    copy = take<Point>   ( element ); break;
+      case LINE:     copy = take<Line>    ( element ); break;
+      case POLYLINE: copy = take<Polyline>( element ); break;
+      case RECT:     copy = take<Rect>    ( element ); break;
+      case POLYGON:  copy = take<Polygon> ( element ); break;
+      case ELLIPSE:  copy = take<Ellipse> ( element ); break;
+      case IMAGE:    copy = take<Image>   ( element ); break;
+      case PATH:     copy = take<Path>    ( element ); break;
+      default: return 0;
+    }
+    parents.back()->push_back( copy );
+    return 0;
   }
 
-  root->QueryFloatAttribute( "width",  &svg->width  );
-  root->QueryFloatAttribute( "height", &svg->height );
+ private:
+
+  SVG* svg;
+  vector<vector<SVGElement*>*> parents;
+
+  // move the element (its points, its texture) into the arena
+  template<typename T> T* take( SVGElement* element ) {
+    T* copy = svg->arena.create<T>();
+    *copy = std::move( *static_cast<T*>(element) );
+    return copy;
+  }
 
-  parseSVG( root, svg );
+};
+
+int SVGParser::load( const char* filename, SVG* svg ) {
+
+  SVGBuilder builder( svg );
+  if ( stream( filename, builder ) ) {
+    svg->clear();
+    return -1;
+  }
 
   return 0;
 }
 
-void SVGParser::parseSVG( XMLElement* xml, SVG* svg ) {
+// reset a reused element to the state of a new one
+template<typename T> static T* reuse( T& element ) {
+  element.style = Style();
+  element.transform = Matrix3x3::identity();
+  return &element;
+}
+
+int SVGParser::stream( const char* filename, SVGHandler& handler ) {
+
+  PROFILE_SCOPE("parse");
 
   /* NOTE (sky):
    * SVG uses a "painters model" when drawing elements. Elements 
@@ -67,395 +406,686 @@ void SVGParser::parseSVG( XMLElement* xml, SVG* svg ) {
    * order when drawing elements.
    */
 
-  XMLElement* elem = xml->FirstChildElement();
-  while( elem ) {
+  /* NOTE (sky):
+   * A group contains a list of elements, and optionally a transformation
+   * to apply to all the elements it contains. Elements in a group follow
+   * the same draw order as elements in a svg (top to bottom).  
+   * A group should be considered as one single element outside its scope.
+   * This means at draw time, all elements in a group should be drawn before 
+   * elements outside the group. All elements in the group inherits the group
+   * transformation, and keep in mind that transformation is accumulative.
+   * Groups can also be nested.  
+   */
+
+  FILE* file = fopen( filename, "rb" );
+  if ( !file ) return -1;
 
-    string elementType ( elem->Value() );
-    if( elementType == "line" ) {
+  XMLTagReader reader( file );
 
-      Line* line = new Line();
-      parseElement(elem, line );
-      parseLine( elem, line );
-      svg->elements.push_back( line );
+  // Tags are read one at a time. The attributes of each element are
+  // parsed by handing its tag, as an empty element, to tinyxml2, so that
+  // only one element is ever held as a DOM.
+  XMLDocument doc; string tag;
 
-    } else if( elementType == "polyline" ) {
+  // names of the open elements, how many of the innermost ones are
+  // skipped (unknown elements and the content of primitives), and the
+  // open groups
+  vector<string> open; size_t skipped = 0;
+  vector<Group*> groups; size_t num_groups = 0;
 
-      Polyline* polyline = new Polyline();
-      parseElement(elem, polyline );
-      parsePolyline( elem, polyline );
-      svg->elements.push_back( polyline );
+  // Gradients defined so far, by id, and the one whose stops are being
+  // read. Nothing is drawn inside definitions (defs or a gradient).
+  GradientMap gradients;
+  shared_ptr<Gradient> gradient; size_t stops = 0;
+  size_t defs = 0;
+  float width = 0, height = 0;
 
-    } else if( elementType == "rect" ) {
+  // one reusable element per primitive type
+  Point point; Line line; Polyline polyline; Rect rect;
+  Polygon polygon; Ellipse ellipse; Image image; Path path;
 
-      float w = elem->FloatAttribute("width" );
-      float h = elem->FloatAttribute("height");
+  int status = 0;
+  while ( status == 0 ) {
+
+    const char* text; size_t length;
+    XMLTagType type = reader.next( text, length );
+
+    if ( type == XML_TAG_EOF ) {
+      cerr << "Error: unexpected end of file in " << filename << endl;
+      status = -1; break;
+    }
+    if ( type == XML_TAG_ERROR ) {
+      cerr << "Error: unterminated markup in " << filename << endl;
+      status = -1; break;
+    }
+
+    // element name
+    const char* name_begin = text + (type == XML_TAG_END ? 2 : 1);
+    const char* name_end = name_begin;
+    while ( name_end < text + length && !isspace(*name_end) &&
+            *name_end != '/' && *name_end != '>' ) name_end++;
+    string name ( name_begin, name_end );
+
+    if ( type == XML_TAG_END ) {
+
+      if ( open.empty() || open.back() != name ) {
+        cerr << "Error: mismatched end tag </" << name << "> in " << filename << endl;
+        status = -1; break;
+      }
+      open.pop_back();
+
+      if ( skipped ) {
+        skipped--;
+      } else if ( open.empty() ) {
+        status = handler.end_svg();
+        break;
+      } else if ( name == "defs" ) {
+        defs--;
+      } else if ( gradient ) {
+        gradient->update();
+        gradient.reset();
+      } else {
+        status = handler.end_group( groups[--num_groups] );
+      }
+      continue;
+    }
+
+    bool empty = type == XML_TAG_EMPTY;
+    if ( skipped ) {
+      if ( !empty ) { open.push_back( name ); skipped++; }
+      continue;
+    }
+
+    tag.assign( text, length - (empty ? 2 : 1) );
+    tag += "/>";
+    doc.Parse( tag.c_str(), tag.size() );
+    XMLElement* elem = doc.RootElement();
+    if ( doc.Error() || !elem ) {
+      cerr << "Error: invalid tag <" << name << "> in " << filename << endl;
+      status = -1; break;
+    }
+
+    // root
+    if ( open.empty() ) {
+
+      if ( name != "svg" ) {
+        cerr << "Error: not an SVG file!" << endl;
+        status = -1; break;
+      }
+
+      width  = floatAttribute( elem, "width"  );
+      height = floatAttribute( elem, "height" );
+      status = handler.begin_svg( width, height );
+      if ( empty ) {
+        if ( status == 0 ) status = handler.end_svg();
+        break;
+      }
+      open.push_back( name );
+      continue;
+    }
+
+    // definitions
+    if ( name == "defs" ) {
+      if ( !empty ) { open.push_back( name ); defs++; }
+      continue;
+    }
+
+    if ( !gradient && (name == "linearGradient" || name == "radialGradient") ) {
+      gradient = parseGradient( elem, name == "linearGradient" ? Gradient::LINEAR
+                                                               : Gradient::RADIAL,
+                                gradients, width, height );
+      stops = 0;
+      if ( empty ) {
+        gradient->update();
+        gradient.reset();
+      } else {
+        open.push_back( name );
+      }
+      continue;
+    }
+
+    if ( gradient && name == "stop" ) {
+      // stops of its own replace those of a linked gradient
+      if ( stops++ == 0 ) gradient->stops.clear();
+      parseStop( elem, *gradient );
+      if ( !empty ) { open.push_back( name ); skipped++; }
+      continue;
+    }
+
+    bool drawn = !defs && !gradient;
+
+    // groups stay open until their end tag
+    if ( drawn && name == "g" ) {
+
+      if ( num_groups == groups.size() ) groups.push_back( new Group() );
+      Group* group = reuse( *groups[num_groups++] );
+      parseElement( elem, group );
+      group->opacity = min(max(floatAttribute( elem, "opacity", 1 ), 0.0f), 1.0f);
+
+      status = handler.begin_group( group );
+      if ( empty ) {
+        num_groups--;
+        if ( status == 0 ) status = handler.end_group( group );
+      } else {
+        open.push_back( name );
+      }
+      continue;
+    }
+
+    // primitives
+    SVGElement* element = NULL;
+    if ( !drawn ) {
+       // definitions are not drawn
+    } else if( name == "line" ) {
+
+      element = reuse( line );
+      parseElement( elem, &line );
+      parseLine( elem, &line );
+
+    } else if( name == "polyline" ) {
+
+      element = reuse( polyline );
+      polyline.points.clear();
+      parseElement( elem, &polyline );
+      parsePolyline( elem, &polyline );
+
+    } else if( name == "rect" ) {
+
+      float w = floatAttribute( elem, "width" );
+      float h = floatAttribute( elem, "height" );
 
       // treat zero-size rectangles as points
       if (w == 0 && h == 0) {
-        Point* point = new Point();
-        parseElement(elem, point );
-        parsePoint( elem, point );
-        svg->elements.push_back( point );
+        element = reuse( point );
+        parseElement( elem, &point );
+        parsePoint( elem, &point );
       } else {
-        Rect* rect = new Rect();
-        parseElement( elem, rect );
-        parseRect( elem, rect );
-        svg->elements.push_back( rect );
+        element = reuse( rect );
+        parseElement( elem, &rect );
+        parseRect( elem, &rect );
       }
 
-    } else if( elementType == "polygon" ) {
+    } else if( name == "polygon" ) {
 
-      Polygon* polygon = new Polygon();
-      parseElement( elem, polygon);
-      parsePolygon( elem, polygon );
-      svg->elements.push_back( polygon );
+      element = reuse( polygon );
+      polygon.points.clear();
+      parseElement( elem, &polygon );
+      parsePolygon( elem, &polygon );
 
-    } else if( elementType == "ellipse" ) {
+    } else if( name == "ellipse" ) {
 
-      Ellipse* ellipse = new Ellipse();
-      parseElement( elem, ellipse);
-      parseEllipse( elem, ellipse );
-      svg->elements.push_back( ellipse );
+      element = reuse( ellipse );
+      parseElement( elem, &ellipse );
+      parseEllipse( elem, &ellipse );
 
-    } else if ( elementType == "image" ) {
+    } else if ( name == "image" ) {
 
-      Image* image = new Image();
-      parseElement( elem, image);
-      parseImage( elem, image);
-      svg->elements.push_back( image ); 
+      element = reuse( image );
+      image.tex.mipmap.clear();
+      parseElement( elem, &image );
+      parseImage( elem, &image );
 
-    } else if( elementType == "g" ) {
+    } else if ( name == "path" ) {
 
-       Group* group = new Group();
-       parseElement( elem, group);
-       parseGroup( elem, group );
-       svg->elements.push_back( group );
+      element = reuse( path );
+      path.commands.clear();
+      path.points.clear();
+      path.changed();
+      parseElement( elem, &path );
+      parsePath( elem, &path );
 
     } else {
        // unknown element type --- include default handler here if desired
     }
 
-    elem = elem->NextSiblingElement();
-  }
-}
+    if ( element ) {
+      resolvePaint( elem, element, gradients );
+      status = handler.element( element );
+    }
 
-void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
+    // the content of primitives and unknown elements is ignored
+    if ( !empty ) { open.push_back( name ); skipped++; }
+  }
 
-  // parse style
-  Style* style = &element->style;
-  const char* fill = xml->Attribute( "fill" );
-  if( fill ) style->fillColor = Color::fromHex( fill );
+  for ( size_t i = 0; i < groups.size(); ++i ) delete groups[i];
+  fclose( file );
 
-  const char* fill_opacity = xml->Attribute( "fill-opacity" );
-  if( fill_opacity ) style->fillColor.a = atof( fill_opacity );
+  return status;
+}
 
-  const char* stroke = xml->Attribute( "stroke" );
-  const char* stroke_opacity = xml->Attribute( "stroke-opacity" );
-  if( stroke ) {
-    style->strokeColor = Color::fromHex( stroke );
-    if( stroke_opacity ) style->strokeColor.a = atof( stroke_opacity );
-  } else {
-    style->strokeColor = Color::Black;
-    style->strokeColor.a = 0;
-  }
+// a transform attribute (or gradientTransform) as a matrix
+static Matrix3x3 parseTransform( const char* trans ) {
 
+  // NOTE (sky):
+  // This implements the SVG transformation specification. All the SVG 
+  // transformations are supported as documented in the link below:
+  // https://developer.mozilla.org/en-US/docs/Web/SVG/Attribute/transform
 
-  xml->QueryFloatAttribute( "stroke-width",      &style->strokeWidth );
-  xml->QueryFloatAttribute( "stroke-miterlimit", &style->miterLimit  );
+  // consolidate transformation
+  Matrix3x3 transform = Matrix3x3::identity();
 
-  // parse transformation
-  const char* trans = xml->Attribute( "transform" );
-  if ( trans ) {
-    
-    // NOTE (sky):
-    // This implements the SVG transformation specification. All the SVG 
-    // transformations are supported as documented in the link below:
-    // https://developer.mozilla.org/en-US/docs/Web/SVG/Attribute/transform
+  // the list is scanned in place: a name, then up to six numbers
+  // between parentheses, with comma-wsp separators everywhere
+  const char* p = trans;
+  while ( true ) {
 
-    // consolidate transformation
-    Matrix3x3 transform = Matrix3x3::identity();
+    p = skip_separator(p);
+    const char* name = p;
+    while ( isalpha(*p) ) p++;
+    size_t name_length = p - name;
+    if ( !name_length ) break;
 
-    string trans_str = trans; size_t paren_l, paren_r;
-    while ( trans_str.find_first_of('(') != string::npos ) {
+    while ( isspace(*p) ) p++;
+    if ( *p != '(' ) break;
+    p++;
 
-      paren_l = trans_str.find_first_of('(');
-      paren_r = trans_str.find_first_of(')');
+    float args[6]; size_t n = 0;
+    const char* next;
+    while ( n < 6 && (next = parse_float(p, args[n])) ) {
+      n++; p = skip_separator(next);
+    }
 
-      string type = trans_str.substr(0, paren_l);
-      string data = trans_str.substr(paren_l + 1, paren_r - paren_l - 1);
+    while ( isspace(*p) ) p++;
+    if ( *p != ')' ) break;
+    p++;
 
-      if ( type == "matrix" ) {
-        
-        string matrix_str = data;
-        replace( matrix_str.begin(), matrix_str.end(), ',', ' ');
+    string type (name, name_length);
+    if ( type == "matrix" ) {
 
-        stringstream ss (matrix_str);
-        float a; float b; float c; float d; float e; float f;
-        ss >> a; ss >> b; ss >> c; ss >> d; ss >> e; ss >> f;
+      float a = 0, b = 0, c = 0, d = 0, e = 0, f = 0;
+      if ( n == 6 ) {
+        a = args[0]; b = args[1]; c = args[2];
+        d = args[3]; e = args[4]; f = args[5];
+      }
 
-        Matrix3x3 m;
-        m(0,0) = a; m(0,1) = c; m(0,2) = e;
-        m(1,0) = b; m(1,1) = d; m(1,2) = f;
-        m(2,0) = 0; m(2,1) = 0; m(2,2) = 1;        
-        transform = transform * m;
+      Matrix3x3 m;
+      m(0,0) = a; m(0,1) = c; m(0,2) = e;
+      m(1,0) = b; m(1,1) = d; m(1,2) = f;
+      m(2,0) = 0; m(2,1) = 0; m(2,2) = 1;        
+      transform = transform * m;
+    
+    } else if ( type == "translate" ) {
       
-      } else if ( type == "translate" ) {
-        
-        stringstream ss (data);
-        float x; if (!(ss >> x)) x = 0;
-        float y; if (!(ss >> y)) y = 0;
+      float x = n > 0 ? args[0] : 0;
+      float y = n > 1 ? args[1] : 0;
 
-        Matrix3x3 m = Matrix3x3::identity();
-        
-        m(0,2) = x;
-        m(1,2) = y;
-        
-        transform = transform * m;
+      Matrix3x3 m = Matrix3x3::identity();
+      
+      m(0,2) = x;
+      m(1,2) = y;
+      
+      transform = transform * m;
 
-      } else if (type == "scale" ) {
+    } else if (type == "scale" ) {
 
-        stringstream ss (data);
-        float x; if (!(ss >> x)) x = 1;
-        float y; if (!(ss >> y)) y = 1;
+      // a single scale factor scales both axes
+      float x = n > 0 ? args[0] : 1;
+      float y = n > 1 ? args[1] : x;
 
-        Matrix3x3 m = Matrix3x3::identity();
-        
-        m(0,0) = x;
-        m(1,1) = y;
+      Matrix3x3 m = Matrix3x3::identity();
+      
+      m(0,0) = x;
+      m(1,1) = y;
 
-        transform = transform * m;
+      transform = transform * m;
 
-      } else if (type == "rotate") {
+    } else if (type == "rotate") {
 
-        stringstream ss (data);
-        float a; if (!(ss >> a)) a = 0;
-        float x; if (!(ss >> x)) x = 0;
-        float y; if (!(ss >> y)) y = 0;
+      float a = n > 0 ? args[0] : 0;
+      float x = n > 1 ? args[1] : 0;
+      float y = n > 2 ? args[2] : 0;
 
-        if ( x != 0 || y != 0 ) {
+      if ( x != 0 || y != 0 ) {
 
-          Matrix3x3 m = Matrix3x3::identity();
+        Matrix3x3 m = Matrix3x3::identity();
 
-          m(0,0) = cos(a*PI/180.0f); m(0,1) = -sin(a*PI/180.0f);
-          m(1,0) = sin(a*PI/180.0f); m(1,1) =  cos(a*PI/180.0f);
+        m(0,0) = cos(a*PI/180.0f); m(0,1) = -sin(a*PI/180.0f);
+        m(1,0) = sin(a*PI/180.0f); m(1,1) =  cos(a*PI/180.0f);
 
-          m(0,2) = -x * cos(a*PI/180.0f) + y * sin(a*PI/180.0f) + x;
-          m(1,2) = -x * sin(a*PI/180.0f) - y * cos(a*PI/180.0f) + y;
+        m(0,2) = -x * cos(a*PI/180.0f) + y * sin(a*PI/180.0f) + x;
+        m(1,2) = -x * sin(a*PI/180.0f) - y * cos(a*PI/180.0f) + y;
 
-          transform = transform * m;
+        transform = transform * m;
 
-        } else {
-          
-          Matrix3x3 m = Matrix3x3::identity();
-          
-          m(0,0) = cos(a*PI/180.0f); m(0,1) = -sin(a*PI/180.0f);
-          m(1,0) = sin(a*PI/180.0f); m(1,1) =  cos(a*PI/180.0f);
-          
-          transform = transform * m;
-        }
+      } else {
         
-      } else if (type == "skewX" ) {
-
-        stringstream ss (data);
-        float a; ss >> a;
-
         Matrix3x3 m = Matrix3x3::identity();
         
-        m(0,1) = tan(a*PI/180.0f);
-
+        m(0,0) = cos(a*PI/180.0f); m(0,1) = -sin(a*PI/180.0f);
+        m(1,0) = sin(a*PI/180.0f); m(1,1) =  cos(a*PI/180.0f);
+        
         transform = transform * m;
+      }
+      
+    } else if (type == "skewX" ) {
 
-      } else if (type == "skewY" ) {
+      float a = n > 0 ? args[0] : 0;
 
-        stringstream ss (data);
-        float a; ss >> a;
+      Matrix3x3 m = Matrix3x3::identity();
+      
+      m(0,1) = tan(a*PI/180.0f);
 
-        Matrix3x3 m = Matrix3x3::identity();
-        
-        m(1,0) = tan(a*PI/180.0f);
+      transform = transform * m;
 
-        transform = transform * m;
+    } else if (type == "skewY" ) {
 
-      } else {
-        cerr << "unknown transformation type: " << type << endl;
-      }
+      float a = n > 0 ? args[0] : 0;
+
+      Matrix3x3 m = Matrix3x3::identity();
+      
+      m(1,0) = tan(a*PI/180.0f);
+
+      transform = transform * m;
 
-      size_t end = paren_r + 2;
-      trans_str.erase(0, end);
+    } else {
+      cerr << "unknown transformation type: " << type << endl;
     }
+  }
 
-    element->transform = transform;
+  return transform;
+}
+
+void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
+
+  // parse style
+  Style* style = &element->style;
+  const char* fill = xml->Attribute( "fill" );
+  if( fill ) style->fillColor = Color::fromHex( fill );
+
+  const char* fill_opacity = xml->Attribute( "fill-opacity" );
+  if( fill_opacity ) parse_float( fill_opacity, style->fillColor.a );
+
+  const char* stroke = xml->Attribute( "stroke" );
+  const char* stroke_opacity = xml->Attribute( "stroke-opacity" );
+  if( stroke ) {
+    style->strokeColor = Color::fromHex( stroke );
+    if( stroke_opacity ) parse_float( stroke_opacity, style->strokeColor.a );
+  } else {
+    style->strokeColor = Color::Black;
+    style->strokeColor.a = 0;
   }
+
+
+  style->strokeWidth = floatAttribute( xml, "stroke-width",      style->strokeWidth );
+  style->miterLimit  = floatAttribute( xml, "stroke-miterlimit", style->miterLimit  );
+
+  // parse transformation
+  const char* trans = xml->Attribute( "transform" );
+  if ( trans ) element->transform = parseTransform( trans );
 }   
 
 
 void SVGParser::parsePoint( XMLElement* xml, Point* point ) {
-  point->position = Vector2D(xml->FloatAttribute( "x" ),
-                             xml->FloatAttribute( "y" ));
+  point->position = Vector2D(floatAttribute( xml, "x" ),
+                             floatAttribute( xml, "y" ));
 }
 
 void SVGParser::parseLine( XMLElement* xml, Line* line ) {
-  line->from = Vector2D(xml->FloatAttribute( "x1" ),
-                        xml->FloatAttribute( "y1" ));
-  line->to   = Vector2D(xml->FloatAttribute( "x2" ),
-                        xml->FloatAttribute( "y2" ));
+  line->from = Vector2D(floatAttribute( xml, "x1" ),
+                        floatAttribute( xml, "y1" ));
+  line->to   = Vector2D(floatAttribute( xml, "x2" ),
+                        floatAttribute( xml, "y2" ));
 }
 
 void SVGParser::parsePolyline( XMLElement* xml, Polyline* polyline ) {
 
-  stringstream points (xml->Attribute( "points" ));
-
-  float x, y;
-  char c;
-
-  while( points >> x >> c >> y ) {
-     polyline->points.push_back( Vector2D( x, y ) );
-  }
+  parsePoints( xml->Attribute( "points" ), polyline->points );
 }
 
 void SVGParser::parseRect( XMLElement* xml, Rect* rect ) {
-  rect->position  = Vector2D(xml->FloatAttribute( "x" ),
-                             xml->FloatAttribute( "y" ));
-  rect->dimension = Vector2D(xml->FloatAttribute( "width"  ),
-                             xml->FloatAttribute( "height" ));
+  rect->position  = Vector2D(floatAttribute( xml, "x" ),
+                             floatAttribute( xml, "y" ));
+  rect->dimension = Vector2D(floatAttribute( xml, "width" ),
+                             floatAttribute( xml, "height" ));
 }
 
 void SVGParser::parsePolygon( XMLElement* xml, Polygon* polygon ) {
 
-  stringstream points (xml->Attribute( "points" ));
-
-  float x, y;
-  char c;
-
-  while( points >> x >> c >> y ) {
-     polygon->points.push_back( Vector2D( x, y ) );
-  }
+  parsePoints( xml->Attribute( "points" ), polygon->points );
 }
 
 void SVGParser::parseEllipse( XMLElement* xml, Ellipse* ellipse ) {
-  ellipse->center = Vector2D(xml->FloatAttribute( "cx" ),
-                             xml->FloatAttribute( "cy" ));
+  ellipse->center = Vector2D(floatAttribute( xml, "cx" ),
+                             floatAttribute( xml, "cy" ));
 
-  ellipse->radius = Vector2D(xml->FloatAttribute( "rx" ),
-                             xml->FloatAttribute( "ry" ));
+  ellipse->radius = Vector2D(floatAttribute( xml, "rx" ),
+                             floatAttribute( xml, "ry" ));
 }
 
 void SVGParser::parseImage( XMLElement* xml, Image* image ) {
-  image->position  = Vector2D ( xml->FloatAttribute( "x" ),
-                                xml->FloatAttribute( "y" ));
-  image->dimension = Vector2D ( xml->FloatAttribute( "width"  ),
-                                xml->FloatAttribute( "height" )); 
+  image->position  = Vector2D ( floatAttribute( xml, "x" ),
+                                floatAttribute( xml, "y" ));
+  image->dimension = Vector2D ( floatAttribute( xml, "width" ),
+                                floatAttribute( xml, "height" )); 
 
-  // read png data
+  // read png data, the base64 text after the comma of the data uri.
+  // Without it there is nothing to decode and the image is not drawn.
   const char* data = xml->Attribute( "xlink:href" );
-  while (*data != ',') data++; data++;
-  
-  // decode base64 encoded data
-  string encoded = data;
-  encoded.erase(remove(encoded.begin(), encoded.end(), ' ' ), encoded.end());
-  encoded.erase(remove(encoded.begin(), encoded.end(), '\t'), encoded.end());
-  encoded.erase(remove(encoded.begin(), encoded.end(), '\n'), encoded.end());
-  string decoded = base64_decode(encoded);
-
-  // load decoded data into buffer
-  const unsigned char* buffer = (unsigned char*) decoded.c_str(); 
-  size_t size = decoded.size();
-
-  // load into png
-  PNG png; PNGParser::load(buffer, size, png);
-  
+  if ( data ) data = strchr( data, ',' );
+  if ( !data ) return;
+  data++;
+
+  // decode base64 encoded data, skipping whitespace. The buffer is kept
+  // around (per thread) so that large images do not reallocate every time.
+  static thread_local vector<unsigned char> decoded;
+  size_t size = 0;
+  if (base64_decode_into(decoded, size, data, strlen(data))) size = 0;
+
+  // without data, the image has no mip levels and is not drawn
+  if (size == 0) return;
+
+  // load into png, an invalid one is not drawn either
+  PNG png;
+  if ( PNGParser::load(decoded.data(), size, png) ) return;
+  if ( png.width == 0 || png.height == 0 ) return;
+
   // create bitmap texture from png (mip level 0)
-  MipLevel mip_start;
+  image->tex.width  = png.width;
+  image->tex.height = png.height;
+  image->tex.mipmap.push_back(MipLevel());
+
+  MipLevel& mip_start = image->tex.mipmap.back();
   mip_start.width  = png.width;
   mip_start.height = png.height;
-  mip_start.texels = png.pixels;
+  mip_start.texels.swap(png.pixels);
+}
 
-  // add to svg
-  image->tex.width  = mip_start.width;
-  image->tex.height = mip_start.height;
-  image->tex.mipmap.push_back(mip_start);
+// Path data //
+
+// an arc flag, a single 0 or 1 that needs no separator after it
+static const char* parseFlag( const char* p, bool& flag ) {
+  while ( isspace(*p) ) p++;
+  if ( *p != '0' && *p != '1' ) return NULL;
+  flag = *p == '1';
+  return skip_separator( p + 1 );
 }
 
-void SVGParser::parseGroup( XMLElement* xml, Group* group ) {
+// numbers of a path command, after it or after the previous numbers
+static const char* parseNumbers( const char* p, float* values, size_t n ) {
+  for ( size_t i = 0; i < n && p; ++i ) {
+    p = parse_float( p, values[i] );
+    if ( p ) p = skip_separator( p );
+  }
+  return p;
+}
 
-  /* NOTE (sky):
-   * A group contains a list of elements, and optionally a transformation
-   * to apply to all the elements it contains. Elements in a group follow
-   * the same draw order as elements in a svg (top to bottom).  
-   * A group should be considered as one single element outside its scope.
-   * This means at draw time, all elements in a group should be drawn before 
-   * elements outside the group. All elements in the group inherits the group
-   * transformation, and keep in mind that transformation is accumulative.
-   * Groups can also be nested.  
-   */
-  XMLElement* elem = xml->FirstChildElement();
-  while( elem ) {
+static void addSegment( Path* path, PathCommand command, const Vector2D* points, size_t n ) {
+  path->commands.push_back( command );
+  path->points.insert( path->points.end(), points, points + n );
+}
 
-    string elementType ( elem->Value() );
-    if( elementType == "line" ) {
+// The elliptical arc from p0 to p (in the endpoint parameters of the d
+// attribute) as cubics, a quarter turn at most each. The center and angles
+// come from the conversion in the implementation notes of the SVG spec
+// (F.6.5), with radii too small to reach p scaled up (F.6.6).
+static void addArc( Path* path, Vector2D p0, float rx, float ry, float angle,
+                    bool large, bool sweep, Vector2D p ) {
+
+  if ( p0.x == p.x && p0.y == p.y ) return;
+  rx = fabs(rx); ry = fabs(ry);
+  if ( rx == 0 || ry == 0 ) {
+    addSegment( path, PATH_LINE, &p, 1 );
+    return;
+  }
 
-      Line* line = new Line();
-      parseElement( elem, line );
-      parseLine( elem, line );
-      group->elements.push_back( line );
-    
-    } else if( elementType == "polyline" ) {
+  double c = cos(angle * PI / 180), s = sin(angle * PI / 180);
+  double dx = (p0.x - p.x) / 2, dy = (p0.y - p.y) / 2;
+  double x1 = c * dx + s * dy, y1 = -s * dx + c * dy;
+
+  double lambda = x1 * x1 / (rx * rx) + y1 * y1 / (ry * ry);
+  if ( lambda > 1 ) { rx *= sqrt(lambda); ry *= sqrt(lambda); }
+
+  double rx2 = rx * rx, ry2 = ry * ry;
+  double k = sqrt(max((rx2 * ry2 - rx2 * y1 * y1 - ry2 * x1 * x1) /
+                      (rx2 * y1 * y1 + ry2 * x1 * x1), 0.0));
+  if ( large == sweep ) k = -k;
+  double cx1 = k * rx * y1 / ry, cy1 = -k * ry * x1 / rx;
+  double cx = c * cx1 - s * cy1 + (p0.x + p.x) / 2;
+  double cy = s * cx1 + c * cy1 + (p0.y + p.y) / 2;
+
+  double t1 = atan2((y1 - cy1) / ry, (x1 - cx1) / rx);
+  double dt = atan2((-y1 - cy1) / ry, (-x1 - cx1) / rx) - t1;
+  if ( sweep && dt < 0 ) dt += 2 * PI;
+  if ( !sweep && dt > 0 ) dt -= 2 * PI;
+
+  // each piece's control points are along the tangents at its ends
+  int n = max((int) ceil(fabs(dt) / (PI / 2) - 1e-6), 1);
+  double step = dt / n, alpha = 4.0 / 3.0 * tan(step / 4);
+  for ( int i = 0; i < n; ++i ) {
+    double a0 = t1 + i * step, a1 = a0 + step;
+    double u0 = cos(a0), v0 = sin(a0), u1 = cos(a1), v1 = sin(a1);
+    Vector2D q0 ( cx + rx * u0 * c - ry * v0 * s, cy + rx * u0 * s + ry * v0 * c );
+    Vector2D q1 ( cx + rx * u1 * c - ry * v1 * s, cy + rx * u1 * s + ry * v1 * c );
+    Vector2D d0 ( -rx * v0 * c - ry * u0 * s, -rx * v0 * s + ry * u0 * c );
+    Vector2D d1 ( -rx * v1 * c - ry * u1 * s, -rx * v1 * s + ry * u1 * c );
+    Vector2D segment[3] = { q0 + alpha * d0, q1 - alpha * d1, i + 1 < n ? q1 : p };
+    addSegment( path, PATH_CUBIC, segment, 3 );
+  }
+}
 
-      Polyline* polyline = new Polyline();
-      parseElement( elem, polyline );
-      parsePolyline( elem, polyline );
-      group->elements.push_back( polyline );
+void SVGParser::parsePath( XMLElement* xml, Path* path ) {
 
-    } else if( elementType == "rect" ) {
+  // the fill rule, from the style attribute first
+  string rule;
+  if ( !styleProperty( xml->Attribute( "style" ), "fill-rule", rule ) &&
+       xml->Attribute( "fill-rule" ) ) {
+    rule = xml->Attribute( "fill-rule" );
+  }
+  path->fillRule = rule == "evenodd" ? Path::EVENODD : Path::NONZERO;
+
+  const char* p = xml->Attribute( "d" );
+  if ( !p ) return;
+
+  // current point, start of the subpath, and the control point that S and
+  // T reflect (the current point if the last command was not of their kind)
+  Vector2D current, start, control;
+  char command = 0, last = 0;
+  float v[7];
+
+  while ( true ) {
+
+    p = skip_separator( p );
+    if ( !*p ) break;
+
+    // a command letter, or more numbers repeating the last command (a
+    // moveto is followed by implicit linetos)
+    if ( isalpha(*p) ) {
+      command = *p++;
+    } else if ( command == 'M' || command == 'm' ) {
+      command = command == 'M' ? 'L' : 'l';
+    } else if ( !command || command == 'Z' || command == 'z' ) {
+      break;
+    }
 
-      float w = elem->FloatAttribute("width" );
-      float h = elem->FloatAttribute("height");
+    bool relative = islower(command);
+    Vector2D origin = relative ? current : Vector2D();
+    char type = toupper(command);
 
-      // treat zero-size rectangles as points
-      if (w == 0 && h == 0) {
-        Point* point = new Point();
-        parseElement( elem, point );
-        parsePoint( elem, point );
-        group->elements.push_back( point );
-      } else {
-        Rect* rect = new Rect();
-        parseElement( elem, rect );
-        parseRect( elem, rect );
-        group->elements.push_back( rect );
-      }
+    // the first command must be a moveto
+    if ( path->commands.empty() && type != 'M' ) break;
 
-    } else if( elementType == "polygon" ) {
-    
-      Polygon* polygon = new Polygon();
-      parseElement( elem, polygon );
-      parsePolygon( elem, polygon );
-      group->elements.push_back( polygon );
-    
-    } else if( elementType == "ellipse" ) {
-    
-      Ellipse* ellipse = new Ellipse();
-      parseElement( elem, ellipse );
-      parseEllipse( elem, ellipse );
-      group->elements.push_back( ellipse );
+    switch ( type ) {
+      case 'M': {
+        if ( !(p = parseNumbers( p, v, 2 )) ) break;
+        current = start = origin + Vector2D( v[0], v[1] );
+        addSegment( path, PATH_MOVE, &current, 1 );
+        break;
+      }
+      case 'L':
+      case 'H':
+      case 'V': {
+        if ( !(p = parseNumbers( p, v, type == 'L' ? 2 : 1 )) ) break;
+        if ( type == 'L' ) current = origin + Vector2D( v[0], v[1] );
+        else if ( type == 'H' ) current.x = (relative ? current.x : 0) + v[0];
+        else current.y = (relative ? current.y : 0) + v[0];
+        addSegment( path, PATH_LINE, &current, 1 );
+        break;
+      }
+      case 'C':
+      case 'S': {
+        Vector2D c[3];
+        if ( type == 'C' ) {
+          if ( !(p = parseNumbers( p, v, 6 )) ) break;
+          c[0] = origin + Vector2D( v[0], v[1] );
+          c[1] = origin + Vector2D( v[2], v[3] );
+          c[2] = origin + Vector2D( v[4], v[5] );
+        } else {
+          if ( !(p = parseNumbers( p, v, 4 )) ) break;
+          bool smooth = last == 'C' || last == 'S';
+          c[0] = smooth ? 2 * current - control : current;
+          c[1] = origin + Vector2D( v[0], v[1] );
+          c[2] = origin + Vector2D( v[2], v[3] );
+        }
+        addSegment( path, PATH_CUBIC, c, 3 );
+        control = c[1];
+        current = c[2];
+        break;
+      }
+      case 'Q':
+      case 'T': {
+        // a quadratic is the cubic with its control points two thirds of
+        // the way from each end to the quadratic's
+        Vector2D q, end;
+        if ( type == 'Q' ) {
+          if ( !(p = parseNumbers( p, v, 4 )) ) break;
+          q = origin + Vector2D( v[0], v[1] );
+          end = origin + Vector2D( v[2], v[3] );
+        } else {
+          if ( !(p = parseNumbers( p, v, 2 )) ) break;
+          bool smooth = last == 'Q' || last == 'T';
+          q = smooth ? 2 * current - control : current;
+          end = origin + Vector2D( v[0], v[1] );
+        }
+        Vector2D c[3] = { current + 2.0 / 3.0 * (q - current),
+                          end + 2.0 / 3.0 * (q - end), end };
+        addSegment( path, PATH_CUBIC, c, 3 );
+        control = q;
+        current = end;
+        break;
+      }
+      case 'A': {
+        bool large, sweep;
+        if ( !(p = parseNumbers( p, v, 3 )) ||
+             !(p = parseFlag( p, large )) || !(p = parseFlag( p, sweep )) ||
+             !(p = parseNumbers( p, v + 3, 2 )) ) break;
+        Vector2D end = origin + Vector2D( v[3], v[4] );
+        addArc( path, current, v[0], v[1], v[2], large, sweep, end );
+        current = end;
+        break;
+      }
+      case 'Z': {
+        path->commands.push_back( PATH_CLOSE );
+        current = start;
+        break;
+      }
+      default:
+        p = NULL;
+        break;
+    }
 
-    } else if ( elementType == "image" ) {
-    
-      Image* image = new Image();
-      parseElement( elem, image );
-      parseImage( elem, image);
-      group->elements.push_back( image ); 
-    
-    } else if( elementType == "g" ) {
-    
-       Group* sub_group = new Group();
-       parseElement( elem, sub_group );
-       parseGroup( elem, sub_group );
-       group->elements.push_back( sub_group );
-    
-    } else {
-       // unknown element type --- include default handler here if desired
-    }    
-    elem = elem->NextSiblingElement();
+    // like other renderers, draw what came before an error in the data
+    if ( !p ) break;
+    last = type;
   }
 }
 
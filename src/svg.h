@@ -2,9 +2,12 @@
 #define CMU462_SVG_H
 
 #include <map>
+#include <memory>
 #include <vector>
+#include <stdint.h>
 
 #include "color.h"
+#include "arena.h"
 #include "texture.h"
 #include "vector2D.h"
 #include "matrix3x3.h"
@@ -23,7 +26,8 @@ typedef enum e_SVGElementType {
   POLYGON,
   ELLIPSE,
   IMAGE,
-  GROUP
+  GROUP,
+  PATH
 } SVGElementType;
 
 struct Style {
@@ -33,6 +37,54 @@ struct Style {
   float miterLimit;
 };
 
+// a color of a gradient, at offset (0 to 1) along it
+struct GradientStop {
+  float offset;
+  Color color;
+};
+
+/**
+ * Linear or radial gradient, from a <linearGradient> or <radialGradient>
+ * definition. Its geometry is in the bounding box of the element it fills
+ * (0 to 1 across it) or, with userSpace set, in the coordinates of the
+ * element, and in both cases goes through transform (gradientTransform)
+ * first. A linear gradient goes from start (offset 0) to end (offset 1),
+ * a radial one from focus to the circle of center and radius. Past the
+ * ends, spread pads with the end colors, repeats or reflects it.
+ *
+ * Renderers look colors up in the table of 256 colors from offset 0 to 1,
+ * which update() makes from the stops.
+ */
+struct Gradient {
+
+  typedef enum e_Type { LINEAR, RADIAL } Type;
+  typedef enum e_Spread { PAD, REFLECT, REPEAT } Spread;
+
+  Gradient() : type ( LINEAR ), spread ( PAD ), userSpace ( false ),
+               transform ( Matrix3x3::identity() ), start ( 0, 0 ),
+               end ( 1, 0 ), center ( 0.5, 0.5 ), focus ( 0.5, 0.5 ),
+               radius ( 0.5 ) { }
+
+  Type type;
+  Spread spread;
+  bool userSpace;
+  Matrix3x3 transform;
+  Vector2D start, end;    // linear
+  Vector2D center, focus; // radial
+  float radius;
+  std::vector<GradientStop> stops;
+
+  // colors at offsets 0, 1/255, ... 1, and their average (which renderers
+  // that do not draw gradients use instead)
+  static const size_t LUT_SIZE = 256;
+  Color lut[LUT_SIZE];
+  Color average;
+
+  // make the table from the stops
+  void update();
+
+};
+
 struct SVGElement {
 
   SVGElement( SVGElementType _type ) 
@@ -53,9 +105,16 @@ struct SVGElement {
 
 struct Group : SVGElement {
 
-  Group() : SVGElement  ( GROUP ) { }
+  Group() : SVGElement  ( GROUP ), opacity ( 1 ) { }
   std::vector<SVGElement*> elements;
 
+  // Opacity of the group as a whole: its elements are drawn together
+  // into a layer that is composited with it (unlike the fill and stroke
+  // opacities of each element). Kept last, past what the prebuilt
+  // renderers read.
+  float opacity;
+
+  // the elements belong to the arena of the svg, which destroys them
   ~Group();
 
 };
@@ -88,6 +147,9 @@ struct Rect : SVGElement {
   Vector2D position;
   Vector2D dimension;
 
+  // gradient of the fill (see fillGradient)
+  std::shared_ptr<const Gradient> gradient;
+
 };
 
 struct Polygon : SVGElement {
@@ -95,6 +157,9 @@ struct Polygon : SVGElement {
   Polygon() : SVGElement  ( POLYGON ) { }
   std::vector<Vector2D> points;
 
+  // gradient of the fill (see fillGradient)
+  std::shared_ptr<const Gradient> gradient;
+
 };
 
 struct Ellipse : SVGElement {
@@ -114,25 +179,128 @@ struct Image : SVGElement {
   
 };
 
+// Segments of a path, each ending at its last point. Every path command
+// of the d attribute becomes one of these when parsed: H and V are lines,
+// quadratic curves are raised to cubics and arcs are split into cubics.
+typedef enum e_PathCommand {
+  PATH_MOVE = 0, // 1 point, starts a subpath
+  PATH_LINE,     // 1 point
+  PATH_CUBIC,    // 3 points: two control points and the end
+  PATH_CLOSE     // 0 points, back to the start of the subpath
+} PathCommand;
+
+struct Path : SVGElement {
+
+  Path() : SVGElement ( PATH ), id ( new_id() ), fillRule ( NONZERO ) { }
+  std::vector<uint8_t>  commands;
+  std::vector<Vector2D> points;
+
+  // gradient of the fill (see fillGradient)
+  std::shared_ptr<const Gradient> gradient;
+
+  // Identifies the geometry, for renderers caching what they make of it
+  // (see FlatPath). Code changing the commands or points of a path must
+  // call changed() so that caches see a new path.
+  uint64_t id;
+  void changed() { id = new_id(); }
+
+  // The fill is the points the subpaths wind around a nonzero number of
+  // times (counting their directions), or with evenodd the points that
+  // are inside an odd number of them: a subpath inside another cuts a
+  // hole in it under evenodd, or under nonzero if it runs the other way.
+  typedef enum e_FillRule { NONZERO, EVENODD } FillRule;
+  FillRule fillRule;
+
+ private:
+
+  static uint64_t new_id();
+
+};
+
+// Gradient filling an element, NULL if its fill is a flat color. Only
+// rectangles, polygons and paths fill with gradients; the fill color of
+// an element with a gradient is the gradient's average with the opacity
+// of the fill, which the gradient's colors are drawn with. The gradients
+// are the last members of these elements, past what the prebuilt
+// renderers read.
+const Gradient* fillGradient( const SVGElement* element );
+
 struct SVG {
 
   ~SVG();
   float width, height;
   std::vector<SVGElement*> elements;
 
+  // Destroy all the elements and free the arena.
+  void clear();
+
+  // All the elements of the svg, nested ones included, are created in
+  // its arena (see Arena::create) rather than with new.
+  Arena arena;
+
 };
 
+/**
+ * Receiver of the elements of a svg as they are parsed, for consumers that
+ * do not need the whole element tree (rendering or binning a document as
+ * it streams in). Elements are delivered in document order; the contents
+ * of a group come between its begin_group and end_group. Elements and
+ * groups belong to the parser and are reused once their callback (for a
+ * group, its end_group) returns, so a handler that keeps one must copy or
+ * move it out. A nonzero return stops parsing and is returned by stream.
+ */
+class SVGHandler {
+ public:
+
+  virtual ~SVGHandler() { }
+
+  virtual int begin_svg( float /*width*/, float /*height*/ ) { return 0; }
+  virtual int end_svg() { return 0; }
+
+  // the group carries its style and transform, its elements follow
+  virtual int begin_group( Group* /*group*/ ) { return 0; }
+  virtual int end_group( Group* /*group*/ ) { return 0; }
+
+  virtual int element( SVGElement* element ) = 0;
+
+}; // class SVGHandler
+
 class SVGParser {
  public:
 
+  // Both return 0 on success and -1 on failure (file cannot be read, is
+  // not a well-formed svg), or for stream the nonzero value of a handler.
   static int load( const char* filename, SVG* svg );
+  static int stream( const char* filename, SVGHandler& handler );
+
   static int save( const char* filename, const SVG* svg );
+
+  /**
+   * Binary scene cache. A cache file is a flat snapshot of a parsed svg
+   * (elements, point arrays, styles, transforms and all the mip levels of
+   * the images) tagged with the hash of the source file it came from.
+   * Loading one maps the file and copies the arrays out in bulk, with no
+   * text parsing or image decoding. Both return 0 on success and -1 on
+   * failure, which for loadBinary includes a cache made from a different
+   * source (hash mismatch) or by a different version of the format.
+   */
+  static int saveBinary( const char* filename, const SVG* svg, uint64_t source_hash );
+  static int loadBinary( const char* filename, SVG* svg, uint64_t source_hash );
+
+  // hash of the contents of a file, 0 if it cannot be read
+  static uint64_t hashFile( const char* filename );
+
+  /**
+   * Load a svg through a cache directory: the cache entry for the file's
+   * hash is used if there is a valid one, otherwise the file is parsed
+   * and a new entry is written. If a sampler is given, mipmaps are
+   * generated before writing the entry so that they are cached as well.
+   */
+  static int loadCached( const char* filename, SVG* svg,
+                         const char* cache_dir, Sampler2D* sampler = NULL );
  
  private:
   
-  // parse a svg file
-  static void parseSVG       ( XMLElement* xml, SVG* svg );
-
   // parse shared properties of svg elements
   static void parseElement   ( XMLElement* xml, SVGElement* element );
   
@@ -144,8 +312,7 @@ class SVGParser {
   static void parsePolygon   ( XMLElement* xml, Polygon*  polygon     );
   static void parseEllipse   ( XMLElement* xml, Ellipse*  ellipse     );
   static void parseImage     ( XMLElement* xml, Image*    image       );
-  static void parseGroup     ( XMLElement* xml, Group*    group       );
-
+  static void parsePath      ( XMLElement* xml, Path*     path        );
 
 }; // class SVGParser
 
@@ -0,0 +1,620 @@
+#include "svg.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <iostream>
+
+using namespace std;
+
+namespace CMU462 {
+
+// Cache format //
+
+/**
+ * A cache file is a header, followed by one fixed size record per element
+ * (nested elements included, in the same pre-order as the parser visits
+ * them, each group record followed by its children) and a data section
+ * holding the point arrays, path commands, mip levels and gradients (each
+ * stored once, however many elements fill with it), 16 byte aligned.
+ * Records refer to their arrays by offset into the data section.
+ * Everything is stored in native byte order, so a cache is only valid on
+ * the machine type that wrote it, which is what the version number and
+ * the type sizes in it guard against.
+ */
+
+static const char     CACHE_MAGIC[4] = {'S', 'V', 'G', 'C'};
+static const uint32_t CACHE_VERSION  = 5;
+
+struct CacheHeader {
+  char     magic[4];
+  uint32_t version;
+  uint64_t source_hash;
+  float    width, height;
+  uint32_t num_records;   // all elements, nested ones included
+  uint32_t num_elements;  // top level elements
+  uint64_t data_size;     // bytes in the data section
+  uint32_t type_sizes;    // sizes of Vector2D and the element record
+  uint32_t reserved;
+};
+
+struct CacheElement {
+  uint32_t type;
+  uint32_t children;      // number of direct children of a group
+  float    style[10];     // stroke color, fill color, width, miter limit
+  double   transform[9];
+  double   geometry[4];   // two Vector2D, depending on the type (group opacity,
+                          // path commands offset and count, and fill rule)
+  uint64_t offset;        // points or mip table, in the data section
+  uint64_t count;         // number of points or mip levels
+  uint64_t gradient;      // offset of the fill gradient plus one, 0 for none
+};
+
+// a gradient is followed by its stops
+struct CacheGradient {
+  uint32_t type, spread;
+  uint32_t user_space;
+  uint32_t num_stops;
+  double   transform[9];
+  double   geometry[9];   // start, end, center, focus, radius
+};
+
+struct CacheStop {
+  float offset;
+  float color[4];
+};
+
+// an image's mip table starts with the texture size, then one entry
+// per level
+struct CacheMipLevel {
+  uint64_t width, height;
+  uint64_t offset, size;
+};
+
+static const uint32_t CACHE_TYPE_SIZES = sizeof(Vector2D) << 16 | sizeof(CacheElement);
+
+static const size_t CACHE_ALIGN = 16;
+
+// Saving //
+
+static uint64_t append_data( vector<unsigned char>& data, const void* src, size_t size ) {
+  size_t offset = (data.size() + CACHE_ALIGN - 1) & ~(CACHE_ALIGN - 1);
+  data.resize(offset + size);
+  if (size) memcpy(&data[offset], src, size);
+  return offset;
+}
+
+static void set_geometry( CacheElement& r, const Vector2D& a, const Vector2D& b ) {
+  r.geometry[0] = a.x; r.geometry[1] = a.y;
+  r.geometry[2] = b.x; r.geometry[3] = b.y;
+}
+
+// offsets of the gradients saved so far
+typedef map<const Gradient*, uint64_t> GradientOffsets;
+
+static uint64_t append_gradient( vector<unsigned char>& data,
+                                 const Gradient& gradient ) {
+
+  CacheGradient g;
+  memset(&g, 0, sizeof(g));
+  g.type       = gradient.type;
+  g.spread     = gradient.spread;
+  g.user_space = gradient.userSpace;
+  g.num_stops  = gradient.stops.size();
+  for (int k = 0; k < 9; ++k) g.transform[k] = gradient.transform(k / 3, k % 3);
+  g.geometry[0] = gradient.start.x;  g.geometry[1] = gradient.start.y;
+  g.geometry[2] = gradient.end.x;    g.geometry[3] = gradient.end.y;
+  g.geometry[4] = gradient.center.x; g.geometry[5] = gradient.center.y;
+  g.geometry[6] = gradient.focus.x;  g.geometry[7] = gradient.focus.y;
+  g.geometry[8] = gradient.radius;
+
+  vector<CacheStop> stops(gradient.stops.size());
+  for (size_t i = 0; i < stops.size(); ++i) {
+    const GradientStop& stop = gradient.stops[i];
+    stops[i].offset = stop.offset;
+    stops[i].color[0] = stop.color.r; stops[i].color[1] = stop.color.g;
+    stops[i].color[2] = stop.color.b; stops[i].color[3] = stop.color.a;
+  }
+
+  uint64_t offset = append_data(data, &g, sizeof(g));
+  if (!stops.empty()) {
+    data.insert(data.end(), (const unsigned char*) &stops[0],
+                (const unsigned char*) &stops[0] + stops.size() * sizeof(CacheStop));
+  }
+  return offset;
+}
+
+static void serialize( const vector<SVGElement*>& elements,
+                       vector<CacheElement>& records,
+                       vector<unsigned char>& data,
+                       GradientOffsets& gradients ) {
+
+  for (size_t i = 0; i < elements.size(); ++i) {
+
+    const SVGElement* element = elements[i];
+
+    CacheElement r;
+    memset(&r, 0, sizeof(r));
+    r.type = element->type;
+
+    const Style& style = element->style;
+    r.style[0] = style.strokeColor.r; r.style[1] = style.strokeColor.g;
+    r.style[2] = style.strokeColor.b; r.style[3] = style.strokeColor.a;
+    r.style[4] = style.fillColor.r;   r.style[5] = style.fillColor.g;
+    r.style[6] = style.fillColor.b;   r.style[7] = style.fillColor.a;
+    r.style[8] = style.strokeWidth;   r.style[9] = style.miterLimit;
+
+    for (int k = 0; k < 9; ++k) r.transform[k] = element->transform(k / 3, k % 3);
+
+    const Gradient* gradient = fillGradient(element);
+    if (gradient) {
+      GradientOffsets::iterator it = gradients.find(gradient);
+      if (it == gradients.end()) {
+        it = gradients.insert(make_pair(gradient, append_gradient(data, *gradient))).first;
+      }
+      r.gradient = it->second + 1;
+    }
+
+    const vector<SVGElement*>* children = NULL;
+    switch (element->type) {
+      case POINT:
+        set_geometry(r, static_cast<const Point*>(element)->position, Vector2D());
+        break;
+      case LINE: {
+        const Line* line = static_cast<const Line*>(element);
+        set_geometry(r, line->from, line->to);
+        break;
+      }
+      case POLYLINE:
+      case POLYGON: {
+        const vector<Vector2D>& points = element->type == POLYLINE ?
+          static_cast<const Polyline*>(element)->points :
+          static_cast<const Polygon*>(element)->points;
+        r.count  = points.size();
+        r.offset = append_data(data, points.empty() ? NULL : &points[0],
+                               points.size() * sizeof(Vector2D));
+        break;
+      }
+      case RECT: {
+        const Rect* rect = static_cast<const Rect*>(element);
+        set_geometry(r, rect->position, rect->dimension);
+        break;
+      }
+      case ELLIPSE: {
+        const Ellipse* ellipse = static_cast<const Ellipse*>(element);
+        set_geometry(r, ellipse->center, ellipse->radius);
+        break;
+      }
+      case IMAGE: {
+        const Image* image = static_cast<const Image*>(element);
+        set_geometry(r, image->position, image->dimension);
+
+        const Texture& tex = image->tex;
+        vector<CacheMipLevel> table(tex.mipmap.size() + 1);
+        table[0].width  = tex.width;
+        table[0].height = tex.height;
+        for (size_t l = 0; l < tex.mipmap.size(); ++l) {
+          const MipLevel& level = tex.mipmap[l];
+          table[l + 1].width  = level.width;
+          table[l + 1].height = level.height;
+          table[l + 1].size   = level.texels.size();
+          table[l + 1].offset = append_data(data,
+            level.texels.empty() ? NULL : &level.texels[0], level.texels.size());
+        }
+        r.count  = tex.mipmap.size();
+        r.offset = append_data(data, &table[0], table.size() * sizeof(CacheMipLevel));
+        break;
+      }
+      case PATH: {
+        const Path* path = static_cast<const Path*>(element);
+        r.count  = path->points.size();
+        r.offset = append_data(data, path->points.empty() ? NULL : &path->points[0],
+                               path->points.size() * sizeof(Vector2D));
+        r.geometry[1] = path->commands.size();
+        r.geometry[0] = append_data(data, path->commands.empty() ? NULL : &path->commands[0],
+                                    path->commands.size());
+        r.geometry[2] = path->fillRule;
+        break;
+      }
+      case GROUP:
+        children = &static_cast<const Group*>(element)->elements;
+        r.children = children->size();
+        r.geometry[0] = static_cast<const Group*>(element)->opacity;
+        break;
+      default:
+        break;
+    }
+
+    records.push_back(r);
+    if (children) serialize(*children, records, data, gradients);
+  }
+}
+
+int SVGParser::saveBinary( const char* filename, const SVG* svg, uint64_t source_hash ) {
+
+  vector<CacheElement> records;
+  vector<unsigned char> data;
+  GradientOffsets gradients;
+  serialize(svg->elements, records, data, gradients);
+
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_MAGIC, 4);
+  header.version      = CACHE_VERSION;
+  header.source_hash  = source_hash;
+  header.width        = svg->width;
+  header.height       = svg->height;
+  header.num_records  = records.size();
+  header.num_elements = svg->elements.size();
+  header.data_size    = data.size();
+  header.type_sizes   = CACHE_TYPE_SIZES;
+
+  // write to a temporary file and rename it into place, so that a reader
+  // never sees a partially written cache
+  string tmpname = string(filename) + ".XXXXXX";
+  int fd = mkstemp(&tmpname[0]);
+  if (fd < 0) return -1;
+
+  FILE* file = fdopen(fd, "wb");
+  if (!file) {
+    close(fd);
+    unlink(tmpname.c_str());
+    return -1;
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  if (ok && !records.empty()) {
+    ok = fwrite(&records[0], sizeof(CacheElement), records.size(), file) == records.size();
+  }
+  if (ok && !data.empty()) {
+    ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+  }
+  ok = (fclose(file) == 0) && ok;
+
+  if (!ok || rename(tmpname.c_str(), filename) < 0) {
+    unlink(tmpname.c_str());
+    return -1;
+  }
+
+  return 0;
+}
+
+// Loading //
+
+struct CacheView {
+  const CacheElement* records;
+  size_t num_records;
+  size_t next;
+  const unsigned char* data;
+  size_t data_size;
+
+  // gradients loaded so far, by offset
+  map<uint64_t, shared_ptr<const Gradient> > gradients;
+
+  // is the array [offset, offset + count * size) inside the data section?
+  bool contains( uint64_t offset, uint64_t count, size_t size ) const {
+    return offset <= data_size && count <= (data_size - offset) / size;
+  }
+};
+
+static Vector2D get_geometry( const CacheElement& r, int i ) {
+  return Vector2D(r.geometry[2 * i], r.geometry[2 * i + 1]);
+}
+
+static int load_points( const CacheView& view, const CacheElement& r,
+                        vector<Vector2D>& points ) {
+  if (!view.contains(r.offset, r.count, sizeof(Vector2D))) return -1;
+  const Vector2D* src = reinterpret_cast<const Vector2D*>(view.data + r.offset);
+  points.assign(src, src + r.count);
+  return 0;
+}
+
+static int load_texture( const CacheView& view, const CacheElement& r,
+                         Texture& tex ) {
+
+  if (r.count > kMaxMipLevels ||
+      !view.contains(r.offset, r.count + 1, sizeof(CacheMipLevel))) return -1;
+
+  const CacheMipLevel* table =
+    reinterpret_cast<const CacheMipLevel*>(view.data + r.offset);
+  tex.width  = table[0].width;
+  tex.height = table[0].height;
+  tex.mipmap.resize(r.count);
+
+  for (size_t l = 0; l < r.count; ++l) {
+    const CacheMipLevel& entry = table[l + 1];
+    if (!view.contains(entry.offset, entry.size, 1)) return -1;
+    MipLevel& level = tex.mipmap[l];
+    level.width  = entry.width;
+    level.height = entry.height;
+    level.texels.assign(view.data + entry.offset,
+                        view.data + entry.offset + entry.size);
+  }
+
+  return 0;
+}
+
+static int load_gradient( CacheView& view, uint64_t offset,
+                          shared_ptr<const Gradient>& gradient ) {
+
+  map<uint64_t, shared_ptr<const Gradient> >::iterator it = view.gradients.find(offset);
+  if (it != view.gradients.end()) {
+    gradient = it->second;
+    return 0;
+  }
+
+  if (!view.contains(offset, 1, sizeof(CacheGradient))) return -1;
+  const CacheGradient& g = *reinterpret_cast<const CacheGradient*>(view.data + offset);
+  uint64_t stops_offset = offset + sizeof(CacheGradient);
+  if (g.type > Gradient::RADIAL || g.spread > Gradient::REPEAT ||
+      !view.contains(stops_offset, g.num_stops, sizeof(CacheStop))) return -1;
+
+  shared_ptr<Gradient> loaded = make_shared<Gradient>();
+  loaded->type      = (Gradient::Type) g.type;
+  loaded->spread    = (Gradient::Spread) g.spread;
+  loaded->userSpace = g.user_space;
+  for (int k = 0; k < 9; ++k) loaded->transform(k / 3, k % 3) = g.transform[k];
+  loaded->start  = Vector2D(g.geometry[0], g.geometry[1]);
+  loaded->end    = Vector2D(g.geometry[2], g.geometry[3]);
+  loaded->center = Vector2D(g.geometry[4], g.geometry[5]);
+  loaded->focus  = Vector2D(g.geometry[6], g.geometry[7]);
+  loaded->radius = g.geometry[8];
+
+  const CacheStop* stops = reinterpret_cast<const CacheStop*>(view.data + stops_offset);
+  loaded->stops.resize(g.num_stops);
+  for (size_t i = 0; i < g.num_stops; ++i) {
+    loaded->stops[i].offset = stops[i].offset;
+    loaded->stops[i].color  = Color(stops[i].color[0], stops[i].color[1],
+                                    stops[i].color[2], stops[i].color[3]);
+  }
+  loaded->update();
+
+  gradient = view.gradients[offset] = loaded;
+  return 0;
+}
+
+static int deserialize( CacheView& view, size_t count,
+                        vector<SVGElement*>& elements, Arena& arena ) {
+
+  for (size_t i = 0; i < count; ++i) {
+
+    if (view.next >= view.num_records) return -1;
+    const CacheElement& r = view.records[view.next++];
+
+    SVGElement* element;
+    switch (r.type) {
+      case POINT:    element = arena.create<Point>();    break;
+      case LINE:     element = arena.create<Line>();     break;
+      case POLYLINE: element = arena.create<Polyline>(); break;
+      case RECT:     element = arena.create<Rect>();     break;
+      case POLYGON:  element = arena.create<Polygon>();  break;
+      case ELLIPSE:  element = arena.create<Ellipse>();  break;
+      case IMAGE:    element = arena.create<Image>();    break;
+      case GROUP:    element = arena.create<Group>();    break;
+      case PATH:     element = arena.create<Path>();     break;
+      default: return -1;
+    }
+    elements.push_back(element);
+
+    Style& style = element->style;
+    style.strokeColor = Color(r.style[0], r.style[1], r.style[2], r.style[3]);
+    style.fillColor   = Color(r.style[4], r.style[5], r.style[6], r.style[7]);
+    style.strokeWidth = r.style[8];
+    style.miterLimit  = r.style[9];
+
+    for (int k = 0; k < 9; ++k) element->transform(k / 3, k % 3) = r.transform[k];
+
+    int status = 0;
+    switch (r.type) {
+      case POINT:
+        static_cast<Point*>(element)->position = get_geometry(r, 0);
+        break;
+      case LINE:
+        static_cast<Line*>(element)->from = get_geometry(r, 0);
+        static_cast<Line*>(element)->to   = get_geometry(r, 1);
+        break;
+      case POLYLINE:
+        status = load_points(view, r, static_cast<Polyline*>(element)->points);
+        break;
+      case POLYGON:
+        status = load_points(view, r, static_cast<Polygon*>(element)->points);
+        break;
+      case RECT:
+        static_cast<Rect*>(element)->position  = get_geometry(r, 0);
+        static_cast<Rect*>(element)->dimension = get_geometry(r, 1);
+        break;
+      case ELLIPSE:
+        static_cast<Ellipse*>(element)->center = get_geometry(r, 0);
+        static_cast<Ellipse*>(element)->radius = get_geometry(r, 1);
+        break;
+      case IMAGE:
+        static_cast<Image*>(element)->position  = get_geometry(r, 0);
+        static_cast<Image*>(element)->dimension = get_geometry(r, 1);
+        status = load_texture(view, r, static_cast<Image*>(element)->tex);
+        break;
+      case PATH: {
+        Path* path = static_cast<Path*>(element);
+        status = load_points(view, r, path->points);
+        uint64_t offset = r.geometry[0], size = r.geometry[1];
+        if (status == 0 && view.contains(offset, size, 1)) {
+          path->commands.assign(view.data + offset, view.data + offset + size);
+          path->fillRule = r.geometry[2] == Path::EVENODD ? Path::EVENODD : Path::NONZERO;
+        } else {
+          status = -1;
+        }
+        break;
+      }
+      case GROUP:
+        static_cast<Group*>(element)->opacity = r.geometry[0];
+        status = deserialize(view, r.children, static_cast<Group*>(element)->elements,
+                             arena);
+        break;
+    }
+    if (status < 0) return -1;
+
+    if (r.gradient) {
+      shared_ptr<const Gradient>* slot = NULL;
+      switch (r.type) {
+        case RECT:    slot = &static_cast<Rect*>   (element)->gradient; break;
+        case POLYGON: slot = &static_cast<Polygon*>(element)->gradient; break;
+        case PATH:    slot = &static_cast<Path*>   (element)->gradient; break;
+        default: return -1;
+      }
+      if (load_gradient(view, r.gradient - 1, *slot) < 0) return -1;
+    }
+  }
+
+  return 0;
+}
+
+int SVGParser::loadBinary( const char* filename, SVG* svg, uint64_t source_hash ) {
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(CacheHeader)) {
+    close(fd);
+    return -1;
+  }
+
+  size_t size = st.st_size;
+  void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return -1;
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  const unsigned char* bytes = (const unsigned char*) map;
+  const CacheHeader* header = (const CacheHeader*) bytes;
+
+  size_t records_size = (size_t) header->num_records * sizeof(CacheElement);
+  if (memcmp(header->magic, CACHE_MAGIC, 4) ||
+      header->version     != CACHE_VERSION ||
+      header->type_sizes  != CACHE_TYPE_SIZES ||
+      header->source_hash != source_hash ||
+      records_size > size - sizeof(CacheHeader) ||
+      header->data_size != size - sizeof(CacheHeader) - records_size) {
+    munmap(map, size);
+    return -1;
+  }
+
+  CacheView view;
+  view.records     = (const CacheElement*) (bytes + sizeof(CacheHeader));
+  view.num_records = header->num_records;
+  view.next        = 0;
+  view.data        = bytes + sizeof(CacheHeader) + records_size;
+  view.data_size   = header->data_size;
+
+  svg->width  = header->width;
+  svg->height = header->height;
+  int status = deserialize(view, header->num_elements, svg->elements, svg->arena);
+  munmap(map, size);
+
+  if (status < 0) {
+    svg->clear();
+    return -1;
+  }
+
+  return 0;
+}
+
+// Source hashing //
+
+static inline uint64_t rotl64( uint64_t x, int r ) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// word at a time multiplicative hash with a murmur3 style finalizer
+static uint64_t hash_bytes( const unsigned char* bytes, size_t size ) {
+
+  const uint64_t k1 = 0x9e3779b97f4a7c15ULL;
+  const uint64_t k2 = 0xc2b2ae3d27d4eb4fULL;
+
+  uint64_t h = size * k1;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t w; memcpy(&w, bytes + i, 8);
+    h = rotl64(h ^ (w * k2), 31) * k1;
+  }
+  uint64_t w = 0;
+  for (size_t j = 0; i + j < size; ++j) w |= (uint64_t) bytes[i + j] << (8 * j);
+  h = rotl64(h ^ (w * k2), 31) * k1;
+
+  h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h ? h : 1;
+}
+
+uint64_t SVGParser::hashFile( const char* filename ) {
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return 0;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return 0;
+  }
+
+  size_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return hash_bytes(NULL, 0);
+  }
+
+  void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return 0;
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  uint64_t hash = hash_bytes((const unsigned char*) map, size);
+  munmap(map, size);
+  return hash;
+}
+
+// Cached loading //
+
+static void generate_mipmaps( vector<SVGElement*>& elements, Sampler2D* sampler ) {
+  for (size_t i = 0; i < elements.size(); ++i) {
+    if (elements[i]->type == IMAGE) {
+      sampler->generate_mips(static_cast<Image*>(elements[i])->tex, 0);
+    } else if (elements[i]->type == GROUP) {
+      generate_mipmaps(static_cast<Group*>(elements[i])->elements, sampler);
+    }
+  }
+}
+
+int SVGParser::loadCached( const char* filename, SVG* svg,
+                           const char* cache_dir, Sampler2D* sampler ) {
+
+  uint64_t hash = hashFile( filename );
+  if (!hash) return -1;
+
+  // cache entries are named after the source hash
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.svgc", (unsigned long long) hash);
+  string path = cache_dir;
+  if (!path.empty() && path[path.size() - 1] != '/') path.push_back('/');
+  path += name;
+
+  if (loadBinary(path.c_str(), svg, hash) == 0) return 0;
+
+  if (load(filename, svg) < 0) return -1;
+  if (sampler) generate_mipmaps(svg->elements, sampler);
+
+  mkdir(cache_dir, 0755);
+  if (saveBinary(path.c_str(), svg, hash) < 0) {
+    cerr << "Warning: could not write scene cache " << path << endl;
+  }
+
+  return 0;
+}
+
+} // namespace CMU462
@@ -24,6 +24,8 @@ inline void float_to_uint8( unsigned char* dst, float src[4] ) {
   dst_uint8[3] = (uint8_t) ( 255.f * max( 0.0f, min( 1.0f, src[3])));
 }
 
+Sampler2D::~Sampler2D() { }
+
 void Sampler2DImp::generate_mips(Texture& tex, int startLevel) {
 
   // NOTE(sky):
@@ -37,11 +39,13 @@ void Sampler2DImp::generate_mips(Texture& tex, int startLevel) {
   // check start level
   if ( startLevel >= tex.mipmap.size() ) {
     std::cerr << "Invalid start level";
+    return;
   }
 
   // allocate sublevels
   int baseWidth  = tex.mipmap[startLevel].width;
   int baseHeight = tex.mipmap[startLevel].height;
+  if ( baseWidth == 0 || baseHeight == 0 ) return;
   int numSubLevels = (int)(log2f( (float)max(baseWidth, baseHeight)));
 
   numSubLevels = min(numSubLevels, kMaxMipLevels - startLevel - 1);
@@ -126,9 +130,8 @@ Color Sampler2DImp::sample_bilinear(Texture& tex,
   // do index math to get access to nearest texel and its neighbors
   // compute weight based on distance of u,v to texel center.
   // return weighted average of color components.
-  if ( level >= tex.mipmap.size() ) {
-    std::cerr << "Invalid start level";
-  }
+  if ( tex.mipmap.empty() ) return Color(1,0,1,1);
+  if ( level >= tex.mipmap.size() ) level = tex.mipmap.size() - 1;
 
   MipLevel& mip = tex.mipmap[level];
   u = mip.width * u - 0.5;
@@ -136,17 +139,22 @@ Color Sampler2DImp::sample_bilinear(Texture& tex,
   int x = floor(u);
   int y = floor(v);
 
-
   float u_ratio = u - x;
   float v_ratio = v - y;
   float u_opposite = 1 - u_ratio;
   float v_opposite = 1 - v_ratio;
+
+  // clamp to the edge texels
+  int w = mip.width, h = mip.height;
+  int x0 = min(max(x, 0), w - 1), x1 = min(max(x + 1, 0), w - 1);
+  int y0 = min(max(y, 0), h - 1), y1 = min(max(y + 1, 0), h - 1);
+
   unsigned char result[4];
   for (int color_id = 0; color_id < 4; color_id++) {
-    result[color_id] = (mip.texels[4 * (mip.width * y + x) + color_id] * u_opposite +
-                        mip.texels[4 * (mip.width * y + x + 1) + color_id] * u_ratio) * v_opposite
-                      +(mip.texels[4 * (mip.width * (y + 1) + x) + color_id] * u_opposite +
-                        mip.texels[4 * (mip.width * (y + 1) + x + 1) + color_id] * u_ratio) * v_ratio;
+    result[color_id] = (mip.texels[4 * (w * y0 + x0) + color_id] * u_opposite +
+                        mip.texels[4 * (w * y0 + x1) + color_id] * u_ratio) * v_opposite
+                      +(mip.texels[4 * (w * y1 + x0) + color_id] * u_opposite +
+                        mip.texels[4 * (w * y1 + x1) + color_id] * u_ratio) * v_ratio;
   }
 
   Color color;
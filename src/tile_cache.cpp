@@ -0,0 +1,260 @@
+#include "tile_cache.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <omp.h>
+
+using namespace std;
+
+namespace CMU462 {
+
+const int TileCache::TILE_SIZE;
+const int TileCache::LEVELS_PER_OCTAVE;
+
+// how many levels down to look for tiles standing in for a missing one
+static const int FALLBACK_LEVELS = 2 * TileCache::LEVELS_PER_OCTAVE;
+
+// range [begin, end) of view pixels, along one axis, in the same tile
+struct TileRun {
+  int tile, begin, end;
+};
+
+// Split [begin, end) of view pixels along one axis in runs of pixels whose
+// centers fall in the same tile of a level, where view pixel x is at
+// (x + 0.5 - offset) * ratio level pixels.
+static void tile_runs( double offset, double ratio, int begin, int end,
+                       vector<TileRun>& runs ) {
+  runs.clear();
+  for (int x = begin; x < end; ++x) {
+    double l = floor((x + 0.5 - offset) * ratio);
+    int tile = (int) floor(l / TileCache::TILE_SIZE);
+    if (runs.empty() || runs.back().tile != tile) {
+      TileRun run = { tile, x, x + 1 };
+      runs.push_back(run);
+    } else {
+      runs.back().end = x + 1;
+    }
+  }
+}
+
+size_t TileCache::KeyHash::operator()( const Key& k ) const {
+  size_t h = (size_t) k.scene;
+  h = h * 31 + k.sample_rate;
+  h = h * 31 + (size_t) k.level;
+  h = h * 1000003 + (size_t) k.x;
+  h = h * 1000003 + (size_t) k.y;
+  return h;
+}
+
+TileCache::TileCache( Sampler2D* sampler, size_t budget )
+  : budget ( max((size_t) 1, budget / (4 * TILE_SIZE * TILE_SIZE)) ),
+    sampler ( sampler ) { }
+
+TileCache::~TileCache( void ) {
+  for (size_t i = 0; i < renderers.size(); ++i) delete renderers[i];
+}
+
+bool TileCache::can_draw( const Matrix3x3& m ) {
+  return m(0,1) == 0 && m(1,0) == 0 && m(0,0) > 0 && m(0,0) == m(1,1) &&
+         m(2,0) == 0 && m(2,1) == 0 && m(2,2) == 1;
+}
+
+int TileCache::level( double scale ) {
+  return (int) floor(LEVELS_PER_OCTAVE * log2(scale) + 0.5);
+}
+
+double TileCache::level_scale( int level ) {
+  return pow(2.0, (double) level / LEVELS_PER_OCTAVE);
+}
+
+const TileCache::Tile* TileCache::find( const Key& key ) {
+
+  auto it = index.find(key);
+  if (it == index.end()) return NULL;
+
+  tiles.splice(tiles.begin(), tiles, it->second);
+  return &*it->second;
+}
+
+void TileCache::insert( const Key& key, vector<unsigned char>& pixels ) {
+
+  if (index.count(key)) return;
+
+  tiles.push_front(Tile());
+  tiles.front().key = key;
+  tiles.front().pixels.swap(pixels);
+  index[key] = tiles.begin();
+
+  while (tiles.size() > budget) {
+    index.erase(tiles.back().key);
+    tiles.pop_back();
+  }
+}
+
+void TileCache::clear( void ) {
+  tiles.clear();
+  index.clear();
+}
+
+void TileCache::draw( const Tile& tile, const Matrix3x3& canvas_to_screen,
+                      unsigned char* pixels, size_t width,
+                      int x0, int y0, int x1, int y1 ) {
+
+  double ratio = level_scale(tile.key.level) / canvas_to_screen(0,0);
+  double ox = canvas_to_screen(0,2), oy = canvas_to_screen(1,2);
+
+  // tile pixel of every column
+  vector<int> columns(x1 - x0);
+  for (int x = x0; x < x1; ++x) {
+    int c = (int) floor((x + 0.5 - ox) * ratio) - tile.key.x * TILE_SIZE;
+    columns[x - x0] = min(max(c, 0), TILE_SIZE - 1);
+  }
+
+  const uint32_t* src = (const uint32_t*) &tile.pixels[0];
+  for (int y = y0; y < y1; ++y) {
+    int r = (int) floor((y + 0.5 - oy) * ratio) - tile.key.y * TILE_SIZE;
+    const uint32_t* row = src + min(max(r, 0), TILE_SIZE - 1) * TILE_SIZE;
+    uint32_t* dst = (uint32_t*) pixels + y * width;
+    for (int x = x0; x < x1; ++x) dst[x] = row[columns[x - x0]];
+  }
+}
+
+size_t TileCache::composite( const SVGScene& scene, const Matrix3x3& canvas_to_screen,
+                             size_t sample_rate, unsigned char* pixels,
+                             size_t width, size_t height ) {
+
+  memset(pixels, 255, 4 * width * height);
+
+  double ox = canvas_to_screen(0,2), oy = canvas_to_screen(1,2);
+  int top = level(canvas_to_screen(0,0));
+
+  // regions to fill, from a level down
+  struct Region { int level, x0, y0, x1, y1; };
+  vector<Region> regions;
+  Region view = { top, 0, 0, (int) width, (int) height };
+  regions.push_back(view);
+
+  size_t missing = 0;
+  vector<TileRun> columns, rows;
+  while (!regions.empty()) {
+
+    Region region = regions.back();
+    regions.pop_back();
+
+    double ratio = level_scale(region.level) / canvas_to_screen(0,0);
+    tile_runs(ox, ratio, region.x0, region.x1, columns);
+    tile_runs(oy, ratio, region.y0, region.y1, rows);
+
+    for (size_t j = 0; j < rows.size(); ++j) {
+      for (size_t i = 0; i < columns.size(); ++i) {
+
+        Key key = { &scene, sample_rate, region.level,
+                    columns[i].tile, rows[j].tile };
+        const Tile* tile = find(key);
+        if (tile) {
+          draw(*tile, canvas_to_screen, pixels, width,
+               columns[i].begin, rows[j].begin, columns[i].end, rows[j].end);
+          continue;
+        }
+
+        if (region.level == top) missing++;
+
+        // look for it a level down
+        if (region.level > top - FALLBACK_LEVELS) {
+          Region part = { region.level - 1, columns[i].begin, rows[j].begin,
+                          columns[i].end, rows[j].end };
+          regions.push_back(part);
+        }
+      }
+    }
+  }
+
+  return missing;
+}
+
+bool TileCache::render( const SVGScene& scene, const Matrix3x3& canvas_to_screen,
+                        size_t sample_rate, size_t width, size_t height,
+                        const atomic<bool>* cancel ) {
+
+  int lvl = level(canvas_to_screen(0,0));
+  double scale = level_scale(lvl);
+  double ratio = scale / canvas_to_screen(0,0);
+  double ox = canvas_to_screen(0,2), oy = canvas_to_screen(1,2);
+
+  // missing tiles, nearest to the center of the view first
+  vector<TileRun> columns, rows;
+  tile_runs(ox, ratio, 0, width, columns);
+  tile_runs(oy, ratio, 0, height, rows);
+
+  vector<Key> missing; vector<double> distance;
+  for (size_t j = 0; j < rows.size(); ++j) {
+    for (size_t i = 0; i < columns.size(); ++i) {
+      Key key = { &scene, sample_rate, lvl, columns[i].tile, rows[j].tile };
+      if (index.count(key)) continue;
+      double dx = (columns[i].begin + columns[i].end) / 2.0 - width  / 2.0;
+      double dy = (rows[j].begin    + rows[j].end)    / 2.0 - height / 2.0;
+      missing.push_back(key);
+      distance.push_back(dx * dx + dy * dy);
+    }
+  }
+  if (missing.empty()) return true;
+
+  vector<size_t> order(missing.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  sort(order.begin(), order.end(),
+       [&distance] (size_t a, size_t b) { return distance[a] < distance[b]; });
+
+  // per thread renderers, the render target set before the sample rate.
+  // Their sample buffers are sized here, before the threads start, and
+  // reused by every tile they draw (begin_frame only clears them).
+  size_t num_threads = omp_get_max_threads();
+  while (renderers.size() < num_threads) {
+    renderers.push_back(new SoftwareRendererImp());
+    targets.push_back(vector<unsigned char>(4 * TILE_SIZE * TILE_SIZE));
+    renderers.back()->set_tex_sampler(sampler);
+    renderers.back()->set_render_target(&targets.back()[0], TILE_SIZE, TILE_SIZE);
+    renderers.back()->set_sample_rate(sample_rate);
+    sample_rates.push_back(sample_rate);
+  }
+  for (size_t t = 0; t < renderers.size(); ++t) {
+    if (sample_rates[t] != sample_rate) {
+      renderers[t]->set_sample_rate(sample_rate);
+      sample_rates[t] = sample_rate;
+    }
+  }
+
+  vector<vector<unsigned char> > results(missing.size());
+
+  #pragma omp parallel for schedule(dynamic)
+  for (size_t n = 0; n < order.size(); ++n) {
+
+    if (cancel && cancel->load(memory_order_relaxed)) continue;
+
+    int t = omp_get_thread_num();
+    SoftwareRendererImp& renderer = *renderers[t];
+
+    const Key& key = missing[order[n]];
+    Matrix3x3 m = Matrix3x3::identity();
+    m(0,0) = m(1,1) = scale;
+    m(0,2) = -key.x * TILE_SIZE;
+    m(1,2) = -key.y * TILE_SIZE;
+
+    renderer.set_cancel_flag(cancel);
+    renderer.set_canvas_to_screen(m);
+    renderer.draw_scene(scene);
+    if (cancel && cancel->load(memory_order_relaxed)) continue;
+
+    results[order[n]] = targets[t];
+  }
+
+  // keep the tiles that were finished
+  for (size_t i = 0; i < missing.size(); ++i) {
+    if (!results[i].empty()) insert(missing[i], results[i]);
+  }
+
+  return !(cancel && cancel->load());
+}
+
+} // namespace CMU462
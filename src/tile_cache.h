@@ -0,0 +1,113 @@
+#ifndef CMU462_TILE_CACHE_H
+#define CMU462_TILE_CACHE_H
+
+#include <list>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+
+#include "scene.h"
+#include "texture.h"
+#include "software_renderer.h"
+
+namespace CMU462 {
+
+/**
+ * Cache of rendered tiles, for map style navigation of large drawings.
+ *
+ * Tiles are rendered at discrete zoom levels: at level L a canvas unit is
+ * 2^(L / LEVELS_PER_OCTAVE) pixels, and the canvas is cut in square tiles
+ * of TILE_SIZE pixels from its origin. A tile is identified by its scene,
+ * sample rate, level and position. A view is drawn by compositing the
+ * tiles of the level closest to its scale, scaled to it (pixel for pixel
+ * if the view is at that level exactly), and missing tiles are rendered
+ * in parallel. While they are, the tiles of coarser levels that are still
+ * cached stand in for them.
+ *
+ * Tiles are kept up to a memory budget, evicting the least recently used.
+ * Views must be an axis aligned uniform scale and a translation (as in the
+ * viewer); can_draw tells.
+ */
+class TileCache {
+ public:
+
+  static const int TILE_SIZE = 256;
+  static const int LEVELS_PER_OCTAVE = 4;
+
+  TileCache( Sampler2D* sampler, size_t budget = 256 << 20 );
+  ~TileCache( void );
+
+  // whether views drawn with this transformation can be tiled
+  static bool can_draw( const Matrix3x3& canvas_to_screen );
+
+  // level closest to a scale (pixels per canvas unit) and scale of a level
+  static int level( double scale );
+  static double level_scale( int level );
+
+  // Composite the view into pixels (width x height, RGBA) from cached
+  // tiles, coarser ones standing in for missing ones, and white where
+  // there are none. Returns the number of missing tiles.
+  size_t composite( const SVGScene& scene, const Matrix3x3& canvas_to_screen,
+                    size_t sample_rate, unsigned char* pixels,
+                    size_t width, size_t height );
+
+  // Render the missing tiles of the view, in parallel. Tiles finished
+  // before the flag (if any) is set are kept. Returns false if cancelled.
+  bool render( const SVGScene& scene, const Matrix3x3& canvas_to_screen,
+               size_t sample_rate, size_t width, size_t height,
+               const std::atomic<bool>* cancel = NULL );
+
+  // drop all tiles (the scenes they come from changed)
+  void clear( void );
+
+ private:
+
+  struct Key {
+    const SVGScene* scene;
+    size_t sample_rate;
+    int level, x, y;
+    bool operator==( const Key& k ) const {
+      return scene == k.scene && sample_rate == k.sample_rate &&
+             level == k.level && x == k.x && y == k.y;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()( const Key& k ) const;
+  };
+
+  struct Tile {
+    Key key;
+    std::vector<unsigned char> pixels;
+  };
+
+  // tiles, most recently used first
+  std::list<Tile> tiles;
+  std::unordered_map<Key, std::list<Tile>::iterator, KeyHash> index;
+  size_t budget;
+
+  // cached tile, marked as used, NULL if missing
+  const Tile* find( const Key& key );
+  void insert( const Key& key, std::vector<unsigned char>& pixels );
+
+  // tiles of a level covering the view
+  static void visible( const Matrix3x3& canvas_to_screen, int level,
+                       size_t width, size_t height,
+                       int& x0, int& y0, int& x1, int& y1 );
+
+  // draw the part of a tile within [x0, x1) x [y0, y1) of the view
+  static void draw( const Tile& tile, const Matrix3x3& canvas_to_screen,
+                    unsigned char* pixels, size_t width,
+                    int x0, int y0, int x1, int y1 );
+
+  // one renderer (and tile sized target) per thread
+  Sampler2D* sampler;
+  std::vector<SoftwareRendererImp*> renderers;
+  std::vector<std::vector<unsigned char> > targets;
+  std::vector<size_t> sample_rates;
+
+}; // class TileCache
+
+} // namespace CMU462
+
+#endif // CMU462_TILE_CACHE_H
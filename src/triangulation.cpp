@@ -1,4 +1,5 @@
 #include "triangulation.h"
+#include "profiler.h"
 
 #include <vector>
 
@@ -71,6 +72,7 @@ bool snip(const vector<Vector2D>& contour,int u,int v,int w,int n,int *V ) {
 
 void triangulate(const Polygon& polygon, vector<Vector2D>& triangles) {
   
+  PROFILE_SCOPE("triangulate");
   const vector<Vector2D>& contour = polygon.points;
 
   // allocate and initialize list of vertices in polygon
@@ -0,0 +1,141 @@
+#include "xml_reader.h"
+
+#include <cstring>
+
+namespace CMU462 {
+
+static const size_t READ_SIZE = 1 << 16;
+
+typedef enum ScanResult {
+  SCAN_MORE,    // the markup continues past the buffered data
+  SCAN_SKIP,    // comment, processing instruction, CDATA or doctype
+  SCAN_ELEMENT  // element tag
+} ScanResult;
+
+// find a terminator in [s, s + n), returning the offset past it
+static bool find_terminator( const char* s, size_t n, const char* terminator,
+                             size_t& length ) {
+  size_t t = strlen(terminator);
+  for (size_t i = 0; i + t <= n; ) {
+    const char* p = (const char*) memchr(s + i, terminator[0], n + 1 - t - i);
+    if (!p) return false;
+    i = p - s;
+    if (!memcmp(p, terminator, t)) {
+      length = i + t;
+      return true;
+    }
+    i++;
+  }
+  return false;
+}
+
+// Find the end of the markup starting with '<' at s.
+static ScanResult scan_markup( const char* s, size_t n, size_t& length ) {
+
+  if (n < 2) return SCAN_MORE;
+
+  if (s[1] == '?') {
+    return find_terminator(s + 2, n - 2, "?>", length) ?
+           (length += 2, SCAN_SKIP) : SCAN_MORE;
+  }
+
+  if (s[1] == '!') {
+
+    if (n < 4) return SCAN_MORE;
+    if (s[2] == '-' && s[3] == '-') {
+      return find_terminator(s + 4, n - 4, "-->", length) ?
+             (length += 4, SCAN_SKIP) : SCAN_MORE;
+    }
+
+    const char* cdata = "<![CDATA[";
+    if (!memcmp(s, cdata, n < 9 ? n : 9)) {
+      if (n < 9) return SCAN_MORE;
+      return find_terminator(s + 9, n - 9, "]]>", length) ?
+             (length += 9, SCAN_SKIP) : SCAN_MORE;
+    }
+
+    // doctype, possibly with an internal subset in brackets
+    int depth = 0; char quote = 0;
+    for (size_t i = 2; i < n; ++i) {
+      char c = s[i];
+      if (quote) {
+        if (c == quote) quote = 0;
+      } else if (c == '"' || c == '\'') {
+        quote = c;
+      } else if (c == '[') {
+        depth++;
+      } else if (c == ']') {
+        depth--;
+      } else if (c == '>' && depth <= 0) {
+        length = i + 1;
+        return SCAN_SKIP;
+      }
+    }
+    return SCAN_MORE;
+  }
+
+  // element tag: ends at the first '>' outside of an attribute value
+  for (size_t i = 1; i < n; ++i) {
+    char c = s[i];
+    if (c == '"' || c == '\'') {
+      const char* q = (const char*) memchr(s + i + 1, c, n - i - 1);
+      if (!q) return SCAN_MORE;
+      i = q - s;
+    } else if (c == '>') {
+      length = i + 1;
+      return SCAN_ELEMENT;
+    }
+  }
+  return SCAN_MORE;
+}
+
+XMLTagReader::XMLTagReader( FILE* file )
+  : file ( file ), buffer ( READ_SIZE ), begin ( 0 ), end ( 0 ), eof ( false ) { }
+
+bool XMLTagReader::fill() {
+
+  if (eof) return false;
+
+  if (begin > 0) {
+    memmove(&buffer[0], &buffer[begin], end - begin);
+    end -= begin; begin = 0;
+  }
+  if (end == buffer.size()) buffer.resize(2 * buffer.size());
+
+  size_t n = fread(&buffer[end], 1, buffer.size() - end, file);
+  if (n == 0) eof = true;
+  end += n;
+  return n > 0;
+}
+
+XMLTagType XMLTagReader::next( const char*& text, size_t& length ) {
+
+  while (true) {
+
+    // skip character data up to the next markup
+    const char* p = begin < end ?
+      (const char*) memchr(&buffer[begin], '<', end - begin) : NULL;
+    if (!p) {
+      begin = end;
+      if (!fill()) return XML_TAG_EOF;
+      continue;
+    }
+    begin = p - &buffer[0];
+
+    // find its end, reading on until it is complete
+    ScanResult result;
+    while ((result = scan_markup(&buffer[begin], end - begin, length)) == SCAN_MORE) {
+      if (!fill()) return XML_TAG_ERROR;
+    }
+
+    text = &buffer[begin];
+    begin += length;
+    if (result == SCAN_SKIP) continue;
+
+    if (text[1] == '/') return XML_TAG_END;
+    if (length >= 3 && text[length - 2] == '/') return XML_TAG_EMPTY;
+    return XML_TAG_START;
+  }
+}
+
+} // namespace CMU462
@@ -0,0 +1,49 @@
+#ifndef CMU462_XML_READER_H
+#define CMU462_XML_READER_H
+
+#include <stdio.h>
+#include <vector>
+
+namespace CMU462 {
+
+typedef enum XMLTagType {
+  XML_TAG_START,  // <name ...>
+  XML_TAG_EMPTY,  // <name .../>
+  XML_TAG_END,    // </name>
+  XML_TAG_EOF,
+  XML_TAG_ERROR   // markup left open at the end of the file
+} XMLTagType;
+
+/**
+ * Streaming XML tokenizer. Reads a file in chunks and returns its element
+ * tags one at a time, skipping character data, comments, processing
+ * instructions, CDATA sections and the doctype. Only the markup being
+ * scanned is held in memory: the buffer grows to the size of the largest
+ * tag in the file (typically one carrying an embedded image) and the rest
+ * of the file streams through it.
+ */
+class XMLTagReader {
+ public:
+
+  XMLTagReader( FILE* file );
+
+  // Read the next element tag. On success text and length give the whole
+  // tag, from '<' to '>', which stays valid until the next call.
+  XMLTagType next( const char*& text, size_t& length );
+
+ private:
+
+  FILE* file;
+  std::vector<char> buffer;
+  size_t begin, end;  // unread part of the buffer
+  bool eof;
+
+  // move the unread data to the front and read more, growing the buffer
+  // when it is already full; false once the file is exhausted
+  bool fill();
+
+}; // class XMLTagReader
+
+} // namespace CMU462
+
+#endif // CMU462_XML_READER_H